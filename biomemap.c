@@ -0,0 +1,488 @@
+#include "biomemap.h"
+#include "generator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct BiomeMap
+{
+    const BmHeader    *hdr;
+    const BmTileEntry *dir;     // sorted by (tx, tz)
+    uint64_t           dirCount;
+    const char        *base;
+    uint64_t           size;
+    int                fd;
+};
+
+static int64_t floor_div(int64_t v, int64_t d)
+{
+    return v >= 0 ? v / d : -((-v + d - 1) / d);
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+    const BmTileEntry *ea = (const BmTileEntry *)a;
+    const BmTileEntry *eb = (const BmTileEntry *)b;
+    if (ea->tx != eb->tx)
+        return ea->tx < eb->tx ? -1 : 1;
+    if (ea->tz != eb->tz)
+        return ea->tz < eb->tz ? -1 : 1;
+    return 0;
+}
+
+static const BmTileEntry *find_entry(const BmTileEntry *dir, uint64_t n, int tx, int tz)
+{
+    uint64_t lo = 0, hi = n;
+    while (lo < hi)
+    {
+        uint64_t mid = (lo + hi) / 2;
+        const BmTileEntry *e = &dir[mid];
+        if (e->tx < tx || (e->tx == tx && e->tz < tz))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < n && dir[lo].tx == tx && dir[lo].tz == tz)
+        return &dir[lo];
+    return NULL;
+}
+
+// Building ----------------------------------------------------------------
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    FILE *fp;
+    uint64_t end;               // next free byte for a tile block
+    int64_t genSeed;
+    int mc, dim, scale;
+    const int32_t *todo;        // tx, tz pairs still to build
+    int todoCount;
+    int next;
+    BmTileEntry *built;
+    int builtCount;
+    int err;
+} BuildJob;
+
+// Run-length encodes one tile of biome ids (row-major by z). Returns the
+// block size in bytes; block must hold the worst case.
+static size_t encode_tile(const int *ids, char *block, uint8_t present[32])
+{
+    uint32_t *rowStart = (uint32_t *)block;
+    BmRun *runs = (BmRun *)(block + (BM_TILE_CELLS + 1) * sizeof(uint32_t));
+    uint32_t n = 0;
+
+    memset(present, 0, 32);
+    for (int z = 0; z < BM_TILE_CELLS; z++)
+    {
+        rowStart[z] = n;
+        const int *row = ids + (size_t)z * BM_TILE_CELLS;
+        int prev = -2;
+        for (int x = 0; x < BM_TILE_CELLS; x++)
+        {
+            int id = row[x] >= 0 && row[x] < BM_NO_BIOME ? row[x] : BM_NO_BIOME;
+            if (id == prev)
+                continue;
+            runs[n].x = (uint16_t)x;
+            runs[n].biome = (uint8_t)id;
+            runs[n].pad = 0;
+            n++;
+            present[id >> 3] |= (uint8_t)(1u << (id & 7));
+            prev = id;
+        }
+    }
+    rowStart[BM_TILE_CELLS] = n;
+    return (BM_TILE_CELLS + 1) * sizeof(uint32_t) + (size_t)n * sizeof(BmRun);
+}
+
+static void *build_worker(void *arg)
+{
+    BuildJob *job = (BuildJob *)arg;
+
+    Generator g;
+    setupGenerator(&g, job->mc, 0);
+    applySeed(&g, job->dim, (uint64_t)job->genSeed);
+
+    Range r;
+    memset(&r, 0, sizeof(r));
+    r.scale = job->scale;
+    r.sx = BM_TILE_CELLS;
+    r.sz = BM_TILE_CELLS;
+    r.y = job->scale == 1 ? 64 : 64 >> 2;   // sea level, 1:4 above scale 1
+    r.sy = 1;
+
+    int *ids = allocCache(&g, r);
+    char *block = (char *)malloc((BM_TILE_CELLS + 1) * sizeof(uint32_t) +
+        (size_t)BM_TILE_CELLS * BM_TILE_CELLS * sizeof(BmRun));
+    if (!ids || !block)
+    {
+        free(ids);
+        free(block);
+        pthread_mutex_lock(&job->lock);
+        job->err = 1;
+        pthread_mutex_unlock(&job->lock);
+        return NULL;
+    }
+
+    for (;;)
+    {
+        pthread_mutex_lock(&job->lock);
+        int i = job->err ? job->todoCount : job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->todoCount)
+            break;
+
+        BmTileEntry e;
+        memset(&e, 0, sizeof(e));
+        e.tx = job->todo[2 * i];
+        e.tz = job->todo[2 * i + 1];
+        r.x = e.tx * BM_TILE_CELLS;
+        r.z = e.tz * BM_TILE_CELLS;
+        if (genBiomes(&g, ids, r) != 0)
+        {
+            pthread_mutex_lock(&job->lock);
+            job->err = 1;
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        size_t bytes = encode_tile(ids, block, e.present);
+
+        pthread_mutex_lock(&job->lock);
+        e.offset = job->end;
+        if (fseeko(job->fp, (off_t)job->end, SEEK_SET) != 0 ||
+            fwrite(block, 1, bytes, job->fp) != bytes)
+            job->err = 1;
+        else
+        {
+            job->end += bytes;
+            job->built[job->builtCount++] = e;
+        }
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    free(block);
+    free(ids);
+    return NULL;
+}
+
+uint64_t bm_tiles_for_rect(int scale, int64_t x0, int64_t z0, int64_t x1, int64_t z1)
+{
+    if (x1 <= x0 || z1 <= z0)
+        return 0;
+    int64_t span = (int64_t)scale * BM_TILE_CELLS;
+    uint64_t nx = (uint64_t)(floor_div(x1 - 1, span) - floor_div(x0, span) + 1);
+    uint64_t nz = (uint64_t)(floor_div(z1 - 1, span) - floor_div(z0, span) + 1);
+    return nx * nz;
+}
+
+int bm_build(const char *path, int64_t seed, uint64_t genSeed, int mc, int dim,
+    int scale, int64_t x0, int64_t z0, int64_t x1, int64_t z1, int threads)
+{
+    if (x1 <= x0 || z1 <= z0)
+        return 0;
+
+    BmHeader hdr;
+    BmTileEntry *old = NULL;
+    FILE *fp = fopen(path, "r+b");
+    if (fp)
+    {
+        // Keep the existing tiles only if the file describes the same map
+        if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != BM_MAGIC ||
+            hdr.version != BM_FORMAT_VERSION || hdr.seed != seed || hdr.mc != mc ||
+            hdr.dim != dim || hdr.scale != scale || hdr.tileCells != BM_TILE_CELLS)
+        {
+            fclose(fp);
+            fp = NULL;
+        }
+        else if (hdr.dirCount > 0)
+        {
+            old = (BmTileEntry *)malloc((size_t)hdr.dirCount * sizeof(BmTileEntry));
+            if (!old || fseeko(fp, (off_t)hdr.dirOffset, SEEK_SET) != 0 ||
+                fread(old, sizeof(BmTileEntry), (size_t)hdr.dirCount, fp) != hdr.dirCount)
+            {
+                free(old);
+                old = NULL;
+                fclose(fp);
+                fp = NULL;
+            }
+        }
+    }
+    if (!fp)
+    {
+        fp = fopen(path, "w+b");
+        if (!fp)
+        {
+            fprintf(stderr, "Error: cannot create biome map %s\n", path);
+            return -1;
+        }
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = BM_MAGIC;
+        hdr.version = BM_FORMAT_VERSION;
+        hdr.seed = seed;
+        hdr.mc = mc;
+        hdr.dim = dim;
+        hdr.scale = scale;
+        hdr.tileCells = BM_TILE_CELLS;
+        hdr.dirOffset = BM_HEADER_SIZE;
+        hdr.dirCount = 0;
+        if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+        {
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    // Collect the tiles of the rect that the map does not hold yet
+    int64_t span = (int64_t)scale * BM_TILE_CELLS;
+    int64_t tx0 = floor_div(x0, span), tx1 = floor_div(x1 - 1, span);
+    int64_t tz0 = floor_div(z0, span), tz1 = floor_div(z1 - 1, span);
+    uint64_t maxTodo = (uint64_t)(tx1 - tx0 + 1) * (uint64_t)(tz1 - tz0 + 1);
+    int32_t *todo = (int32_t *)malloc((size_t)maxTodo * 2 * sizeof(int32_t));
+    if (!todo)
+    {
+        free(old);
+        fclose(fp);
+        return -1;
+    }
+    int todoCount = 0;
+    for (int64_t tx = tx0; tx <= tx1; tx++)
+    {
+        for (int64_t tz = tz0; tz <= tz1; tz++)
+        {
+            if (find_entry(old, hdr.dirCount, (int)tx, (int)tz))
+                continue;
+            todo[2 * todoCount] = (int32_t)tx;
+            todo[2 * todoCount + 1] = (int32_t)tz;
+            todoCount++;
+        }
+    }
+    if (todoCount == 0)
+    {
+        free(todo);
+        free(old);
+        fclose(fp);
+        return 0;
+    }
+
+    BuildJob job;
+    memset(&job, 0, sizeof(job));
+    pthread_mutex_init(&job.lock, NULL);
+    job.fp = fp;
+    // New blocks go after the old directory, which stays valid until the
+    // header is rewritten to point at the new one
+    job.end = hdr.dirOffset + hdr.dirCount * sizeof(BmTileEntry);
+    job.genSeed = (int64_t)genSeed;
+    job.mc = mc;
+    job.dim = dim;
+    job.scale = scale;
+    job.todo = todo;
+    job.todoCount = todoCount;
+    job.built = (BmTileEntry *)malloc(((size_t)hdr.dirCount + todoCount) * sizeof(BmTileEntry));
+    if (!job.built)
+    {
+        pthread_mutex_destroy(&job.lock);
+        free(todo);
+        free(old);
+        fclose(fp);
+        return -1;
+    }
+    if (hdr.dirCount > 0)
+        memcpy(job.built, old, (size_t)hdr.dirCount * sizeof(BmTileEntry));
+    job.builtCount = (int)hdr.dirCount;
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > todoCount)
+        threads = todoCount;
+    pthread_t *tids = (pthread_t *)malloc((size_t)threads * sizeof(pthread_t));
+    int started = 0;
+    for (int i = 0; tids && i < threads; i++)
+    {
+        if (pthread_create(&tids[i], NULL, build_worker, &job) != 0)
+            break;
+        started++;
+    }
+    if (started == 0)
+        build_worker(&job);
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+    free(tids);
+
+    int built = job.builtCount - (int)hdr.dirCount;
+    qsort(job.built, (size_t)job.builtCount, sizeof(BmTileEntry), entry_cmp);
+    hdr.dirOffset = (job.end + 7) & ~(uint64_t)7;
+    hdr.dirCount = (uint64_t)job.builtCount;
+    if (job.err ||
+        fseeko(fp, (off_t)hdr.dirOffset, SEEK_SET) != 0 ||
+        fwrite(job.built, sizeof(BmTileEntry), (size_t)hdr.dirCount, fp) != hdr.dirCount ||
+        fseeko(fp, 0, SEEK_SET) != 0 ||
+        fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+        job.err = 1;
+    if (fclose(fp) != 0)
+        job.err = 1;
+
+    pthread_mutex_destroy(&job.lock);
+    free(job.built);
+    free(todo);
+    free(old);
+    if (job.err)
+    {
+        fprintf(stderr, "Error: failed to write biome map %s\n", path);
+        return -1;
+    }
+    return built;
+}
+
+// Reading -----------------------------------------------------------------
+
+BiomeMap *bm_open(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (uint64_t)st.st_size < BM_HEADER_SIZE)
+    {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    const BmHeader *h = (const BmHeader *)data;
+    uint64_t size = (uint64_t)st.st_size;
+    if (h->magic != BM_MAGIC || h->version != BM_FORMAT_VERSION ||
+        h->tileCells != BM_TILE_CELLS || h->scale <= 0 ||
+        h->dirOffset + h->dirCount * sizeof(BmTileEntry) > size)
+    {
+        munmap(data, (size_t)st.st_size);
+        close(fd);
+        return NULL;
+    }
+
+    BiomeMap *m = (BiomeMap *)calloc(1, sizeof(BiomeMap));
+    if (!m)
+    {
+        munmap(data, (size_t)st.st_size);
+        close(fd);
+        return NULL;
+    }
+    m->hdr = h;
+    m->base = (const char *)data;
+    m->size = size;
+    m->dir = (const BmTileEntry *)(m->base + h->dirOffset);
+    m->dirCount = h->dirCount;
+    m->fd = fd;
+    return m;
+}
+
+void bm_close(BiomeMap *m)
+{
+    if (!m)
+        return;
+    munmap((void *)m->base, (size_t)m->size);
+    close(m->fd);
+    free(m);
+}
+
+const BmHeader *bm_header(const BiomeMap *m)
+{
+    return m->hdr;
+}
+
+static int tile_biome(const BiomeMap *m, const BmTileEntry *e, int lx, int lz)
+{
+    const char *block = m->base + e->offset;
+    const uint32_t *rowStart = (const uint32_t *)block;
+    const BmRun *runs = (const BmRun *)(block + (BM_TILE_CELLS + 1) * sizeof(uint32_t));
+
+    // Last run of the row starting at or before lx
+    uint32_t lo = rowStart[lz], hi = rowStart[lz + 1];
+    while (hi - lo > 1)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (runs[mid].x <= lx)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return runs[lo].biome;
+}
+
+int bm_get(const BiomeMap *m, int cx, int cz)
+{
+    const BmTileEntry *e = find_entry(m->dir, m->dirCount,
+        (int)floor_div(cx, BM_TILE_CELLS), (int)floor_div(cz, BM_TILE_CELLS));
+    if (!e)
+        return -1;
+    return tile_biome(m, e, cx & (BM_TILE_CELLS - 1), cz & (BM_TILE_CELLS - 1));
+}
+
+int bm_may_be_viable(const BiomeMap *m, const uint8_t viable[256],
+    int blockX, int blockZ, int margin)
+{
+    int scale = m->hdr->scale;
+    int cx = (int)floor_div(blockX, scale);
+    int cz = (int)floor_div(blockZ, scale);
+
+    const BmTileEntry *e = NULL;
+    int etx = 0, etz = 0;
+    for (int z = cz - margin; z <= cz + margin; z++)
+    {
+        for (int x = cx - margin; x <= cx + margin; x++)
+        {
+            int tx = (int)floor_div(x, BM_TILE_CELLS);
+            int tz = (int)floor_div(z, BM_TILE_CELLS);
+            if (!e || tx != etx || tz != etz)
+            {
+                e = find_entry(m->dir, m->dirCount, tx, tz);
+                if (!e)
+                    return 1;
+                etx = tx;
+                etz = tz;
+            }
+            int id = tile_biome(m, e, x & (BM_TILE_CELLS - 1), z & (BM_TILE_CELLS - 1));
+            if (viable[id])
+                return 1;
+        }
+    }
+    return 0;
+}
+
+int bm_rect_may_be_viable(const BiomeMap *m, const uint8_t viable[256],
+    int64_t x0, int64_t z0, int64_t x1, int64_t z1, int margin)
+{
+    if (x1 <= x0 || z1 <= z0)
+        return 0;
+    int64_t scale = m->hdr->scale;
+    int64_t tx0 = floor_div(floor_div(x0, scale) - margin, BM_TILE_CELLS);
+    int64_t tx1 = floor_div(floor_div(x1 - 1, scale) + margin, BM_TILE_CELLS);
+    int64_t tz0 = floor_div(floor_div(z0, scale) - margin, BM_TILE_CELLS);
+    int64_t tz1 = floor_div(floor_div(z1 - 1, scale) + margin, BM_TILE_CELLS);
+
+    for (int64_t tx = tx0; tx <= tx1; tx++)
+    {
+        for (int64_t tz = tz0; tz <= tz1; tz++)
+        {
+            const BmTileEntry *e = find_entry(m->dir, m->dirCount, (int)tx, (int)tz);
+            if (!e)
+                return 1;
+            for (int id = 0; id < 256; id++)
+            {
+                if (viable[id] && (e->present[id >> 3] & (1u << (id & 7))))
+                    return 1;
+            }
+        }
+    }
+    return 0;
+}
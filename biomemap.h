@@ -0,0 +1,88 @@
+#ifndef BIOMEMAP_H_
+#define BIOMEMAP_H_
+
+// Persistent coarse biome map.
+//
+// One file holds the biomes of one seed, version and dimension sampled at
+// a fixed coarse scale (1:16 or 1:64) around sea level. Cells are grouped
+// into tiles of BM_TILE_CELLS x BM_TILE_CELLS; only the tiles a scan
+// needed are present. The file is laid out as
+//
+//     BmHeader                       (fixed, BM_HEADER_SIZE bytes)
+//     tile blocks                    (appended as tiles are built)
+//     BmTileEntry[dirCount]          (sorted by tx, tz; rewritten last)
+//
+// A tile block is a row index, uint32_t rowStart[BM_TILE_CELLS + 1],
+// followed by the run-length encoded rows (BmRun, sorted by x within a
+// row). Every entry also carries the set of biomes present in its tile,
+// so whole tiles can be rejected without decoding them.
+
+#include <stdint.h>
+
+#define BM_MAGIC            0x4d424653u     // "SFBM"
+#define BM_FORMAT_VERSION   2
+#define BM_HEADER_SIZE      64
+#define BM_TILE_SHIFT       10
+#define BM_TILE_CELLS       (1 << BM_TILE_SHIFT)
+#define BM_NO_BIOME         255
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    int64_t  seed;
+    int32_t  mc;
+    int32_t  dim;
+    int32_t  scale;         // blocks per cell
+    int32_t  tileCells;
+    uint64_t dirOffset;
+    uint64_t dirCount;
+    uint8_t  reserved[BM_HEADER_SIZE - 48];
+} BmHeader;
+
+typedef struct
+{
+    int32_t  tx, tz;
+    uint64_t offset;        // start of the tile block
+    uint8_t  present[32];   // bitset of biome ids occurring in the tile
+} BmTileEntry;
+
+typedef struct
+{
+    uint16_t x;             // first cell of the run within the row
+    uint8_t  biome;
+    uint8_t  pad;
+} BmRun;
+
+typedef struct BiomeMap BiomeMap;
+
+// Generates the tiles covering the block rect [x0,x1) x [z0,z1) that are
+// not in the file yet, using up to `threads` threads, and appends them.
+// genSeed is the seed the scanner applies to its generator. Returns the
+// number of tiles built, or -1 on error.
+int bm_build(const char *path, int64_t seed, uint64_t genSeed, int mc, int dim,
+    int scale, int64_t x0, int64_t z0, int64_t x1, int64_t z1, int threads);
+
+// Maps a biome map read-only. Returns NULL if it is missing or invalid.
+BiomeMap *bm_open(const char *path);
+void bm_close(BiomeMap *m);
+const BmHeader *bm_header(const BiomeMap *m);
+
+// Biome of cell (cx, cz), or -1 if its tile is not in the map.
+int bm_get(const BiomeMap *m, int cx, int cz);
+
+// Returns 0 only if every cell within `margin` cells of the block
+// position is in the map and none of them holds a biome flagged in
+// viable[]; 1 means the position has to be checked live.
+int bm_may_be_viable(const BiomeMap *m, const uint8_t viable[256],
+    int blockX, int blockZ, int margin);
+
+// Tile-level version of bm_may_be_viable for the block rect
+// [x0,x1) x [z0,z1), using only the per-tile biome sets.
+int bm_rect_may_be_viable(const BiomeMap *m, const uint8_t viable[256],
+    int64_t x0, int64_t z0, int64_t x1, int64_t z1, int margin);
+
+// Number of map tiles needed to cover the block rect at this scale.
+uint64_t bm_tiles_for_rect(int scale, int64_t x0, int64_t z0, int64_t x1, int64_t z1);
+
+#endif
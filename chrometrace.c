@@ -0,0 +1,145 @@
+#include "chrometrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+typedef struct
+{
+    const char *name;
+    uint64_t start;     // ns since ct_enable
+    uint64_t dur;
+    int64_t arg;
+} CtEvent;
+
+typedef struct CtBuffer
+{
+    struct CtBuffer *next;
+    int tid;
+    char name[32];
+    CtEvent *events;
+    size_t count, cap;
+} CtBuffer;
+
+int ct_on = 0;
+
+static uint64_t g_origin;
+static CtBuffer *g_buffers;     // every thread that recorded a span
+static int g_nextTid;
+static _Thread_local CtBuffer *t_buffer;
+
+#ifdef _WIN32
+static CRITICAL_SECTION g_lock;
+static void ct_lock(void)   { EnterCriticalSection(&g_lock); }
+static void ct_unlock(void) { LeaveCriticalSection(&g_lock); }
+#else
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static void ct_lock(void)   { pthread_mutex_lock(&g_lock); }
+static void ct_unlock(void) { pthread_mutex_unlock(&g_lock); }
+#endif
+
+uint64_t ct_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec - g_origin;
+}
+
+void ct_enable(void)
+{
+#ifdef _WIN32
+    InitializeCriticalSection(&g_lock);
+#endif
+    g_origin = 0;
+    g_origin = ct_now_ns();
+    ct_on = 1;
+}
+
+// The calling thread's buffer, registered on first use
+static CtBuffer *ct_buffer(void)
+{
+    if (t_buffer)
+        return t_buffer;
+    CtBuffer *b = calloc(1, sizeof(CtBuffer));
+    if (!b)
+        return NULL;
+    ct_lock();
+    b->tid = g_nextTid++;
+    b->next = g_buffers;
+    g_buffers = b;
+    ct_unlock();
+    snprintf(b->name, sizeof(b->name), "thread %d", b->tid);
+    t_buffer = b;
+    return b;
+}
+
+void ct_thread_name(const char *name, int n)
+{
+    if (!ct_on)
+        return;
+    CtBuffer *b = ct_buffer();
+    if (!b)
+        return;
+    if (n >= 0)
+        snprintf(b->name, sizeof(b->name), "%s %d", name, n);
+    else
+        snprintf(b->name, sizeof(b->name), "%s", name);
+}
+
+void ct_record(uint64_t start, const char *name, int64_t arg)
+{
+    uint64_t end = ct_now_ns();
+    CtBuffer *b = ct_buffer();
+    if (!b)
+        return;
+    if (b->count == b->cap)
+    {
+        size_t cap = b->cap ? b->cap * 2 : 4096;
+        CtEvent *p = realloc(b->events, cap * sizeof(CtEvent));
+        if (!p)
+            return;     // drop spans rather than disturb the run
+        b->events = p;
+        b->cap = cap;
+    }
+    CtEvent *e = &b->events[b->count++];
+    e->name = name;
+    e->start = start;
+    e->dur = end - start;
+    e->arg = arg;
+}
+
+int ct_write(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return -1;
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+
+    ct_lock();
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    int first = 1;
+    for (CtBuffer *b = g_buffers; b; b = b->next)
+    {
+        fprintf(fp, "%s{\"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"name\": \"thread_name\", "
+            "\"args\": {\"name\": \"%s\"}}", first ? "" : ",\n", b->tid, b->name);
+        first = 0;
+        for (size_t i = 0; i < b->count; i++)
+        {
+            const CtEvent *e = &b->events[i];
+            fprintf(fp, ",\n{\"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"name\": \"%s\", "
+                "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"n\": %lld}}",
+                b->tid, e->name, e->start / 1000.0, e->dur / 1000.0, (long long)e->arg);
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    ct_unlock();
+
+    return fclose(fp) == 0 ? 0 : -1;
+}
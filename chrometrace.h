@@ -0,0 +1,46 @@
+#ifndef CHROMETRACE_H_
+#define CHROMETRACE_H_
+
+// Opt-in timeline capture in Chrome trace format (chrome://tracing,
+// Perfetto). Spans are recorded into per-thread buffers without locking
+// and written out once, at exit:
+//
+//     uint64_t t = ct_begin();
+//     ... work ...
+//     ct_end(t, "tile", tileIndex);
+//
+// While tracing is off ct_begin and ct_end reduce to one predictable
+// branch on a global flag.
+
+#include <stdint.h>
+
+extern int ct_on;
+
+// Turns tracing on; call before the threads to be traced start.
+void ct_enable(void);
+
+// Names the calling thread in the trace, e.g. ct_thread_name("scan", 3).
+// n < 0 leaves the number off.
+void ct_thread_name(const char *name, int n);
+
+uint64_t ct_now_ns(void);
+
+// Records a span from start to now. name must stay valid until ct_write;
+// arg is shown with the span.
+void ct_record(uint64_t start, const char *name, int64_t arg);
+
+static inline uint64_t ct_begin(void)
+{
+    return ct_on ? ct_now_ns() : 0;
+}
+
+static inline void ct_end(uint64_t start, const char *name, int64_t arg)
+{
+    if (ct_on)
+        ct_record(start, name, arg);
+}
+
+// Writes every recorded span as Chrome trace JSON. Returns 0 on success.
+int ct_write(const char *path);
+
+#endif
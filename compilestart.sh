@@ -13,12 +13,28 @@ fi
 
 echo ""
 echo "=== Building structure_finder ==="
-cc -O3 -march=native -ffast-math -flto -o structure_finder structure_finder.c libcubiomes.a -lm -pthread
+cc -O3 -march=native -ffast-math -flto -o structure_finder structure_finder.c sfscan.c tilestore.c biomemap.c regionbitmap.c promfile.c chrometrace.c perfcount.c libcubiomes.a -lm -pthread
 if [ $? -ne 0 ]; then
     echo "ERROR: Failed to build structure_finder"
     exit 1
 fi
 
+echo ""
+echo "=== Building seedsweep ==="
+cc -O3 -march=native -ffast-math -flto -o seedsweep seedsweep.c libcubiomes.a -lm -pthread
+if [ $? -ne 0 ]; then
+    echo "ERROR: Failed to build seedsweep"
+    exit 1
+fi
+
+echo ""
+echo "=== Building storequery ==="
+cc -O3 -march=native -o storequery storequery.c tilestore.c regionbitmap.c
+if [ $? -ne 0 ]; then
+    echo "ERROR: Failed to build storequery"
+    exit 1
+fi
+
 echo ""
 echo "=== Building groupfinder ==="
 make -C findgroups
@@ -31,4 +47,6 @@ echo ""
 echo "=== Build Complete ==="
 echo ""
 echo "Run: ./structure_finder"
+echo "Run: ./seedsweep"
+echo "Run: ./storequery <store.sfts> minX minZ maxX maxZ"
 echo "Run: cd findgroups && ./groupfinder"
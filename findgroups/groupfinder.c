@@ -16,23 +16,37 @@
 #include <stdbool.h>
 #include <math.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <time.h>
 #include <errno.h>
+#include <dirent.h>
+#include <glob.h>
+
+#include "../tilestore.h"
+#include "../regionbitmap.h"
+#include "../promfile.h"
+#include "../chrometrace.h"
+#include "../perfcount.h"
 
 #if defined(__APPLE__)
 #include <sys/sysctl.h>
 #endif
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 /* ============================================================================
  * Configuration - Auto-tuned at runtime
  * ========================================================================== */
 
 #define MAX_LINE_LENGTH 256
 #define AVG_BYTES_PER_LINE 35
+#define CACHE_LINE 64
 
 /* Memory thresholds */
 #define HIGH_MEM_THRESHOLD  (64ULL * 1024 * 1024 * 1024)   /* 64 GB */
@@ -79,10 +93,10 @@ typedef struct {
     int64_t cellZ;
     uint32_t start;
     uint32_t count;
-    uint32_t next;
 } CellEntry;
 
-/* Thread work */
+/* Thread work, one cache-line aligned slot per worker so the counters
+ * each worker updates never share a line with another worker's */
 typedef struct {
     int thread_id;
     int num_threads;
@@ -90,36 +104,86 @@ typedef struct {
     uint64_t num_structures;
     CellEntry *cells;
     uint64_t num_cells;
-    uint32_t *hash_table;
-    uint64_t hash_table_size;
     int64_t radius;
     int64_t radius_sq;
     int64_t cell_size;
     FILE *output;
     pthread_mutex_t *output_lock;
-    uint64_t groups_found_3;
-    uint64_t groups_found_4;
-    uint64_t cells_processed;
+    _Atomic uint64_t groups_found_3;
+    _Atomic uint64_t groups_found_4;
+    _Atomic uint64_t cells_processed;   /* read by the progress thread */
+    const uint32_t *order;      /* cells in search order, NULL = row-major */
+    const uint32_t *row_up;     /* with order, seeds the row cursors */
     uint32_t *neighbors_buf;
     uint32_t neighbors_buf_size;
-} ThreadWork;
+} __attribute__((aligned(CACHE_LINE))) ThreadWork;
 
 /* Globals */
-static pthread_mutex_t g_progress_lock = PTHREAD_MUTEX_INITIALIZER;
 static uint64_t g_total_cells = 0;
-static uint64_t g_processed_cells = 0;
-static volatile int g_done = 0;
+static atomic_int g_done = 0;
+static const char *g_prom_path = NULL;     /* optional Prometheus textfile */
+static int g_prom_interval = 0;
+static _Atomic(const char *) g_prom_phase = "parse";
+static _Atomic(ThreadWork *) g_prom_work = NULL;   /* set for the search */
+static atomic_int g_prom_stop = 0;
+static pthread_t g_prom_tid;
+static bool g_prom_running = false;
 static struct timespec g_start_time;
+static struct timespec g_total_start;      /* start of parsing, for time to first group */
+static double g_first_group = -1.0;        /* seconds; written under the output lock */
 
 static void *g_structures = NULL;
 static uint64_t g_structures_count = 0;
 static uint64_t g_structures_capacity = 0;
 static CellEntry *g_cells = NULL;
 static uint64_t g_cells_count = 0;
-static uint32_t *g_hash_table = NULL;
-static uint64_t g_hash_table_size = 0;
 static int64_t g_cell_size = 0;
 
+/* Forward half-neighbourhood of a cell: rows cellX .. cellX + rows - 1,
+ * row dx reaching reach[dx] cells either side in cellZ (only forward in
+ * the cell's own row). See sweep_setup. */
+#define MAX_SWEEP_ROWS 4
+static int g_sweep_rows = 0;
+static int g_sweep_reach[MAX_SWEEP_ROWS];
+
+/* Search work is handed out in runs of this many consecutive cells */
+#define SEARCH_BATCH 1024
+static _Atomic uint64_t g_next_cell = 0;
+
+/* Optional Hilbert curve layout: cells in curve order, with their records
+ * laid out in the same order. g_cells itself stays row-major. */
+static bool g_hilbert = false;
+static uint32_t *g_cell_order = NULL;
+static uint32_t *g_row_up = NULL;      /* per cell: where the next row starts */
+
+/* Pre-sorted runs: structure_finder can write its text files in cell order,
+ * each starting with a "#sorted cell=<size>" line. Concatenated files keep
+ * their header lines, so every header marks the start of one sorted run. */
+static int64_t g_run_cell = 0;          /* 0 = no runs, -1 = not usable */
+static uint64_t *g_run_starts = NULL;
+static uint64_t g_run_count = 0;
+static uint64_t g_run_capacity = 0;
+
+/* Structure types, interned from the label in front of "->" in the order
+ * they first appear. Labels past the 256th share the last id, and labels
+ * are cut to 31 bytes; warn_type_table reports either once. */
+#define MAX_TYPES 256
+#define TYPE_NAME_LEN 32
+
+typedef struct {
+    char name[MAX_TYPES][TYPE_NAME_LEN];
+    uint64_t count[MAX_TYPES];
+    int n;
+    int last;                   /* labels come in runs: try this one first */
+    bool overflowed;            /* a label past the 256th got the last id */
+    bool truncated;             /* a label was cut to TYPE_NAME_LEN - 1 bytes */
+} TypeTable;
+
+static TypeTable g_type_table;
+/* One type id per structure, parallel to g_structures; only kept when the
+ * input has more than one type */
+static uint8_t *g_types = NULL;
+
 /* ============================================================================
  * System Detection
  * ========================================================================== */
@@ -145,20 +209,19 @@ static void detect_and_configure(uint64_t estimated_structures)
 {
     g_system_memory = get_system_memory();
     
+    uint64_t cell_mem = sizeof(CellEntry);
+
     /* Estimate memory needed for high-perf mode */
     uint64_t high_perf_mem = estimated_structures * sizeof(StructureFast) +
-                             estimated_structures * sizeof(CellEntry) +
-                             (1ULL << 27) * sizeof(uint32_t);  /* Max hash table */
+                             estimated_structures * cell_mem;
     
     /* Estimate for balanced mode */
     uint64_t balanced_mem = estimated_structures * sizeof(StructureFast) +
-                            (estimated_structures / 4) * sizeof(CellEntry) +
-                            (1ULL << 26) * sizeof(uint32_t);
+                            (estimated_structures / 4) * cell_mem;
     
     /* Estimate for low-mem mode */
     uint64_t low_mem_need = estimated_structures * sizeof(StructureCompact) +
-                            (estimated_structures / 16) * sizeof(CellEntry) +
-                            (1ULL << 24) * sizeof(uint32_t);
+                            (estimated_structures / 16) * cell_mem;
     
     /* Leave 20% headroom for OS and other processes */
     uint64_t available = (g_system_memory * 80) / 100;
@@ -178,8 +241,7 @@ static void detect_and_configure(uint64_t estimated_structures)
     while (low_mem_need > available && g_cell_multiplier < 16) {
         g_cell_multiplier *= 2;
         low_mem_need = estimated_structures * sizeof(StructureCompact) +
-                       (estimated_structures / (g_cell_multiplier * g_cell_multiplier)) * sizeof(CellEntry) +
-                       (1ULL << 22) * sizeof(uint32_t);
+                       (estimated_structures / (g_cell_multiplier * g_cell_multiplier)) * cell_mem;
     }
     
     const char *mode_str = (g_mode == MODE_HIGH_PERF) ? "HIGH PERFORMANCE" :
@@ -207,16 +269,59 @@ static inline int64_t coord_to_cell(int32_t coord, int64_t cell_size)
     return (coord - cell_size + 1) / cell_size;
 }
 
-static inline uint64_t hash_cell(int64_t cx, int64_t cz, uint64_t table_size)
+/* coord_to_cell without a division: a multiply by the reciprocal, then a
+ * fix-up step so the result is exactly floor(coord / cell_size) */
+typedef struct {
+    int64_t cell_size;
+    double inv;
+} CellDiv;
+
+static inline int64_t cell_of(const CellDiv *d, int32_t coord)
+{
+    int64_t c = (int64_t)floor(coord * d->inv);
+    if (c * d->cell_size > coord) c--;
+    else if ((c + 1) * d->cell_size <= coord) c++;
+    return c;
+}
+
+/* Coarse buckets of whole cell columns, so parse threads can count records
+ * per bucket and place them bucket by bucket. Stripes of 2^shift cells
+ * cover x in [-2^25, 2^25), past the world border; bucket 0 and the last
+ * bucket take whatever lies below or above. */
+typedef struct {
+    CellDiv div;
+    int64_t lo;                 /* first cell of the first stripe */
+    int shift;
+    uint32_t stripes;
+    uint32_t count;             /* stripes + 2 */
+} Bucketing;
+
+static void bucketing_init(Bucketing *b, int64_t cell_size)
+{
+    b->div.cell_size = cell_size;
+    b->div.inv = 1.0 / (double)cell_size;
+    b->shift = 0;
+    while (((int64_t)1 << b->shift) * cell_size < 4096)
+        b->shift++;
+    b->lo = coord_to_cell(-(1 << 25), cell_size);
+    int64_t cells = coord_to_cell((1 << 25) - 1, cell_size) - b->lo + 1;
+    b->stripes = (uint32_t)((cells + ((int64_t)1 << b->shift) - 1) >> b->shift);
+    b->count = b->stripes + 2;
+}
+
+static inline uint32_t bucket_of(const Bucketing *b, int32_t x)
 {
-    uint64_t h = 14695981039346656037ULL;
-    h ^= (uint64_t)cx;
-    h *= 1099511628211ULL;
-    h ^= (uint64_t)cz;
-    h *= 1099511628211ULL;
-    return h & (table_size - 1);
+    int64_t c = cell_of(&b->div, x) - b->lo;
+    if (c < 0) return 0;
+    uint64_t s = (uint64_t)c >> b->shift;
+    return s < b->stripes ? (uint32_t)s + 1 : b->stripes + 1;
 }
 
+/* Set when the parse placed the records bucket by bucket for
+ * g_bucketing.div.cell_size; bucket b is [starts[b], starts[b + 1]) */
+static Bucketing g_bucketing;
+static uint64_t *g_bucket_starts = NULL;
+
 static double elapsed_seconds(void)
 {
     struct timespec now;
@@ -244,6 +349,43 @@ static void print_progress(const char *phase, uint64_t current, uint64_t total)
     fflush(stderr);
 }
 
+/* Phase the parse and index helper threads charge their hardware counters
+ * to; main sets it before the phase starts any threads */
+static const char *g_perf_phase = "parse_file";
+
+/* Hardware counters of one helper thread, from its start to its end. The
+ * units of work are added by main, so helpers add none. */
+typedef struct {
+    PerfGroup g;
+    PerfSample start;
+    bool on;
+} HelperPerf;
+
+static void helper_perf_begin(HelperPerf *h)
+{
+    h->on = pc_open(&h->g) == 0;
+    if (h->on)
+        pc_read(&h->g, &h->start);
+}
+
+static void helper_perf_end(HelperPerf *h)
+{
+    if (!h->on)
+        return;
+    PerfSample end;
+    pc_read(&h->g, &end);
+    pc_phase_add(g_perf_phase, "structure", &h->start, &end, 0);
+    pc_close(&h->g);
+}
+
+/* Counters in ThreadWork have a single writer: a relaxed load/store pair
+ * is enough and avoids a locked instruction per update */
+static inline void counter_inc(_Atomic uint64_t *c)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
 /* ============================================================================
  * Memory Management
  * ========================================================================== */
@@ -254,60 +396,51 @@ static size_t structure_size(void)
            sizeof(StructureFast) : sizeof(StructureCompact);
 }
 
-static bool preallocate_structures(size_t file_size)
+static int type_intern(TypeTable *t, const char *label, size_t len)
 {
-    uint64_t estimated_count = file_size / AVG_BYTES_PER_LINE;
-    uint64_t cap = (estimated_count * 11) / 10;
-    if (cap < 1024) cap = 1024;
-    
-    /* Round up to power of 2 */
-    uint64_t p2 = 1;
-    while (p2 < cap) p2 *= 2;
-    cap = p2;
-    
-    size_t elem_size = structure_size();
-    g_structures = malloc(cap * elem_size);
-    if (!g_structures) {
-        fprintf(stderr, "Error: Failed to allocate %.2f GB for structures\n",
-                (cap * elem_size) / (1024.0 * 1024.0 * 1024.0));
-        return false;
+    if (len >= TYPE_NAME_LEN) {
+        len = TYPE_NAME_LEN - 1;
+        t->truncated = true;
     }
-    
-    g_structures_capacity = cap;
-    fprintf(stderr, "Allocated %.2f GB for ~%lu structures\n",
-            (cap * elem_size) / (1024.0 * 1024.0 * 1024.0),
-            (unsigned long)estimated_count);
-    
-    return true;
+    if (t->n > 0 && memcmp(t->name[t->last], label, len) == 0 && t->name[t->last][len] == '\0')
+        return t->last;
+    for (int i = 0; i < t->n; i++) {
+        if (memcmp(t->name[i], label, len) == 0 && t->name[i][len] == '\0') {
+            t->last = i;
+            return i;
+        }
+    }
+    if (t->n == MAX_TYPES) {
+        t->overflowed = true;
+        return MAX_TYPES - 1;
+    }
+    memcpy(t->name[t->n], label, len);
+    t->name[t->n][len] = '\0';
+    t->last = t->n;
+    return t->n++;
 }
 
-static bool ensure_capacity(uint64_t needed)
+/* Labels merged by type_intern are written out under one name */
+static void warn_type_table(const TypeTable *t)
 {
-    if (needed <= g_structures_capacity)
-        return true;
-
-    uint64_t new_cap = g_structures_capacity ? g_structures_capacity : 1024;
-    while (new_cap < needed)
-        new_cap *= 2;
-
-    size_t elem_size = structure_size();
-    void *new_arr = realloc(g_structures, new_cap * elem_size);
-    if (!new_arr)
-        return false;
-
-    g_structures = new_arr;
-    g_structures_capacity = new_cap;
-    return true;
+    if (t->truncated)
+        fprintf(stderr, "Warning: structure labels of %d or more characters were cut to %d; "
+                "labels that only differ after that count as one type\n",
+                TYPE_NAME_LEN, TYPE_NAME_LEN - 1);
+    if (t->overflowed)
+        fprintf(stderr, "Warning: more than %d structure labels; the labels after the "
+                "%dth count as \"%s\"\n", MAX_TYPES, MAX_TYPES, t->name[MAX_TYPES - 1]);
 }
 
 /* ============================================================================
  * File Parsing
  * ========================================================================== */
 
-static bool parse_line(const char *line, int32_t *x, int32_t *z)
+static bool parse_line(const char *line, int32_t *x, int32_t *z, size_t *label_len)
 {
     const char *arrow = strstr(line, "->");
     if (!arrow) return false;
+    *label_len = (size_t)(arrow - line);
 
     const char *p = arrow + 2;
     if (*p != '(') return false;
@@ -326,151 +459,2091 @@ static bool parse_line(const char *line, int32_t *x, int32_t *z)
     return true;
 }
 
-static uint64_t parse_file(const char *filename)
+/* Vectorized parser for the exact "label->(x,z)reg(rx,rz)" lines written by
+ * structure_finder. One pass of byte compares over a 64-byte window finds
+ * the newline and every delimiter; the two numbers are then decoded by
+ * hand. Anything unusual (long lines, '+' or spaces, more than 10 digits,
+ * the end of the mapping) is left to parse_line, so both give the same
+ * records. */
+#define FAST_WINDOW 64
+
+static bool g_simd_parse = true;    /* off only for the parse benchmark */
+
+typedef struct {
+    uint64_t nl, dash, gt, comma, close, nul;
+} LineMasks;
+
+#if defined(__AVX2__)
+static inline void line_masks(const char *p, LineMasks *m)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i *)p);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));
+#define MASK64(c) ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, _mm256_set1_epi8(c))) | \
+                   (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, _mm256_set1_epi8(c))) << 32)
+    m->nl = MASK64('\n');
+    m->dash = MASK64('-');
+    m->gt = MASK64('>');
+    m->comma = MASK64(',');
+    m->close = MASK64(')');
+    m->nul = MASK64('\0');
+#undef MASK64
+}
+#elif defined(__SSE2__)
+static inline void line_masks(const char *p, LineMasks *m)
+{
+    __m128i v[4];
+    for (int i = 0; i < 4; i++)
+        v[i] = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+#define MASK64(c) ((uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v[0], _mm_set1_epi8(c))) | \
+                   (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v[1], _mm_set1_epi8(c))) << 16 | \
+                   (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v[2], _mm_set1_epi8(c))) << 32 | \
+                   (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v[3], _mm_set1_epi8(c))) << 48)
+    m->nl = MASK64('\n');
+    m->dash = MASK64('-');
+    m->gt = MASK64('>');
+    m->comma = MASK64(',');
+    m->close = MASK64(')');
+    m->nul = MASK64('\0');
+#undef MASK64
+}
+#else
+static inline void line_masks(const char *p, LineMasks *m)
+{
+    memset(m, 0, sizeof(*m));
+    for (int i = 0; i < FAST_WINDOW; i++) {
+        uint64_t bit = 1ULL << i;
+        switch (p[i]) {
+        case '\n': m->nl |= bit; break;
+        case '-': m->dash |= bit; break;
+        case '>': m->gt |= bit; break;
+        case ',': m->comma |= bit; break;
+        case ')': m->close |= bit; break;
+        case '\0': m->nul |= bit; break;
+        }
+    }
+}
+#endif
+
+/* [-]digits with 1 to 10 digits, so the value fits a long as with strtol */
+static inline bool decode_int(const char *s, const char *e, int32_t *out)
+{
+    bool neg = (s < e && *s == '-');
+    if (neg) s++;
+    if (e - s < 1 || e - s > 10) return false;
+    int64_t v = 0;
+    for (; s < e; s++) {
+        unsigned d = (unsigned char)*s - '0';
+        if (d > 9) return false;
+        v = v * 10 + d;
+    }
+    *out = (int32_t)(neg ? -v : v);
+    return true;
+}
+
+/* Parses the line at p, which must not start with '#'. Returns true and
+ * sets *eol to its newline if it is a well-formed record; false means the
+ * caller has to take the parse_line path. limit is the end of the mapping. */
+static inline bool parse_line_fast(const char *p, const char *limit, const char **eol,
+                                   int32_t *x, int32_t *z, size_t *label_len)
+{
+    if (limit - p < FAST_WINDOW)
+        return false;
+    LineMasks m;
+    line_masks(p, &m);
+    if (!m.nl)
+        return false;
+    int nl = __builtin_ctzll(m.nl);
+    uint64_t line = (1ULL << nl) - 1;
+
+    uint64_t arrow = m.dash & (m.gt >> 1) & line;
+    if (!arrow)
+        return false;
+    int open = __builtin_ctzll(arrow) + 2;
+    if (open + 1 >= nl || p[open] != '(')
+        return false;
+
+    uint64_t after = ~((2ULL << open) - 1);
+    uint64_t comma = m.comma & line & after;
+    if (!comma)
+        return false;
+    int c = __builtin_ctzll(comma);
+    uint64_t close = m.close & line & ~((2ULL << c) - 1);
+    if (!close)
+        return false;
+    int e = __builtin_ctzll(close);
+    /* strstr and strtol stop at a NUL byte */
+    if (m.nul & ((2ULL << e) - 1))
+        return false;
+
+    if (!decode_int(p + open + 1, p + c, x) || !decode_int(p + c + 1, p + e, z))
+        return false;
+    *label_len = (size_t)(open - 2);
+    *eol = p + nl;
+    return true;
+}
+
+/* Records the start of a sorted run at index start; runs must all use the
+ * same cell size */
+static void note_run_start(long cell, uint64_t start)
+{
+    if (g_run_cell < 0)
+        return;
+    if (cell <= 0 || (g_run_cell != 0 && g_run_cell != cell)) {
+        g_run_cell = -1;
+        return;
+    }
+    if (g_run_count == g_run_capacity) {
+        uint64_t cap = g_run_capacity ? g_run_capacity * 2 : 64;
+        uint64_t *p = realloc(g_run_starts, cap * sizeof(uint64_t));
+        if (!p) {
+            g_run_cell = -1;
+            return;
+        }
+        g_run_starts = p;
+        g_run_capacity = cap;
+    }
+    g_run_cell = cell;
+    g_run_starts[g_run_count++] = start;
+}
+
+/* A "#sorted cell=" line seen by a parse thread, replayed in file order */
+typedef struct {
+    uint64_t index;             /* records before it in the chunk */
+    long cell;
+} RunMark;
+
+/* One newline-aligned slice of the mapped file and what it parsed to */
+typedef struct {
+    const char *begin;
+    const char *end;
+    const char *limit;          /* end of the mapping, for the fast parser */
+    void *recs;
+    uint8_t *types;             /* ids into tt, one per record */
+    uint64_t count;
+    uint64_t capacity;
+    TypeTable *tt;              /* labels seen in this chunk */
+    uint64_t *hist;             /* records per bucket, then next slot per bucket */
+    uint64_t last_label[2];     /* previous label's first 16 bytes, zero padded */
+    size_t last_len;
+    int last_type;
+    bool last_valid;
+    RunMark *marks;
+    uint64_t mark_count;
+    uint64_t mark_capacity;
+    bool leading_records;       /* records before the chunk's first header */
+    bool runs_lost;             /* a header could not be kept */
+    bool failed;
+    bool threaded;
+    void *dst;                  /* copy-out target, set after the prefix sum */
+    uint8_t *types_dst;
+    uint8_t map[MAX_TYPES];     /* tt ids to g_type_table ids */
+    _Atomic uint64_t bytes_done;    /* read by the main thread for progress */
+} ParseChunk;
+
+static bool chunk_push(ParseChunk *c, int32_t x, int32_t z, int type, bool use_fast)
+{
+    if (c->count == c->capacity) {
+        uint64_t cap = c->capacity * 2;
+        void *p = realloc(c->recs, cap * structure_size());
+        if (!p)
+            return false;
+        c->recs = p;
+        uint8_t *t = realloc(c->types, cap);
+        if (!t)
+            return false;
+        c->types = t;
+        c->capacity = cap;
+    }
+    c->types[c->count] = (uint8_t)type;
+    if (c->hist)
+        c->hist[bucket_of(&g_bucketing, x)]++;
+    if (use_fast) {
+        StructureFast *arr = (StructureFast *)c->recs;
+        arr[c->count].x = x;
+        arr[c->count].z = z;
+        arr[c->count].cellX = 0;    /* Computed later */
+        arr[c->count].cellZ = 0;
+    } else {
+        StructureCompact *arr = (StructureCompact *)c->recs;
+        arr[c->count].x = x;
+        arr[c->count].z = z;
+    }
+    c->count++;
+    return true;
+}
+
+/* Labels come in long runs, so the fast path compares a short label as two
+ * words against the previous one before searching the table. p must have
+ * 16 readable bytes. */
+static inline int chunk_type(ParseChunk *c, const char *p, size_t len)
+{
+    if (len > 16)
+        return type_intern(c->tt, p, len);
+    uint64_t w[2];
+    memcpy(w, p, 16);
+    if (len < 8) {
+        w[0] &= (1ULL << (8 * len)) - 1;
+        w[1] = 0;
+    } else if (len < 16) {
+        w[1] &= (1ULL << (8 * (len - 8))) - 1;
+    }
+    if (c->last_valid && len == c->last_len &&
+        w[0] == c->last_label[0] && w[1] == c->last_label[1])
+        return c->last_type;
+    c->last_type = type_intern(c->tt, p, len);
+    c->last_label[0] = w[0];
+    c->last_label[1] = w[1];
+    c->last_len = len;
+    c->last_valid = true;
+    return c->last_type;
+}
+
+static void chunk_mark(ParseChunk *c, long cell)
+{
+    if (c->mark_count == c->mark_capacity) {
+        uint64_t cap = c->mark_capacity ? c->mark_capacity * 2 : 16;
+        RunMark *p = realloc(c->marks, cap * sizeof(RunMark));
+        if (!p) {
+            c->runs_lost = true;    /* only costs the merge, not the records */
+            return;
+        }
+        c->marks = p;
+        c->mark_capacity = cap;
+    }
+    c->marks[c->mark_count].index = c->count;
+    c->marks[c->mark_count].cell = cell;
+    c->mark_count++;
+}
+
+static void *parse_chunk(void *arg)
+{
+    ParseChunk *c = (ParseChunk *)arg;
+    uint64_t span = ct_begin();
+    bool use_fast = (g_mode == MODE_HIGH_PERF || g_mode == MODE_BALANCED);
+    char line[MAX_LINE_LENGTH];
+    const char *p = c->begin;
+    const char *end = c->end;
+    uint64_t line_count = 0;
+
+    while (p < end) {
+        int32_t x, z;
+        size_t label_len;
+        const char *eol;
+        if (g_simd_parse && *p != '#' &&
+            parse_line_fast(p, c->limit, &eol, &x, &z, &label_len)) {
+            if (c->mark_count == 0)
+                c->leading_records = true;
+            if (!chunk_push(c, x, z, chunk_type(c, p, label_len), use_fast)) {
+                c->failed = true;
+                break;
+            }
+            if ((++line_count & 0xffff) == 0)
+                atomic_store_explicit(&c->bytes_done, (uint64_t)(eol - c->begin),
+                                      memory_order_relaxed);
+            p = eol + 1;
+            continue;
+        }
+
+        eol = memchr(p, '\n', (size_t)(end - p));
+        if (!eol) eol = end;
+
+        size_t len = eol - p;
+        if (len >= MAX_LINE_LENGTH) len = MAX_LINE_LENGTH - 1;
+        memcpy(line, p, len);
+        line[len] = '\0';
+
+        long cell;
+        if (line[0] == '#') {
+            if (sscanf(line, "#sorted cell=%ld", &cell) == 1)
+                chunk_mark(c, cell);
+        } else if (parse_line(line, &x, &z, &label_len)) {
+            if (c->mark_count == 0)
+                c->leading_records = true;
+            if (!chunk_push(c, x, z, type_intern(c->tt, line, label_len), use_fast)) {
+                c->failed = true;
+                break;
+            }
+        }
+
+        if ((++line_count & 0xffff) == 0)
+            atomic_store_explicit(&c->bytes_done, (uint64_t)(eol - c->begin),
+                                  memory_order_relaxed);
+        p = eol + 1;
+    }
+    atomic_store_explicit(&c->bytes_done, (uint64_t)(end - c->begin), memory_order_relaxed);
+    ct_end(span, "parse chunk", (int64_t)c->count);
+    return NULL;
+}
+
+static void *copy_chunk(void *arg)
+{
+    ParseChunk *c = (ParseChunk *)arg;
+    uint64_t span = ct_begin();
+    memcpy(c->dst, c->recs, c->count * structure_size());
+    for (uint64_t i = 0; i < c->count; i++) {
+        c->tt->count[c->types[i]]++;
+        c->types_dst[i] = c->map[c->types[i]];
+    }
+    free(c->recs);
+    free(c->types);
+    c->recs = NULL;
+    c->types = NULL;
+    ct_end(span, "place chunk", (int64_t)c->count);
+    return NULL;
+}
+
+/* Like copy_chunk, but every record goes to the next slot of its bucket;
+ * fast records get their cell coordinates on the way */
+static void *scatter_chunk(void *arg)
+{
+    ParseChunk *c = (ParseChunk *)arg;
+    uint64_t span = ct_begin();
+    const CellDiv *d = &g_bucketing.div;
+    if (g_mode == MODE_HIGH_PERF || g_mode == MODE_BALANCED) {
+        const StructureFast *src = (const StructureFast *)c->recs;
+        StructureFast *dst = (StructureFast *)c->dst;
+        for (uint64_t i = 0; i < c->count; i++) {
+            uint64_t j = c->hist[bucket_of(&g_bucketing, src[i].x)]++;
+            dst[j].x = src[i].x;
+            dst[j].z = src[i].z;
+            dst[j].cellX = cell_of(d, src[i].x);
+            dst[j].cellZ = cell_of(d, src[i].z);
+            c->types_dst[j] = c->map[c->types[i]];
+            c->tt->count[c->types[i]]++;
+        }
+    } else {
+        const StructureCompact *src = (const StructureCompact *)c->recs;
+        StructureCompact *dst = (StructureCompact *)c->dst;
+        for (uint64_t i = 0; i < c->count; i++) {
+            uint64_t j = c->hist[bucket_of(&g_bucketing, src[i].x)]++;
+            dst[j] = src[i];
+            c->types_dst[j] = c->map[c->types[i]];
+            c->tt->count[c->types[i]]++;
+        }
+    }
+    free(c->recs);
+    free(c->types);
+    c->recs = NULL;
+    c->types = NULL;
+    ct_end(span, "scatter chunk", (int64_t)c->count);
+    return NULL;
+}
+
+static void free_chunks(ParseChunk *chunks, int n)
+{
+    for (int i = 0; i < n; i++) {
+        free(chunks[i].recs);
+        free(chunks[i].hist);
+        free(chunks[i].types);
+        free(chunks[i].tt);
+        free(chunks[i].marks);
+    }
+    free(chunks);
+}
+
+/* Chunks are handed out in order to a fixed set of threads */
+typedef struct {
+    ParseChunk *chunks;
+    int count;
+    atomic_int next;
+    atomic_int finished;        /* threads that have run out of chunks */
+    void *(*fn)(void *);
+} ChunkQueue;
+
+static void *chunk_queue_worker(void *arg)
+{
+    ChunkQueue *q = (ChunkQueue *)arg;
+    int i;
+    while ((i = atomic_fetch_add(&q->next, 1)) < q->count)
+        q->fn(&q->chunks[i]);
+    return NULL;
+}
+
+static void *chunk_queue_thread(void *arg)
+{
+    ChunkQueue *q = (ChunkQueue *)arg;
+    ct_thread_name("parse", -1);
+    HelperPerf perf;
+    helper_perf_begin(&perf);
+    chunk_queue_worker(q);
+    helper_perf_end(&perf);
+    atomic_fetch_add(&q->finished, 1);
+    return NULL;
+}
+
+/* Runs fn over every chunk on up to num_threads threads, printing parse
+ * progress against total_bytes while waiting if that is non-zero */
+static void run_chunk_queue(ParseChunk *chunks, int count, void *(*fn)(void *),
+                            int num_threads, uint64_t total_bytes)
+{
+    ChunkQueue q = { chunks, count, 0, 0, fn };
+    int n = num_threads < count ? num_threads : count;
+    pthread_t *tids = n > 1 ? malloc((size_t)n * sizeof(pthread_t)) : NULL;
+    int started = 0;
+    if (tids) {
+        while (started < n &&
+               pthread_create(&tids[started], NULL, chunk_queue_thread, &q) == 0)
+            started++;
+    }
+    if (started == 0) {
+        chunk_queue_worker(&q);
+        free(tids);
+        return;
+    }
+    /* Polls a counter rather than pthread_tryjoin_np, which macOS lacks */
+    while (total_bytes && atomic_load(&q.finished) < started) {
+        uint64_t done = 0;
+        for (int j = 0; j < count; j++)
+            done += atomic_load_explicit(&chunks[j].bytes_done, memory_order_relaxed);
+        print_progress("Parsing", done, total_bytes);
+        usleep(200000);
+    }
+    for (int t = 0; t < started; t++)
+        pthread_join(tids[t], NULL);
+    free(tids);
+}
+
+/* ============================================================================
+ * Input Files
+ * ========================================================================== */
+
+/* The text input: one file, or the part files structure_finder leaves in
+ * its temp directory (huts_000.txt, monuments_001.txt, ...) read in place
+ * of all_structures.txt */
+typedef struct {
+    char **paths;
+    uint64_t *sizes;
+    int count;
+    int capacity;
+    uint64_t total_size;
+} InputList;
+
+static bool input_add_file(InputList *in, const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        fprintf(stderr, "Error: Cannot access '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    if (in->count == in->capacity) {
+        int cap = in->capacity ? in->capacity * 2 : 16;
+        char **p = realloc(in->paths, (size_t)cap * sizeof(char *));
+        if (p) in->paths = p;
+        uint64_t *sz = realloc(in->sizes, (size_t)cap * sizeof(uint64_t));
+        if (sz) in->sizes = sz;
+        if (!p || !sz) return false;
+        in->capacity = cap;
+    }
+    in->paths[in->count] = strdup(path);
+    if (!in->paths[in->count]) return false;
+    in->sizes[in->count] = (uint64_t)st.st_size;
+    in->total_size += (uint64_t)st.st_size;
+    in->count++;
+    return true;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Every *.txt in the directory, in name order. all_structures.txt repeats
+ * the parts, so it is only used when there are no parts next to it. */
+static bool input_add_dir(InputList *in, const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "Error: Cannot open directory '%s': %s\n", dir, strerror(errno));
+        return false;
+    }
+    char **names = NULL;
+    int n = 0, cap = 0;
+    bool merged = false, ok = true;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len < 5 || strcmp(e->d_name + len - 4, ".txt") != 0)
+            continue;
+        if (strcmp(e->d_name, "all_structures.txt") == 0) {
+            merged = true;
+            continue;
+        }
+        if (n == cap) {
+            cap = cap ? cap * 2 : 32;
+            char **p = realloc(names, (size_t)cap * sizeof(char *));
+            if (!p) { ok = false; break; }
+            names = p;
+        }
+        if (!(names[n] = strdup(e->d_name))) { ok = false; break; }
+        n++;
+    }
+    closedir(d);
+    if (ok && n == 0 && merged) {
+        names = malloc(sizeof(char *));
+        if (names && (names[0] = strdup("all_structures.txt")))
+            n = 1;
+    }
+    if (n > 0)
+        qsort(names, (size_t)n, sizeof(char *), compare_paths);
+
+    char path[1024];
+    for (int i = 0; i < n; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        struct stat st;
+        if (ok && stat(path, &st) == 0 && S_ISREG(st.st_mode))
+            ok = input_add_file(in, path);
+        free(names[i]);
+    }
+    free(names);
+    if (ok && n == 0)
+        fprintf(stderr, "Error: No .txt files in '%s'\n", dir);
+    return ok && n > 0;
+}
+
+/* A file, a directory, a glob pattern, or several of these separated by
+ * spaces */
+static bool input_add(InputList *in, const char *arg)
+{
+    struct stat st;
+    if (stat(arg, &st) == 0)
+        return S_ISDIR(st.st_mode) ? input_add_dir(in, arg) : input_add_file(in, arg);
+
+    if (strpbrk(arg, " \t")) {
+        char *copy = strdup(arg), *save = NULL;
+        bool ok = copy != NULL, any = false;
+        for (char *tok = copy ? strtok_r(copy, " \t", &save) : NULL; ok && tok;
+             tok = strtok_r(NULL, " \t", &save)) {
+            ok = input_add(in, tok);
+            any = true;
+        }
+        free(copy);
+        return ok && any;
+    }
+
+    if (strpbrk(arg, "*?[")) {
+        glob_t g;
+        int rc = glob(arg, 0, NULL, &g);
+        if (rc != 0) {
+            fprintf(stderr, "Error: No files match '%s'\n", arg);
+            if (rc != GLOB_NOMATCH) globfree(&g);
+            return false;
+        }
+        bool ok = true;
+        for (size_t i = 0; ok && i < g.gl_pathc; i++)
+            ok = input_add_file(in, g.gl_pathv[i]);
+        globfree(&g);
+        return ok;
+    }
+
+    fprintf(stderr, "Error: Cannot access '%s': %s\n", arg, strerror(errno));
+    return false;
+}
+
+static void input_free(InputList *in)
+{
+    for (int i = 0; i < in->count; i++)
+        free(in->paths[i]);
+    free(in->paths);
+    free(in->sizes);
+    memset(in, 0, sizeof(*in));
+}
+
+/* Continues chunk c in the array and header list of dst, then hands them
+ * back; lets one thread parse every chunk into a single array */
+static void parse_chunk_into(ParseChunk *dst, ParseChunk *c)
+{
+    c->recs = dst->recs; c->count = dst->count; c->capacity = dst->capacity;
+    c->types = dst->types; c->tt = dst->tt;
+    c->marks = dst->marks; c->mark_count = dst->mark_count;
+    c->mark_capacity = dst->mark_capacity;
+    c->leading_records = dst->leading_records;
+    parse_chunk(c);
+    dst->recs = c->recs; dst->count = c->count; dst->capacity = c->capacity;
+    dst->types = c->types;
+    dst->marks = c->marks; dst->mark_count = c->mark_count;
+    dst->mark_capacity = c->mark_capacity;
+    dst->leading_records = c->leading_records;
+    dst->runs_lost |= c->runs_lost;
+    dst->failed |= c->failed;
+    c->recs = NULL;
+    c->types = NULL;
+    c->tt = NULL;
+    c->marks = NULL;
+}
+
+/* Parses every input file in newline-aligned chunks of about an even share
+ * of the total size, each chunk into its own array, with the threads taking
+ * chunks in order. A prefix sum over the chunk counts then places every
+ * chunk in g_structures, so the result is the same as reading the files
+ * one after another. Each file is mapped on its own.
+ *
+ * The chunks also count their records per bucket of cell columns for the
+ * radius. Unless pre-sorted runs will be merged, the records are then
+ * placed bucket by bucket instead, so the index only has to sort each
+ * bucket on its own. */
+static bool runs_usable(int64_t radius);
+
+static uint64_t parse_files(const InputList *in, int num_threads, int64_t radius)
+{
+    uint64_t total_size = in->total_size;
+    if (total_size == 0) {
+        fprintf(stderr, "Input is empty\n");
+        return 0;
+    }
+    if (in->count == 1)
+        fprintf(stderr, "Parsing file: %s (%.2f GB)\n",
+                in->paths[0], total_size / (1024.0 * 1024.0 * 1024.0));
+    else
+        fprintf(stderr, "Parsing %d files (%.2f GB)\n",
+                in->count, total_size / (1024.0 * 1024.0 * 1024.0));
+
+    /* The chunk arrays and g_structures coexist while chunks are placed;
+     * when twice the records would not fit, one thread parses everything
+     * into a single array that becomes g_structures without a copy */
+    size_t elem_size = structure_size();
+    uint64_t estimated_count = total_size / AVG_BYTES_PER_LINE;
+    int threads = num_threads < 1 ? 1 : num_threads;
+    if (threads > 1 && 2 * estimated_count * (elem_size + 1) > (g_system_memory * 80) / 100) {
+        fprintf(stderr, "  Not enough memory for chunked parsing, using one thread\n");
+        threads = 1;
+    }
+    bool single = (threads == 1);
+    uint64_t target = (total_size + threads - 1) / threads;
+    if (target < (1u << 20) || single)
+        target = total_size;
+
+    char **maps = calloc((size_t)in->count, sizeof(char *));
+    int max_chunks = in->count + threads;
+    ParseChunk *chunks = calloc((size_t)max_chunks, sizeof(ParseChunk));
+    if (!maps || !chunks) {
+        fprintf(stderr, "Error: Failed to allocate parse chunks\n");
+        free(maps); free(chunks);
+        return 0;
+    }
+
+    /* Map every file and cut it at the next line start after each
+     * target-sized step */
+    int nchunks = 0;
+    bool ok = true;
+    for (int f = 0; ok && f < in->count; f++) {
+        size_t size = in->sizes[f];
+        if (size == 0)
+            continue;
+        int fd = open(in->paths[f], O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Failed to open %s: %s\n", in->paths[f], strerror(errno));
+            ok = false;
+            break;
+        }
+        maps[f] = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (maps[f] == MAP_FAILED) {
+            fprintf(stderr, "Failed to mmap %s: %s\n", in->paths[f], strerror(errno));
+            maps[f] = NULL;
+            ok = false;
+            break;
+        }
+        madvise(maps[f], size, MADV_SEQUENTIAL);
+
+        const char *end = maps[f] + size;
+        const char *prev = maps[f];
+        while (ok && prev < end) {
+            const char *b = end;
+            if ((uint64_t)(end - prev) > target) {
+                const char *nl = memchr(prev + target, '\n', (size_t)(end - prev - target));
+                b = nl ? nl + 1 : end;
+            }
+            if (nchunks == max_chunks) {
+                ParseChunk *p = realloc(chunks, (size_t)max_chunks * 2 * sizeof(ParseChunk));
+                if (!p) { ok = false; break; }
+                memset(p + max_chunks, 0, (size_t)max_chunks * sizeof(ParseChunk));
+                chunks = p;
+                max_chunks *= 2;
+            }
+            chunks[nchunks].begin = prev;
+            chunks[nchunks].end = b;
+            chunks[nchunks].limit = end;
+            nchunks++;
+            prev = b;
+        }
+    }
+
+    bool bucketed = !single && nchunks > 1 && radius > 0;
+    if (bucketed)
+        bucketing_init(&g_bucketing, radius * g_cell_multiplier);
+
+    /* 10% over the average line estimate, so most arrays never grow */
+    ParseChunk all;
+    memset(&all, 0, sizeof(all));
+    for (int i = 0; ok && i < (single ? 1 : nchunks); i++) {
+        ParseChunk *c = single ? &all : &chunks[i];
+        uint64_t bytes = single ? total_size : (uint64_t)(c->end - c->begin);
+        uint64_t cap = (bytes / AVG_BYTES_PER_LINE) * 11 / 10;
+        if (cap < 1024) cap = 1024;
+        c->capacity = cap;
+        c->recs = malloc(cap * elem_size);
+        c->types = malloc(cap);
+        c->tt = calloc(1, sizeof(TypeTable));
+        if (bucketed)
+            c->hist = calloc(g_bucketing.count, sizeof(uint64_t));
+        if (!c->recs || !c->types || !c->tt || (bucketed && !c->hist)) {
+            fprintf(stderr, "Error: Failed to allocate %.2f GB for structures\n",
+                    (cap * elem_size) / (1024.0 * 1024.0 * 1024.0));
+            ok = false;
+        }
+    }
+    if (ok)
+        fprintf(stderr, "Allocated %.2f GB for ~%lu structures in %d chunk%s\n",
+                (estimated_count * 11 / 10 * elem_size) / (1024.0 * 1024.0 * 1024.0),
+                (unsigned long)estimated_count, nchunks, nchunks == 1 ? "" : "s");
+
+    clock_gettime(CLOCK_MONOTONIC, &g_start_time);
+
+    if (ok && single) {
+        uint64_t done = 0;
+        for (int i = 0; i < nchunks && !all.failed; i++) {
+            parse_chunk_into(&all, &chunks[i]);
+            done += (uint64_t)(chunks[i].end - chunks[i].begin);
+            print_progress("Parsing", done, total_size);
+        }
+        free_chunks(chunks, nchunks);
+        chunks = calloc(1, sizeof(ParseChunk));
+        if (chunks) {
+            chunks[0] = all;
+            nchunks = 1;
+        } else {
+            free(all.recs);
+            free(all.types);
+            free(all.tt);
+            free(all.marks);
+            nchunks = 0;
+            ok = false;
+        }
+        if (all.failed) ok = false;
+    } else if (ok) {
+        run_chunk_queue(chunks, nchunks, parse_chunk, threads, total_size);
+        for (int i = 0; i < nchunks; i++)
+            if (chunks[i].failed) ok = false;
+    }
+
+    for (int f = 0; f < in->count; f++)
+        if (maps[f]) munmap(maps[f], in->sizes[f]);
+    free(maps);
+
+    if (!ok) {
+        fprintf(stderr, "\nError: Out of memory while parsing\n");
+        free_chunks(chunks, nchunks);
+        return 0;
+    }
+
+    /* Replay the sorted-run headers in input order; records ahead of the
+     * first header anywhere make the runs unusable, as before */
+    uint64_t total = 0;
+    for (int i = 0; i < nchunks; i++) {
+        if ((chunks[i].leading_records && g_run_count == 0) || chunks[i].runs_lost)
+            g_run_cell = -1;    /* records outside any sorted run */
+        for (uint64_t m = 0; m < chunks[i].mark_count; m++)
+            note_run_start(chunks[i].marks[m].cell, total + chunks[i].marks[m].index);
+        total += chunks[i].count;
+    }
+
+    /* Type ids in input order, so they do not depend on the chunking */
+    for (int i = 0; i < nchunks; i++) {
+        const TypeTable *tt = chunks[i].tt;
+        g_type_table.overflowed |= tt->overflowed;
+        g_type_table.truncated |= tt->truncated;
+        for (int t = 0; t < tt->n; t++) {
+            int id = type_intern(&g_type_table, tt->name[t], strlen(tt->name[t]));
+            chunks[i].map[t] = (uint8_t)id;
+        }
+    }
+
+    if (nchunks == 1) {
+        ParseChunk *c = &chunks[0];
+        for (uint64_t i = 0; i < c->count; i++) {
+            c->tt->count[c->types[i]]++;
+            c->types[i] = c->map[c->types[i]];
+        }
+        g_structures = c->recs;
+        g_structures_capacity = c->capacity;
+        g_types = c->types;
+        c->recs = NULL;
+        c->types = NULL;
+    } else {
+        g_structures = malloc((total ? total : 1) * elem_size);
+        g_types = malloc(total ? total : 1);
+        if (!g_structures || !g_types) {
+            fprintf(stderr, "\nError: Failed to allocate %.2f GB for structures\n",
+                    (total * (elem_size + 1)) / (1024.0 * 1024.0 * 1024.0));
+            free_chunks(chunks, nchunks);
+            return 0;
+        }
+        g_structures_capacity = total;
+
+        if (bucketed && !runs_usable(radius))
+            g_bucket_starts = malloc(((size_t)g_bucketing.count + 1) * sizeof(uint64_t));
+        if (g_bucket_starts) {
+            /* Prefix sum over (bucket, chunk) turns the counts into the
+             * first slot of each chunk's share of each bucket */
+            uint64_t offset = 0;
+            for (uint32_t b = 0; b < g_bucketing.count; b++) {
+                g_bucket_starts[b] = offset;
+                for (int i = 0; i < nchunks; i++) {
+                    uint64_t n = chunks[i].hist[b];
+                    chunks[i].hist[b] = offset;
+                    offset += n;
+                }
+            }
+            g_bucket_starts[g_bucketing.count] = offset;
+            for (int i = 0; i < nchunks; i++) {
+                chunks[i].dst = g_structures;
+                chunks[i].types_dst = g_types;
+            }
+            run_chunk_queue(chunks, nchunks, scatter_chunk, threads, 0);
+        } else {
+            uint64_t offset = 0;
+            for (int i = 0; i < nchunks; i++) {
+                chunks[i].dst = (char *)g_structures + offset * elem_size;
+                chunks[i].types_dst = g_types + offset;
+                offset += chunks[i].count;
+            }
+            run_chunk_queue(chunks, nchunks, copy_chunk, threads, 0);
+        }
+    }
+    g_structures_count = total;
+    for (int i = 0; i < nchunks; i++)
+        for (int t = 0; t < chunks[i].tt->n; t++)
+            g_type_table.count[chunks[i].map[t]] += chunks[i].tt->count[t];
+    free_chunks(chunks, nchunks);
+    if (g_type_table.n <= 1) {
+        free(g_types);      /* a single type needs no side array */
+        g_types = NULL;
+    }
+
+    fprintf(stderr, "\rParsing: 100.00%% complete                                        \n");
+    fprintf(stderr, "Parsed %lu structures", (unsigned long)g_structures_count);
+    for (int t = 0; t < g_type_table.n; t++)
+        fprintf(stderr, "%s %s %lu", t ? "," : ":", g_type_table.name[t],
+                (unsigned long)g_type_table.count[t]);
+    fprintf(stderr, "\n");
+
+    return g_structures_count;
+}
+
+/* groupfinder --bench-parse FILE: single-threaded parse speed of the
+ * vectorized parser against parse_line on the same mapped file */
+static double bench_pass(ParseChunk *c, bool simd)
+{
+    g_simd_parse = simd;
+    c->count = 0;
+    c->mark_count = 0;
+    c->leading_records = false;
+    memset(c->tt, 0, sizeof(TypeTable));
+    c->last_valid = false;
+    struct timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    parse_chunk(c);
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    g_simd_parse = true;
+    return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+static int bench_parse(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+        fprintf(stderr, "Error: Cannot read '%s'\n", filename);
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    size_t file_size = st.st_size;
+    char *data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Failed to mmap input file");
+        return 1;
+    }
+
+    ParseChunk c, ref;
+    memset(&c, 0, sizeof(c));
+    c.begin = data;
+    c.end = c.limit = data + file_size;
+    c.capacity = file_size / AVG_BYTES_PER_LINE + 1024;
+    c.recs = malloc(c.capacity * structure_size());
+    c.types = malloc(c.capacity);
+    c.tt = malloc(sizeof(TypeTable));
+    ref = c;
+    ref.recs = malloc(ref.capacity * structure_size());
+    ref.types = malloc(ref.capacity);
+    ref.tt = malloc(sizeof(TypeTable));
+    if (!c.recs || !c.types || !c.tt || !ref.recs || !ref.types || !ref.tt) {
+        fprintf(stderr, "Error: Out of memory\n");
+        free(c.recs); free(c.types); free(c.tt);
+        free(ref.recs); free(ref.types); free(ref.tt);
+        munmap(data, file_size);
+        return 1;
+    }
+
+    /* First pass only warms the page cache */
+    bench_pass(&ref, false);
+    double best_ref = 1e30, best_simd = 1e30;
+    for (int i = 0; i < 3; i++) {
+        double t = bench_pass(&ref, false);
+        if (t < best_ref) best_ref = t;
+        t = bench_pass(&c, true);
+        if (t < best_simd) best_simd = t;
+    }
+    bool same = !c.failed && !ref.failed && c.count == ref.count &&
+                memcmp(c.recs, ref.recs, c.count * structure_size()) == 0 &&
+                memcmp(c.types, ref.types, c.count) == 0 &&
+                memcmp(c.tt, ref.tt, sizeof(TypeTable)) == 0;
+
+    double gb = file_size / 1e9;
+#if defined(__AVX2__)
+    const char *isa = "AVX2";
+#elif defined(__SSE2__)
+    const char *isa = "SSE2";
+#else
+    const char *isa = "scalar";
+#endif
+    printf("Input: %s (%.3f GB, %lu records)\n", filename, gb, (unsigned long)ref.count);
+    char name[32];
+    snprintf(name, sizeof(name), "fast (%s)", isa);
+    printf("  %-14s %8.3f s  %6.2f GB/s\n", "parse_line", best_ref, gb / best_ref);
+    printf("  %-14s %8.3f s  %6.2f GB/s  (%.1fx)\n", name, best_simd, gb / best_simd,
+           best_ref / best_simd);
+    printf("  Records identical: %s\n", same ? "yes" : "NO");
+
+    free(c.recs); free(c.types); free(c.tt);
+    free(ref.recs); free(ref.types); free(ref.tt);
+    free(c.marks); free(ref.marks);
+    munmap(data, file_size);
+    return same ? 0 : 1;
+}
+
+/* ============================================================================
+ * Tile Store Loading
+ * ========================================================================== */
+
+static void store_append(void *ctx, int32_t x, int32_t z)
+{
+    bool use_fast = *(bool *)ctx;
+    if (use_fast) {
+        StructureFast *arr = (StructureFast *)g_structures;
+        arr[g_structures_count].x = x;
+        arr[g_structures_count].z = z;
+        arr[g_structures_count].cellX = 0;  /* Computed later */
+        arr[g_structures_count].cellZ = 0;
+    } else {
+        StructureCompact *arr = (StructureCompact *)g_structures;
+        arr[g_structures_count].x = x;
+        arr[g_structures_count].z = z;
+    }
+    g_structures_count++;
+}
+
+/* Load only the structures inside the box; only intersecting tiles are read */
+static uint64_t load_store(const TsReader *r, int32_t min_x, int32_t min_z,
+                           int32_t max_x, int32_t max_z, uint64_t count)
+{
+    fprintf(stderr, "Loading %s structures from tile store (seed %ld)\n",
+            r->hdr->label, (long)r->hdr->seed);
+
+    size_t elem_size = structure_size();
+    uint64_t cap = count > 0 ? count : 1;
+    g_structures = malloc(cap * elem_size);
+    if (!g_structures) {
+        fprintf(stderr, "Error: Failed to allocate %.2f GB for structures\n",
+                (cap * elem_size) / (1024.0 * 1024.0 * 1024.0));
+        return 0;
+    }
+    g_structures_capacity = cap;
+
+    bool use_fast = (g_mode == MODE_HIGH_PERF || g_mode == MODE_BALANCED);
+    ts_query(r, min_x, min_z, max_x, max_z, store_append, &use_fast);
+    g_type_table.count[type_intern(&g_type_table, r->hdr->label, strlen(r->hdr->label))] =
+        g_structures_count;
+
+    fprintf(stderr, "Loaded %lu structures\n", (unsigned long)g_structures_count);
+    return g_structures_count;
+}
+
+/* Load the structures of a region bitmap inside the box, regenerating
+ * each position from its region */
+static uint64_t load_bitmap(const RbReader *r, int32_t min_x, int32_t min_z,
+                            int32_t max_x, int32_t max_z, uint64_t count)
+{
+    fprintf(stderr, "Loading %s structures from region bitmap (seed %ld)\n",
+            r->hdr->label, (long)r->hdr->seed);
+
+    size_t elem_size = structure_size();
+    uint64_t cap = count > 0 ? count : 1;
+    g_structures = malloc(cap * elem_size);
+    if (!g_structures) {
+        fprintf(stderr, "Error: Failed to allocate %.2f GB for structures\n",
+                (cap * elem_size) / (1024.0 * 1024.0 * 1024.0));
+        return 0;
+    }
+    g_structures_capacity = cap;
+
+    bool use_fast = (g_mode == MODE_HIGH_PERF || g_mode == MODE_BALANCED);
+    rb_query(r, min_x, min_z, max_x, max_z, rb_builtin_pos, (void *)r->hdr,
+             store_append, &use_fast);
+    g_type_table.count[type_intern(&g_type_table, r->hdr->label, strlen(r->hdr->label))] =
+        g_structures_count;
+
+    fprintf(stderr, "Loaded %lu structures\n", (unsigned long)g_structures_count);
+    return g_structures_count;
+}
+
+/* ============================================================================
+ * Sorting
+ * ========================================================================== */
+
+/* Fast mode: precomputed cell coords */
+static int compare_fast(const void *a, const void *b)
+{
+    const StructureFast *sa = (const StructureFast *)a;
+    const StructureFast *sb = (const StructureFast *)b;
+
+    if (sa->cellX < sb->cellX) return -1;
+    if (sa->cellX > sb->cellX) return 1;
+    if (sa->cellZ < sb->cellZ) return -1;
+    if (sa->cellZ > sb->cellZ) return 1;
+    return 0;
+}
+
+/* Compact mode: compute on-the-fly */
+static int compare_compact(const void *a, const void *b)
+{
+    const StructureCompact *sa = (const StructureCompact *)a;
+    const StructureCompact *sb = (const StructureCompact *)b;
+    
+    int64_t cellXa = coord_to_cell(sa->x, g_cell_size);
+    int64_t cellXb = coord_to_cell(sb->x, g_cell_size);
+    int64_t cellZa = coord_to_cell(sa->z, g_cell_size);
+    int64_t cellZb = coord_to_cell(sb->z, g_cell_size);
+
+    if (cellXa < cellXb) return -1;
+    if (cellXa > cellXb) return 1;
+    if (cellZa < cellZb) return -1;
+    if (cellZa > cellZb) return 1;
+    return 0;
+}
+
+/* ============================================================================
+ * Pre-sorted Run Merging
+ * ========================================================================== */
+
+typedef struct {
+    int64_t cx;
+    int64_t cz;
+} CellKey;
+
+static inline CellKey key_at(const void *arr, uint64_t i)
+{
+    CellKey k;
+    if (g_mode == MODE_HIGH_PERF || g_mode == MODE_BALANCED) {
+        const StructureFast *s = (const StructureFast *)arr + i;
+        k.cx = s->cellX;
+        k.cz = s->cellZ;
+    } else {
+        const StructureCompact *s = (const StructureCompact *)arr + i;
+        k.cx = coord_to_cell(s->x, g_cell_size);
+        k.cz = coord_to_cell(s->z, g_cell_size);
+    }
+    return k;
+}
+
+static inline int key_cmp(CellKey a, CellKey b)
+{
+    if (a.cx != b.cx) return a.cx < b.cx ? -1 : 1;
+    if (a.cz != b.cz) return a.cz < b.cz ? -1 : 1;
+    return 0;
+}
+
+static int compare_keys(const void *a, const void *b)
+{
+    return key_cmp(*(const CellKey *)a, *(const CellKey *)b);
+}
+
+/* First index in [lo, hi) whose key is not below k */
+static uint64_t lower_bound_key(const void *arr, uint64_t lo, uint64_t hi, CellKey k)
+{
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (key_cmp(key_at(arr, mid), k) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* One merge thread: merges its slice of every run into dst[out...] */
+typedef struct {
+    const void *src;
+    void *dst;
+    const uint8_t *src_types;   /* NULL when there is one type */
+    uint8_t *dst_types;
+    uint64_t out;
+    uint64_t num_runs;
+    uint64_t *lo;           /* per-run slice, advanced while merging */
+    const uint64_t *hi;
+    CellKey split_lo, split_hi;
+    bool has_lo, has_hi;
+    bool out_of_order;
+    bool threaded;
+} MergeWork;
+
+static void heap_sift(uint64_t *heap, uint64_t n, uint64_t i, const CellKey *head)
+{
+    for (;;) {
+        uint64_t l = 2 * i + 1, m = i;
+        if (l < n && key_cmp(head[heap[l]], head[heap[m]]) < 0) m = l;
+        if (l + 1 < n && key_cmp(head[heap[l + 1]], head[heap[m]]) < 0) m = l + 1;
+        if (m == i) return;
+        uint64_t t = heap[i]; heap[i] = heap[m]; heap[m] = t;
+        i = m;
+    }
+}
+
+static void *merge_worker(void *arg)
+{
+    MergeWork *m = (MergeWork *)arg;
+    uint64_t span = ct_begin();
+    size_t es = structure_size();
+    uint64_t *heap = malloc(m->num_runs * sizeof(uint64_t));
+    CellKey *head = malloc(m->num_runs * sizeof(CellKey));
+    if (!heap || !head) {
+        free(heap); free(head);
+        m->out_of_order = true;
+        return NULL;
+    }
+
+    uint64_t n = 0;
+    for (uint64_t r = 0; r < m->num_runs; r++) {
+        if (m->lo[r] < m->hi[r]) {
+            head[r] = key_at(m->src, m->lo[r]);
+            heap[n++] = r;
+        }
+    }
+    for (uint64_t i = n / 2; i-- > 0; )
+        heap_sift(heap, n, i, head);
+
+    char *dst = (char *)m->dst + m->out * es;
+    const char *src = (const char *)m->src;
+    uint8_t *dst_types = m->dst_types ? m->dst_types + m->out : NULL;
+    while (n > 0) {
+        uint64_t r = heap[0];
+        CellKey k = head[r];
+        /* Every key must lie in this thread's range, and each run must
+         * be non-decreasing; otherwise the input was not really sorted */
+        if ((m->has_lo && key_cmp(k, m->split_lo) < 0) ||
+            (m->has_hi && key_cmp(k, m->split_hi) >= 0)) {
+            m->out_of_order = true;
+            break;
+        }
+        memcpy(dst, src + m->lo[r] * es, es);
+        dst += es;
+        if (dst_types)
+            *dst_types++ = m->src_types[m->lo[r]];
+        if (++m->lo[r] < m->hi[r]) {
+            head[r] = key_at(m->src, m->lo[r]);
+            if (key_cmp(head[r], k) < 0) {
+                m->out_of_order = true;
+                break;
+            }
+        } else {
+            heap[0] = heap[--n];
+        }
+        heap_sift(heap, n, 0, head);
+    }
+
+    free(heap);
+    free(head);
+    ct_end(span, "merge range", (int64_t)m->out);
+    return NULL;
+}
+
+static void *merge_thread(void *arg)
+{
+    ct_thread_name("merge", -1);
+    HelperPerf perf;
+    helper_perf_begin(&perf);
+    void *r = merge_worker(arg);
+    helper_perf_end(&perf);
+    return r;
+}
+
+/* K-way merge of the pre-sorted runs, split by key range over the threads.
+ * Returns false (leaving the array untouched) if memory is short or a run
+ * turns out not to be in cell order; the caller then sorts instead. */
+static bool merge_sorted_runs(int num_threads)
+{
+    uint64_t n = g_structures_count;
+    uint64_t k = g_run_count;
+    size_t es = structure_size();
+
+    uint64_t *bounds = malloc((k + 1) * sizeof(uint64_t));
+    void *dst = malloc(n * es);
+    uint8_t *dst_types = g_types ? malloc(n) : NULL;
+    if (!bounds || !dst || (g_types && !dst_types)) {
+        fprintf(stderr, "  Not enough memory to merge runs, sorting instead\n");
+        free(bounds); free(dst); free(dst_types);
+        return false;
+    }
+    memcpy(bounds, g_run_starts, k * sizeof(uint64_t));
+    bounds[k] = n;
+
+    int parts = num_threads;
+    if (parts < 1) parts = 1;
+    if (n < 65536) parts = 1;
+
+    /* Splitters from evenly spaced samples of every run */
+    uint64_t max_samples = k * 64;
+    CellKey *samples = malloc(max_samples * sizeof(CellKey));
+    uint64_t *cuts = malloc((size_t)(parts + 1) * k * sizeof(uint64_t));
+    MergeWork *mw = calloc((size_t)parts, sizeof(MergeWork));
+    pthread_t *tids = malloc((size_t)parts * sizeof(pthread_t));
+    if (!samples || !cuts || !mw || !tids) {
+        fprintf(stderr, "  Not enough memory to merge runs, sorting instead\n");
+        free(bounds); free(dst); free(dst_types); free(samples); free(cuts); free(mw); free(tids);
+        return false;
+    }
+    uint64_t ns = 0;
+    for (uint64_t r = 0; r < k; r++) {
+        uint64_t len = bounds[r + 1] - bounds[r];
+        uint64_t take = len < 64 ? len : 64;
+        for (uint64_t j = 0; j < take; j++)
+            samples[ns++] = key_at(g_structures, bounds[r] + j * len / take);
+    }
+    qsort(samples, ns, sizeof(CellKey), compare_keys);
+
+    for (uint64_t r = 0; r < k; r++) {
+        cuts[r] = bounds[r];
+        cuts[(uint64_t)parts * k + r] = bounds[r + 1];
+    }
+    for (int p = 1; p < parts; p++) {
+        CellKey split = samples[(uint64_t)p * ns / parts];
+        for (uint64_t r = 0; r < k; r++) {
+            uint64_t lo = cuts[(uint64_t)(p - 1) * k + r];
+            cuts[(uint64_t)p * k + r] = lower_bound_key(g_structures, lo, bounds[r + 1], split);
+        }
+        mw[p - 1].split_hi = split;
+        mw[p - 1].has_hi = true;
+        mw[p].split_lo = split;
+        mw[p].has_lo = true;
+    }
+
+    uint64_t out = 0;
+    for (int p = 0; p < parts; p++) {
+        mw[p].src = g_structures;
+        mw[p].dst = dst;
+        mw[p].src_types = g_types;
+        mw[p].dst_types = dst_types;
+        mw[p].out = out;
+        mw[p].num_runs = k;
+        mw[p].lo = &cuts[(uint64_t)p * k];
+        mw[p].hi = &cuts[(uint64_t)(p + 1) * k];
+        for (uint64_t r = 0; r < k; r++)
+            out += mw[p].hi[r] - mw[p].lo[r];
+    }
+    /* lo[] is advanced in place, so hand each thread its own copy */
+    uint64_t *lo_copy = malloc((size_t)parts * k * sizeof(uint64_t));
+    if (!lo_copy) {
+        free(bounds); free(dst); free(dst_types); free(samples); free(cuts); free(mw); free(tids);
+        return false;
+    }
+    memcpy(lo_copy, cuts, (size_t)parts * k * sizeof(uint64_t));
+    for (int p = 0; p < parts; p++)
+        mw[p].lo = &lo_copy[(uint64_t)p * k];
+
+    for (int p = 0; p < parts; p++) {
+        mw[p].threaded = pthread_create(&tids[p], NULL, merge_thread, &mw[p]) == 0;
+        if (!mw[p].threaded)
+            merge_worker(&mw[p]);
+    }
+    for (int p = 0; p < parts; p++)
+        if (mw[p].threaded)
+            pthread_join(tids[p], NULL);
+
+    bool ok = true;
+    for (int p = 0; p < parts; p++)
+        if (mw[p].out_of_order) ok = false;
+
+    free(lo_copy); free(bounds); free(samples); free(cuts); free(mw); free(tids);
+    if (!ok) {
+        fprintf(stderr, "  Input runs are not in cell order, sorting instead\n");
+        free(dst); free(dst_types);
+        return false;
+    }
+
+    free(g_structures);
+    g_structures = dst;
+    free(g_types);
+    g_types = dst_types;
+    g_structures_capacity = n;
+    fprintf(stderr, "  Merged %lu pre-sorted runs with %d threads\n", (unsigned long)k, parts);
+    return true;
+}
+
+/* qsort cannot move g_types along with the records, so mixed-type input is
+ * sorted with this quicksort over both arrays instead */
+static inline void swap_records(char *arr, uint8_t *types, int64_t i, int64_t j, size_t es)
+{
+    char tmp[sizeof(StructureFast)];
+    memcpy(tmp, arr + i * es, es);
+    memcpy(arr + i * es, arr + j * es, es);
+    memcpy(arr + j * es, tmp, es);
+    uint8_t t = types[i];
+    types[i] = types[j];
+    types[j] = t;
+}
+
+static void sort_with_types(char *arr, uint8_t *types, int64_t lo, int64_t hi, size_t es)
+{
+    while (hi - lo > 16) {
+        /* Median of three at lo, mid, hi-1 keeps both sides non-empty */
+        int64_t mid = lo + (hi - lo) / 2;
+        if (key_cmp(key_at(arr, mid), key_at(arr, lo)) < 0) swap_records(arr, types, mid, lo, es);
+        if (key_cmp(key_at(arr, hi - 1), key_at(arr, mid)) < 0) {
+            swap_records(arr, types, hi - 1, mid, es);
+            if (key_cmp(key_at(arr, mid), key_at(arr, lo)) < 0) swap_records(arr, types, mid, lo, es);
+        }
+        CellKey pivot = key_at(arr, mid);
+
+        int64_t i = lo - 1, j = hi;
+        for (;;) {
+            do i++; while (key_cmp(key_at(arr, i), pivot) < 0);
+            do j--; while (key_cmp(key_at(arr, j), pivot) > 0);
+            if (i >= j) break;
+            swap_records(arr, types, i, j, es);
+        }
+        /* Recurse into the smaller side, loop on the larger */
+        if (j + 1 - lo < hi - (j + 1)) {
+            sort_with_types(arr, types, lo, j + 1, es);
+            lo = j + 1;
+        } else {
+            sort_with_types(arr, types, j + 1, hi, es);
+            hi = j + 1;
+        }
+    }
+    for (int64_t i = lo + 1; i < hi; i++)
+        for (int64_t j = i; j > lo && key_cmp(key_at(arr, j), key_at(arr, j - 1)) < 0; j--)
+            swap_records(arr, types, j, j - 1, es);
+}
+
+/* Header of each slice handed to run_slices; the rest of the struct
+ * belongs to the caller */
+typedef struct {
+    void *(*fn)(void *);
+    const char *name;           /* trace thread name */
+    pthread_t tid;
+    bool threaded;
+} SliceThread;
+
+static void *slice_thread(void *arg)
+{
+    SliceThread *st = (SliceThread *)arg;
+    ct_thread_name(st->name, -1);
+    HelperPerf perf;
+    helper_perf_begin(&perf);
+    void *r = st->fn(arg);
+    helper_perf_end(&perf);
+    return r;
+}
+
+/* Runs fn on parts slices of size bytes, each starting with a SliceThread:
+ * the first on this thread and the rest on their own threads, running a
+ * slice here if its thread cannot be started */
+static void run_slices(void *slices, size_t size, int parts, void *(*fn)(void *),
+                       const char *name)
+{
+    for (int p = 1; p < parts; p++) {
+        SliceThread *st = (SliceThread *)((char *)slices + (size_t)p * size);
+        st->fn = fn;
+        st->name = name;
+        st->threaded = pthread_create(&st->tid, NULL, slice_thread, st) == 0;
+        if (!st->threaded)
+            fn(st);
+    }
+    fn(slices);
+    for (int p = 1; p < parts; p++) {
+        SliceThread *st = (SliceThread *)((char *)slices + (size_t)p * size);
+        if (st->threaded)
+            pthread_join(st->tid, NULL);
+    }
+}
+
+/* Cell of record i in either layout; Fast records must have theirs filled in */
+static inline void cell_at(const CellDiv *d, bool fast, const void *arr, uint64_t i,
+                           int64_t *cx, int64_t *cz)
+{
+    if (fast) {
+        const StructureFast *s = (const StructureFast *)arr + i;
+        *cx = s->cellX;
+        *cz = s->cellZ;
+    } else {
+        const StructureCompact *s = (const StructureCompact *)arr + i;
+        *cx = cell_of(d, s->x);
+        *cz = cell_of(d, s->z);
+    }
+}
+
+/* Parallel LSD radix sort on a packed cell key: cellX - min_x above
+ * cellZ - min_z, so key order is cell order and only the bits the input
+ * actually spans are sorted. Each pass counts digits per thread slice,
+ * turns the counts into per-thread offsets and scatters stably into the
+ * other buffer, carrying g_types along. */
+#define RADIX_MAX_BITS 11
+#define RADIX_DIGITS (1 << RADIX_MAX_BITS)
+#define RADIX_MIN_RECORDS 64    /* below this the quicksort is faster */
+
+typedef struct {
+    CellDiv div;
+    bool fast;                  /* StructureFast with cellX/cellZ filled in */
+    int64_t min_x, min_z;
+    int bits_z;
+    int bits;
+} RadixKey;
+
+static inline uint64_t radix_key(const RadixKey *k, const void *arr, uint64_t i)
+{
+    int64_t cx, cz;
+    cell_at(&k->div, k->fast, arr, i, &cx, &cz);
+    return ((uint64_t)(cx - k->min_x) << k->bits_z) | (uint64_t)(cz - k->min_z);
+}
+
+/* One thread's slice [lo, hi) of the source for every phase of a pass */
+typedef struct {
+    SliceThread st;
+    const RadixKey *key;
+    const void *src;
+    void *dst;
+    const uint8_t *src_types;   /* NULL when there is one type */
+    uint8_t *dst_types;
+    uint64_t lo, hi;
+    int shift;
+    int digits;                 /* 1 << digit width */
+    uint64_t *count;            /* digit counts, then write offsets */
+    int64_t min_x, max_x, min_z, max_z;
+} RadixWork;
+
+static void *radix_range_worker(void *arg)
+{
+    RadixWork *w = (RadixWork *)arg;
+    w->min_x = w->min_z = INT64_MAX;
+    w->max_x = w->max_z = INT64_MIN;
+    for (uint64_t i = w->lo; i < w->hi; i++) {
+        int64_t cx, cz;
+        cell_at(&w->key->div, w->key->fast, w->src, i, &cx, &cz);
+        if (cx < w->min_x) w->min_x = cx;
+        if (cx > w->max_x) w->max_x = cx;
+        if (cz < w->min_z) w->min_z = cz;
+        if (cz > w->max_z) w->max_z = cz;
+    }
+    return NULL;
+}
+
+static void *radix_count_worker(void *arg)
+{
+    RadixWork *w = (RadixWork *)arg;
+    uint64_t mask = (uint64_t)w->digits - 1;
+    memset(w->count, 0, (size_t)w->digits * sizeof(uint64_t));
+    for (uint64_t i = w->lo; i < w->hi; i++)
+        w->count[(radix_key(w->key, w->src, i) >> w->shift) & mask]++;
+    return NULL;
+}
+
+static void *radix_scatter_worker(void *arg)
+{
+    RadixWork *w = (RadixWork *)arg;
+    uint64_t mask = (uint64_t)w->digits - 1;
+    uint64_t *off = w->count;
+    for (uint64_t i = w->lo; i < w->hi; i++) {
+        uint64_t j = off[(radix_key(w->key, w->src, i) >> w->shift) & mask]++;
+        if (w->key->fast)
+            ((StructureFast *)w->dst)[j] = ((const StructureFast *)w->src)[i];
+        else
+            ((StructureCompact *)w->dst)[j] = ((const StructureCompact *)w->src)[i];
+        if (w->src_types)
+            w->dst_types[j] = w->src_types[i];
+    }
+    return NULL;
+}
+
+static int bit_width(uint64_t v)
+{
+    int b = 0;
+    while (v) {
+        b++;
+        v >>= 1;
+    }
+    return b;
+}
+
+/* Sorts the n records of arr (and types, if not NULL) on parts threads,
+ * using tmp (and tmp_types) of the same size as the other buffer. w holds
+ * parts slices, each with its own count array. Returns arr or tmp,
+ * whichever ended up holding the sorted records, or NULL if the key does
+ * not fit in 64 bits and nothing was moved. */
+static void *radix_sort(RadixKey *k, void *arr, uint8_t *types, void *tmp, uint8_t *tmp_types,
+                        uint64_t n, RadixWork *w, int parts)
+{
+    for (int p = 0; p < parts; p++) {
+        w[p].key = k;
+        w[p].src = arr;
+        w[p].lo = n * (uint64_t)p / (uint64_t)parts;
+        w[p].hi = n * (uint64_t)(p + 1) / (uint64_t)parts;
+    }
+    run_slices(w, sizeof(RadixWork), parts, radix_range_worker, "sort");
+    int64_t max_x = INT64_MIN, max_z = INT64_MIN;
+    k->min_x = k->min_z = INT64_MAX;
+    for (int p = 0; p < parts; p++) {
+        if (w[p].lo == w[p].hi) continue;
+        if (w[p].min_x < k->min_x) k->min_x = w[p].min_x;
+        if (w[p].max_x > max_x) max_x = w[p].max_x;
+        if (w[p].min_z < k->min_z) k->min_z = w[p].min_z;
+        if (w[p].max_z > max_z) max_z = w[p].max_z;
+    }
+    k->bits_z = bit_width((uint64_t)(max_z - k->min_z));
+    k->bits = k->bits_z + bit_width((uint64_t)(max_x - k->min_x));
+    if (k->bits > 64)
+        return NULL;
+
+    int passes = (k->bits + RADIX_MAX_BITS - 1) / RADIX_MAX_BITS;
+    int width = passes ? (k->bits + passes - 1) / passes : 0;
+    for (int p = 0; p < parts; p++)
+        w[p].digits = 1 << width;
+    void *src = arr, *dst = tmp;
+    uint8_t *src_types = types, *dst_types = tmp_types;
+    for (int pass = 0; pass < passes; pass++) {
+        for (int p = 0; p < parts; p++) {
+            w[p].src = src;
+            w[p].shift = pass * width;
+        }
+        run_slices(w, sizeof(RadixWork), parts, radix_count_worker, "sort");
+
+        /* Digit-major, slice-minor offsets keep the scatter stable */
+        uint64_t sum = 0;
+        bool one_digit = false;
+        for (int d = 0; d < w[0].digits; d++) {
+            uint64_t before = sum;
+            for (int p = 0; p < parts; p++) {
+                uint64_t c = w[p].count[d];
+                w[p].count[d] = sum;
+                sum += c;
+            }
+            if (sum - before == n) one_digit = true;
+        }
+        if (one_digit)
+            continue;
+
+        for (int p = 0; p < parts; p++) {
+            w[p].dst = dst;
+            w[p].src_types = types ? src_types : NULL;
+            w[p].dst_types = dst_types;
+        }
+        run_slices(w, sizeof(RadixWork), parts, radix_scatter_worker, "sort");
+        void *t = src; src = dst; dst = t;
+        uint8_t *tt = src_types; src_types = dst_types; dst_types = tt;
+    }
+    return src;
+}
+
+static void radix_key_init(RadixKey *k, int64_t cell_size)
+{
+    memset(k, 0, sizeof(*k));
+    k->div.cell_size = cell_size;
+    k->div.inv = 1.0 / (double)cell_size;
+    k->fast = (g_mode == MODE_HIGH_PERF || g_mode == MODE_BALANCED);
+}
+
+/* Sorts all of g_structures on num_threads threads. Returns false, with
+ * nothing moved, if there is no memory for the second buffer. */
+static bool radix_sort_all(int num_threads)
+{
+    uint64_t n = g_structures_count;
+    size_t es = structure_size();
+    int parts = num_threads < 1 ? 1 : num_threads;
+    uint64_t max_parts = n / 65536 > 0 ? n / 65536 : 1;    /* slices of at least 64K */
+    if ((uint64_t)parts > max_parts)
+        parts = (int)max_parts;
+
+    /* Both buffers must fit, as for the parallel parse */
+    if (2 * n * (es + 1) > (g_system_memory * 80) / 100) {
+        fprintf(stderr, "  Not enough memory to radix sort, sorting in place instead\n");
+        return false;
+    }
+    void *tmp = malloc(n * es);
+    uint8_t *tmp_types = g_types ? malloc(n) : NULL;
+    RadixWork *w = calloc((size_t)parts, sizeof(RadixWork));
+    uint64_t *counts = malloc((size_t)parts * RADIX_DIGITS * sizeof(uint64_t));
+    if (!tmp || (g_types && !tmp_types) || !w || !counts) {
+        fprintf(stderr, "  Not enough memory to radix sort, sorting in place instead\n");
+        free(tmp); free(tmp_types); free(w); free(counts);
+        return false;
+    }
+    for (int p = 0; p < parts; p++)
+        w[p].count = &counts[(size_t)p * RADIX_DIGITS];
+
+    RadixKey k;
+    radix_key_init(&k, g_cell_size);
+    void *sorted = radix_sort(&k, g_structures, g_types, tmp, tmp_types, n, w, parts);
+    free(w);
+    free(counts);
+    if (sorted == tmp) {
+        free(g_structures);
+        g_structures = tmp;
+        g_structures_capacity = n;
+        free(g_types);
+        g_types = tmp_types;
+    } else {
+        free(tmp);
+        free(tmp_types);
+    }
+    if (!sorted) {
+        fprintf(stderr, "  Cell keys span more than 64 bits, sorting in place instead\n");
+        return false;
+    }
+    fprintf(stderr, "  Radix sorted %d key bits with %d thread%s\n",
+            k.bits, parts, parts == 1 ? "" : "s");
+    return true;
+}
+
+/* Per-thread buffers for radix sorting buckets, grown to the largest
+ * bucket the thread has seen */
+typedef struct {
+    RadixKey key;
+    void *tmp;
+    uint8_t *tmp_types;
+    uint64_t capacity;
+    uint64_t count[RADIX_DIGITS];
+} RadixScratch;
+
+static bool radix_reserve(RadixScratch *rs, uint64_t n)
 {
-    int fd = open(filename, O_RDONLY);
-    if (fd < 0) {
-        perror("Failed to open input file");
-        return 0;
+    if (n <= rs->capacity)
+        return true;
+    void *tmp = realloc(rs->tmp, n * structure_size());
+    if (!tmp)
+        return false;
+    rs->tmp = tmp;
+    if (g_types) {
+        uint8_t *tt = realloc(rs->tmp_types, n);
+        if (!tt)
+            return false;
+        rs->tmp_types = tt;
     }
+    rs->capacity = n;
+    return true;
+}
 
-    struct stat st;
-    if (fstat(fd, &st) < 0) {
-        perror("Failed to stat input file");
-        close(fd);
-        return 0;
-    }
+/* Buckets hold whole cell columns in x order, so sorting each on its own
+ * sorts the array; threads take buckets from a shared counter */
+typedef struct {
+    atomic_uint next;
+    uint64_t sorted;
+} BucketSort;
 
-    size_t file_size = st.st_size;
-    if (file_size == 0) {
-        fprintf(stderr, "Input file is empty\n");
-        close(fd);
-        return 0;
+static void sort_range(RadixScratch *rs, uint64_t lo, uint64_t hi)
+{
+    size_t es = structure_size();
+    uint64_t n = hi - lo;
+    if (n < 2)
+        return;
+    if (rs && n >= RADIX_MIN_RECORDS && radix_reserve(rs, n)) {
+        RadixWork w;
+        memset(&w, 0, sizeof(w));
+        w.count = rs->count;
+        char *arr = (char *)g_structures + lo * es;
+        uint8_t *types = g_types ? g_types + lo : NULL;
+        void *sorted = radix_sort(&rs->key, arr, types, rs->tmp, rs->tmp_types, n, &w, 1);
+        if (sorted == rs->tmp) {
+            memcpy(arr, rs->tmp, n * es);
+            if (types)
+                memcpy(types, rs->tmp_types, n);
+        }
+        if (sorted)
+            return;
     }
+    if (g_types)
+        sort_with_types((char *)g_structures, g_types, (int64_t)lo, (int64_t)hi, es);
+    else
+        qsort((char *)g_structures + lo * es, hi - lo, es,
+              es == sizeof(StructureFast) ? compare_fast : compare_compact);
+}
 
-    fprintf(stderr, "Parsing file: %s (%.2f GB)\n",
-            filename, file_size / (1024.0 * 1024.0 * 1024.0));
-
-    char *data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (data == MAP_FAILED) {
-        perror("Failed to mmap input file");
-        close(fd);
-        return 0;
+static void *bucket_sort_worker(void *arg)
+{
+    BucketSort *bs = (BucketSort *)arg;
+    uint64_t span = ct_begin();
+    uint64_t done = 0;
+    unsigned b;
+    RadixScratch *rs = calloc(1, sizeof(RadixScratch));
+    if (rs)
+        radix_key_init(&rs->key, g_cell_size);
+    while ((b = atomic_fetch_add(&bs->next, 1)) < g_bucketing.count) {
+        sort_range(rs, g_bucket_starts[b], g_bucket_starts[b + 1]);
+        done += g_bucket_starts[b + 1] - g_bucket_starts[b];
     }
-
-    madvise(data, file_size, MADV_SEQUENTIAL);
-
-    if (!preallocate_structures(file_size)) {
-        munmap(data, file_size);
-        close(fd);
-        return 0;
+    if (rs) {
+        free(rs->tmp);
+        free(rs->tmp_types);
+        free(rs);
     }
+    ct_end(span, "sort buckets", (int64_t)done);
+    return NULL;
+}
 
-    clock_gettime(CLOCK_MONOTONIC, &g_start_time);
-
-    uint64_t progress_interval = (file_size / AVG_BYTES_PER_LINE) / 100;
-    if (progress_interval < 100000) progress_interval = 100000;
-
-    char line[MAX_LINE_LENGTH];
-    const char *p = data;
-    const char *end = data + file_size;
-    uint64_t line_count = 0;
-    bool use_fast = (g_mode == MODE_HIGH_PERF || g_mode == MODE_BALANCED);
+static void *bucket_sort_thread(void *arg)
+{
+    ct_thread_name("sort", -1);
+    HelperPerf perf;
+    helper_perf_begin(&perf);
+    void *r = bucket_sort_worker(arg);
+    helper_perf_end(&perf);
+    return r;
+}
 
-    while (p < end) {
-        const char *eol = p;
-        while (eol < end && *eol != '\n') eol++;
+/* Sorts the buckets on num_threads threads, this one included */
+static void sort_buckets(int num_threads)
+{
+    BucketSort bs = { 0, 0 };
+    int n = num_threads < 1 ? 0 : num_threads - 1;
+    pthread_t *tids = n > 0 ? malloc((size_t)n * sizeof(pthread_t)) : NULL;
+    int started = 0;
+    while (tids && started < n &&
+           pthread_create(&tids[started], NULL, bucket_sort_thread, &bs) == 0)
+        started++;
+    bucket_sort_worker(&bs);
+    for (int t = 0; t < started; t++)
+        pthread_join(tids[t], NULL);
+    free(tids);
+}
 
-        size_t len = eol - p;
-        if (len >= MAX_LINE_LENGTH) len = MAX_LINE_LENGTH - 1;
-        memcpy(line, p, len);
-        line[len] = '\0';
+/* ============================================================================
+ * Spatial Index Building
+ * ========================================================================== */
 
-        int32_t x, z;
-        if (parse_line(line, &x, &z)) {
-            if (!ensure_capacity(g_structures_count + 1)) {
-                munmap(data, file_size);
-                close(fd);
-                return 0;
-            }
+/* Pre-sorted runs are used when their cell size works for this radius:
+ * at least the radius (so neighbour search stays small) and at most 16x */
+static bool runs_usable(int64_t radius)
+{
+    return g_run_cell > 0 && g_run_count > 0 &&
+           g_run_cell >= radius && g_run_cell <= 16 * radius;
+}
 
-            if (use_fast) {
-                StructureFast *arr = (StructureFast *)g_structures;
-                arr[g_structures_count].x = x;
-                arr[g_structures_count].z = z;
-                arr[g_structures_count].cellX = 0;  /* Computed later */
-                arr[g_structures_count].cellZ = 0;
-            } else {
-                StructureCompact *arr = (StructureCompact *)g_structures;
-                arr[g_structures_count].x = x;
-                arr[g_structures_count].z = z;
-            }
-            g_structures_count++;
-        }
+static int64_t choose_cell_size(int64_t radius)
+{
+    return runs_usable(radius) ? g_run_cell : radius * g_cell_multiplier;
+}
 
-        line_count++;
-        if ((line_count % progress_interval) == 0) {
-            print_progress("Parsing", (uint64_t)(p - data), file_size);
+/* One thread's slice [lo, hi) of the sorted records while building the
+ * cell index. A cell belongs to the slice holding its first record. */
+typedef struct {
+    SliceThread st;
+    CellDiv div;
+    bool fast;
+    uint64_t lo, hi;
+    uint64_t cells;             /* cells starting in the slice */
+    uint64_t first_cell;        /* index of the first of them */
+} IndexWork;
+
+static void *index_count_worker(void *arg)
+{
+    IndexWork *w = (IndexWork *)arg;
+    int64_t px = 0, pz = 0, cx, cz;
+    bool have_prev = w->lo > 0;
+    if (have_prev)
+        cell_at(&w->div, w->fast, g_structures, w->lo - 1, &px, &pz);
+    uint64_t cells = 0;
+    for (uint64_t i = w->lo; i < w->hi; i++) {
+        cell_at(&w->div, w->fast, g_structures, i, &cx, &cz);
+        if (!have_prev || cx != px || cz != pz) {
+            cells++;
+            px = cx;
+            pz = cz;
+            have_prev = true;
         }
-
-        p = eol + 1;
     }
+    w->cells = cells;
+    return NULL;
+}
 
-    munmap(data, file_size);
-    close(fd);
+static void *index_fill_worker(void *arg)
+{
+    IndexWork *w = (IndexWork *)arg;
+    if (w->cells == 0)
+        return NULL;
+    int64_t px = 0, pz = 0, cx, cz;
+    bool have_prev = w->lo > 0;
+    if (have_prev)
+        cell_at(&w->div, w->fast, g_structures, w->lo - 1, &px, &pz);
+    uint64_t c = w->first_cell;
+    uint64_t start = 0;
+    bool open = false;
+    for (uint64_t i = w->lo; i < w->hi; i++) {
+        cell_at(&w->div, w->fast, g_structures, i, &cx, &cz);
+        if (have_prev && cx == px && cz == pz)
+            continue;
+        if (open)
+            g_cells[c++].count = (uint32_t)(i - start);
+        g_cells[c].cellX = cx;
+        g_cells[c].cellZ = cz;
+        g_cells[c].start = (uint32_t)i;
+        start = i;
+        open = true;
+        px = cx;
+        pz = cz;
+        have_prev = true;
+    }
+    /* The last cell may run on into the next slices */
+    uint64_t end = w->hi;
+    while (end < g_structures_count) {
+        cell_at(&w->div, w->fast, g_structures, end, &cx, &cz);
+        if (cx != px || cz != pz)
+            break;
+        end++;
+    }
+    g_cells[c].count = (uint32_t)(end - start);
+    return NULL;
+}
 
-    fprintf(stderr, "\rParsing: 100.00%% complete                                        \n");
-    fprintf(stderr, "Parsed %lu structures\n", (unsigned long)g_structures_count);
+static inline bool cell_before(const CellEntry *c, int64_t cx, int64_t cz)
+{
+    return c->cellX < cx || (c->cellX == cx && c->cellZ < cz);
+}
 
-    return g_structures_count;
+/* Position of (x, z) along the Hilbert curve filling 2^bits x 2^bits */
+static uint64_t hilbert_index(uint32_t x, uint32_t z, int bits)
+{
+    uint64_t d = 0;
+    for (uint32_t s = bits > 0 ? 1u << (bits - 1) : 0; s > 0; s >>= 1) {
+        uint32_t rx = (x & s) ? 1 : 0;
+        uint32_t rz = (z & s) ? 1 : 0;
+        d += (uint64_t)s * s * ((3 * rx) ^ rz);
+        /* Rotate the quadrant, without branches as they are unpredictable:
+         * flip both when rx && !rz, then swap when !rz */
+        x &= s - 1;
+        z &= s - 1;
+        uint32_t flip = (0u - (rx & (rz ^ 1))) & (s - 1);
+        x ^= flip;
+        z ^= flip;
+        uint32_t t = (x ^ z) & (0u - (rz ^ 1));
+        x ^= t;
+        z ^= t;
+    }
+    return d;
 }
 
-/* ============================================================================
- * Sorting
- * ========================================================================== */
+typedef struct {
+    uint64_t d;                 /* curve position, then new record start */
+    uint32_t cell;
+} HilbertCell;
 
-/* Fast mode: precomputed cell coords */
-static int compare_fast(const void *a, const void *b)
+/* LSD radix sort of the cells by curve position, bits wide; returns
+ * whichever of the two buffers ends up sorted */
+static HilbertCell *hilbert_sort(HilbertCell *a, HilbertCell *tmp, uint64_t n, int bits)
 {
-    const StructureFast *sa = (const StructureFast *)a;
-    const StructureFast *sb = (const StructureFast *)b;
+    uint64_t count[RADIX_DIGITS];
+    for (int shift = 0; shift < bits; shift += RADIX_MAX_BITS) {
+        memset(count, 0, sizeof(count));
+        for (uint64_t i = 0; i < n; i++)
+            count[(a[i].d >> shift) & (RADIX_DIGITS - 1)]++;
+        uint64_t sum = 0;
+        for (int d = 0; d < RADIX_DIGITS; d++) {
+            uint64_t c = count[d];
+            count[d] = sum;
+            sum += c;
+        }
+        for (uint64_t i = 0; i < n; i++)
+            tmp[count[(a[i].d >> shift) & (RADIX_DIGITS - 1)]++] = a[i];
+        HilbertCell *t = a;
+        a = tmp;
+        tmp = t;
+    }
+    return a;
+}
 
-    if (sa->cellX < sb->cellX) return -1;
-    if (sa->cellX > sb->cellX) return 1;
-    if (sa->cellZ < sb->cellZ) return -1;
-    if (sa->cellZ > sb->cellZ) return 1;
-    return 0;
+/* One thread's range [lo, hi) of cells while working out their curve
+ * positions, then of curve positions while moving records */
+typedef struct {
+    SliceThread st;
+    HilbertCell *hc;
+    uint64_t lo, hi;
+    int64_t min_x, min_z;
+    int bits;
+    void *dst;
+    uint8_t *dst_types;
+} HilbertWork;
+
+static void *hilbert_key_worker(void *arg)
+{
+    HilbertWork *w = (HilbertWork *)arg;
+    for (uint64_t c = w->lo; c < w->hi; c++) {
+        w->hc[c].d = hilbert_index((uint32_t)(g_cells[c].cellX - w->min_x),
+                                   (uint32_t)(g_cells[c].cellZ - w->min_z), w->bits);
+        w->hc[c].cell = (uint32_t)c;
+    }
+    return NULL;
 }
 
-/* Compact mode: compute on-the-fly */
-static int compare_compact(const void *a, const void *b)
+static void *hilbert_move_worker(void *arg)
 {
-    const StructureCompact *sa = (const StructureCompact *)a;
-    const StructureCompact *sb = (const StructureCompact *)b;
-    
-    int64_t cellXa = coord_to_cell(sa->x, g_cell_size);
-    int64_t cellXb = coord_to_cell(sb->x, g_cell_size);
-    int64_t cellZa = coord_to_cell(sa->z, g_cell_size);
-    int64_t cellZb = coord_to_cell(sb->z, g_cell_size);
+    HilbertWork *w = (HilbertWork *)arg;
+    size_t es = structure_size();
+    for (uint64_t i = w->lo; i < w->hi; i++) {
+        CellEntry *c = &g_cells[w->hc[i].cell];
+        uint32_t start = (uint32_t)w->hc[i].d;
+        memcpy((char *)w->dst + (size_t)start * es,
+               (const char *)g_structures + (size_t)c->start * es, (size_t)c->count * es);
+        if (w->dst_types)
+            memcpy(w->dst_types + start, g_types + c->start, c->count);
+        c->start = start;
+    }
+    return NULL;
+}
 
-    if (cellXa < cellXb) return -1;
-    if (cellXa > cellXb) return 1;
-    if (cellZa < cellZb) return -1;
-    if (cellZa > cellZb) return 1;
-    return 0;
+/* Orders the cells along a Hilbert curve and moves their records into
+ * that order, so cells close on the curve are close in memory. */
+static bool hilbert_layout(int num_threads)
+{
+    uint64_t n = g_cells_count;
+    uint64_t recs = g_structures_count;
+    size_t es = structure_size();
+    uint64_t need = 2 * recs * (es + 1) + n * (2 * sizeof(HilbertCell) + 2 * sizeof(uint32_t));
+    if (need > (g_system_memory * 80) / 100) {
+        fprintf(stderr, "  Not enough memory for the Hilbert layout, keeping row-major order\n");
+        return false;
+    }
+    HilbertCell *hc = malloc(n * sizeof(HilbertCell));
+    HilbertCell *hc_tmp = malloc(n * sizeof(HilbertCell));
+    uint32_t *order = malloc(n * sizeof(uint32_t));
+    uint32_t *up = malloc(n * sizeof(uint32_t));
+    void *dst = malloc(recs * es);
+    uint8_t *dst_types = g_types ? malloc(recs) : NULL;
+    int parts = num_threads < 1 ? 1 : num_threads;
+    uint64_t max_parts = n / 4096 > 0 ? n / 4096 : 1;
+    if ((uint64_t)parts > max_parts)
+        parts = (int)max_parts;
+    HilbertWork *w = calloc((size_t)parts, sizeof(HilbertWork));
+    if (!hc || !hc_tmp || !order || !up || !dst || (g_types && !dst_types) || !w) {
+        fprintf(stderr, "  Not enough memory for the Hilbert layout, keeping row-major order\n");
+        free(hc); free(hc_tmp); free(order); free(up); free(dst); free(dst_types); free(w);
+        return false;
+    }
+
+    /* Cells are row-major, so only cellZ needs a scan for its range */
+    int64_t min_x = g_cells[0].cellX, max_x = g_cells[n - 1].cellX;
+    int64_t min_z = g_cells[0].cellZ, max_z = min_z;
+    for (uint64_t c = 1; c < n; c++) {
+        if (g_cells[c].cellZ < min_z) min_z = g_cells[c].cellZ;
+        if (g_cells[c].cellZ > max_z) max_z = g_cells[c].cellZ;
+    }
+    uint64_t span = (uint64_t)(max_x - min_x) > (uint64_t)(max_z - min_z) ?
+                    (uint64_t)(max_x - min_x) : (uint64_t)(max_z - min_z);
+    int bits = 0;
+    while (bits < 32 && (span >> bits) != 0)
+        bits++;
+    for (int p = 0; p < parts; p++) {
+        w[p].hc = hc;
+        w[p].lo = n * (uint64_t)p / (uint64_t)parts;
+        w[p].hi = n * (uint64_t)(p + 1) / (uint64_t)parts;
+        w[p].min_x = min_x;
+        w[p].min_z = min_z;
+        w[p].bits = bits;
+    }
+    run_slices(w, sizeof(HilbertWork), parts, hilbert_key_worker, "hilbert");
+    HilbertCell *sorted = hilbert_sort(hc, hc_tmp, n, 2 * bits);
+    if (sorted != hc) {
+        free(hc);
+        hc = sorted;
+    } else {
+        free(hc_tmp);
+    }
+
+    /* Along the curve the base cell jumps between rows, so each cell notes
+     * where its neighbours in the next row begin */
+    int reach = g_sweep_rows > 1 ? g_sweep_reach[1] : 0;
+    uint64_t u = 0;
+    for (uint64_t c = 0; c < n; c++) {
+        while (u < n && cell_before(&g_cells[u], g_cells[c].cellX + 1, g_cells[c].cellZ - reach))
+            u++;
+        up[c] = (uint32_t)u;
+    }
+
+    /* New record starts follow the curve */
+    uint64_t start = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        order[i] = hc[i].cell;
+        hc[i].d = start;
+        start += g_cells[hc[i].cell].count;
+    }
+    for (int p = 0; p < parts; p++) {
+        w[p].hc = hc;
+        w[p].dst = dst;
+        w[p].dst_types = dst_types;
+    }
+    run_slices(w, sizeof(HilbertWork), parts, hilbert_move_worker, "hilbert");
+    free(w);
+    free(hc);
+
+    free(g_structures);
+    g_structures = dst;
+    g_structures_capacity = recs;
+    free(g_types);
+    g_types = dst_types;
+    g_cell_order = order;
+    g_row_up = up;
+    fprintf(stderr, "  Hilbert layout: curve of %d bits, %d thread%s\n",
+            bits, parts, parts == 1 ? "" : "s");
+    return true;
 }
 
-/* ============================================================================
- * Spatial Index Building
- * ========================================================================== */
+/* Works out the forward half-neighbourhood: the cells whose nearest
+ * points can be within 2*radius of some point of the base cell. Two cells
+ * d > 0 apart along an axis are at least (d - 1) * cell_size + 1 apart.
+ * Cells are at least radius wide, so no more than 3 rows are needed. */
+static void sweep_setup(int64_t radius, int64_t cell_size)
+{
+    int64_t reach_sq = 4 * radius * radius;
+    g_sweep_rows = 0;
+    for (int dx = 0; dx < MAX_SWEEP_ROWS; dx++) {
+        int64_t gx = dx > 0 ? (dx - 1) * cell_size + 1 : 0;
+        if (gx * gx > reach_sq)
+            break;
+        int k = 0;
+        for (;;) {
+            int64_t gz = (int64_t)k * cell_size + 1;
+            if (gx * gx + gz * gz > reach_sq)
+                break;
+            k++;
+        }
+        g_sweep_reach[dx] = k;
+        g_sweep_rows = dx + 1;
+    }
+}
 
-static bool build_spatial_index(int64_t radius)
+static bool build_spatial_index(int64_t radius, int num_threads)
 {
-    int64_t cell_size = radius * g_cell_multiplier;
+    bool use_runs = runs_usable(radius);
+    int64_t cell_size = choose_cell_size(radius);
     g_cell_size = cell_size;
-    
-    fprintf(stderr, "Building spatial index (cell size: %ld = %d× radius)...\n",
-            (long)cell_size, g_cell_multiplier);
+
+    sweep_setup(radius, cell_size);
+
+    if (use_runs)
+        fprintf(stderr, "Building spatial index (cell size: %ld from %lu pre-sorted runs)...\n",
+                (long)cell_size, (unsigned long)g_run_count);
+    else
+        fprintf(stderr, "Building spatial index (cell size: %ld = %d× radius)...\n",
+                (long)cell_size, g_cell_multiplier);
+    if (g_run_cell > 0 && !use_runs)
+        fprintf(stderr, "  Pre-sorted cell size %ld does not suit radius %ld, sorting instead\n",
+                (long)g_run_cell, (long)radius);
 
     if (g_structures_count == 0) {
         fprintf(stderr, "No structures to index\n");
@@ -480,8 +2553,11 @@ static bool build_spatial_index(int64_t radius)
     clock_gettime(CLOCK_MONOTONIC, &g_start_time);
     bool use_fast = (g_mode == MODE_HIGH_PERF || g_mode == MODE_BALANCED);
 
+    /* Records placed by bucket already carry their cell coords */
+    bool bucketed = g_bucket_starts && !use_runs && g_bucketing.div.cell_size == cell_size;
+
     /* Precompute cell coords for fast mode */
-    if (use_fast) {
+    if (use_fast && !bucketed) {
         fprintf(stderr, "  Precomputing cell coordinates...\n");
         StructureFast *arr = (StructureFast *)g_structures;
         for (uint64_t i = 0; i < g_structures_count; i++) {
@@ -490,38 +2566,48 @@ static bool build_spatial_index(int64_t radius)
         }
     }
 
-    /* Sort */
-    fprintf(stderr, "  Sorting %lu structures...\n", (unsigned long)g_structures_count);
-    if (use_fast) {
-        qsort(g_structures, g_structures_count, sizeof(StructureFast), compare_fast);
+    /* Merge pre-sorted runs, or sort */
+    uint64_t span = ct_begin();
+    if (use_runs && merge_sorted_runs(num_threads)) {
+        ct_end(span, "merge runs", (int64_t)g_run_count);
+    } else if (bucketed) {
+        fprintf(stderr, "  Sorting %lu structures in %u buckets...\n",
+                (unsigned long)g_structures_count, g_bucketing.count);
+        sort_buckets(num_threads);
+        ct_end(span, "sort", (int64_t)g_structures_count);
     } else {
-        qsort(g_structures, g_structures_count, sizeof(StructureCompact), compare_compact);
+        fprintf(stderr, "  Sorting %lu structures...\n", (unsigned long)g_structures_count);
+        span = ct_begin();
+        if (!radix_sort_all(num_threads))
+            sort_range(NULL, 0, g_structures_count);
+        ct_end(span, "sort", (int64_t)g_structures_count);
     }
     fprintf(stderr, "  Sort complete\n");
 
-    /* Count unique cells */
+    /* Count unique cells, each slice counting the cells that start in it */
     fprintf(stderr, "  Counting cells...\n");
-    uint64_t num_cells = 1;
-    
-    if (use_fast) {
-        StructureFast *arr = (StructureFast *)g_structures;
-        for (uint64_t i = 1; i < g_structures_count; i++) {
-            if (arr[i].cellX != arr[i-1].cellX || arr[i].cellZ != arr[i-1].cellZ)
-                num_cells++;
-        }
-    } else {
-        StructureCompact *arr = (StructureCompact *)g_structures;
-        int64_t prev_cx = coord_to_cell(arr[0].x, cell_size);
-        int64_t prev_cz = coord_to_cell(arr[0].z, cell_size);
-        for (uint64_t i = 1; i < g_structures_count; i++) {
-            int64_t cx = coord_to_cell(arr[i].x, cell_size);
-            int64_t cz = coord_to_cell(arr[i].z, cell_size);
-            if (cx != prev_cx || cz != prev_cz) {
-                num_cells++;
-                prev_cx = cx;
-                prev_cz = cz;
-            }
-        }
+    span = ct_begin();
+    int parts = num_threads < 1 ? 1 : num_threads;
+    uint64_t max_parts = g_structures_count / 65536 > 0 ? g_structures_count / 65536 : 1;
+    if ((uint64_t)parts > max_parts)
+        parts = (int)max_parts;
+    IndexWork *iw = calloc((size_t)parts, sizeof(IndexWork));
+    if (!iw) {
+        fprintf(stderr, "Failed to allocate cells\n");
+        return false;
+    }
+    for (int p = 0; p < parts; p++) {
+        iw[p].div.cell_size = cell_size;
+        iw[p].div.inv = 1.0 / (double)cell_size;
+        iw[p].fast = use_fast;
+        iw[p].lo = g_structures_count * (uint64_t)p / (uint64_t)parts;
+        iw[p].hi = g_structures_count * (uint64_t)(p + 1) / (uint64_t)parts;
+    }
+    run_slices(iw, sizeof(IndexWork), parts, index_count_worker, "index");
+    uint64_t num_cells = 0;
+    for (int p = 0; p < parts; p++) {
+        iw[p].first_cell = num_cells;
+        num_cells += iw[p].cells;
     }
     
     fprintf(stderr, "  Found %lu cells (avg %.1f structures/cell)\n",
@@ -531,105 +2617,62 @@ static bool build_spatial_index(int64_t radius)
     g_cells = malloc(num_cells * sizeof(CellEntry));
     if (!g_cells) {
         fprintf(stderr, "Failed to allocate cells\n");
+        free(iw);
         return false;
     }
     g_cells_count = num_cells;
 
-    /* Build cell entries */
+    /* Fill the cell entries slice by slice */
     fprintf(stderr, "  Building cell index...\n");
-    uint64_t cell_idx = 0;
-    uint64_t cell_start = 0;
-    
-    if (use_fast) {
-        StructureFast *arr = (StructureFast *)g_structures;
-        for (uint64_t i = 1; i <= g_structures_count; i++) {
-            bool is_new = (i == g_structures_count) ||
-                          (arr[i].cellX != arr[i-1].cellX) ||
-                          (arr[i].cellZ != arr[i-1].cellZ);
-            if (is_new) {
-                g_cells[cell_idx].cellX = arr[cell_start].cellX;
-                g_cells[cell_idx].cellZ = arr[cell_start].cellZ;
-                g_cells[cell_idx].start = (uint32_t)cell_start;
-                g_cells[cell_idx].count = (uint32_t)(i - cell_start);
-                g_cells[cell_idx].next = 0;
-                cell_idx++;
-                cell_start = i;
-            }
-        }
-    } else {
-        StructureCompact *arr = (StructureCompact *)g_structures;
-        int64_t prev_cx = coord_to_cell(arr[0].x, cell_size);
-        int64_t prev_cz = coord_to_cell(arr[0].z, cell_size);
-        
-        for (uint64_t i = 1; i <= g_structures_count; i++) {
-            bool is_new = (i == g_structures_count);
-            if (!is_new) {
-                int64_t cx = coord_to_cell(arr[i].x, cell_size);
-                int64_t cz = coord_to_cell(arr[i].z, cell_size);
-                is_new = (cx != prev_cx || cz != prev_cz);
-                if (is_new) {
-                    prev_cx = cx;
-                    prev_cz = cz;
-                }
-            }
-            if (is_new) {
-                g_cells[cell_idx].cellX = coord_to_cell(arr[cell_start].x, cell_size);
-                g_cells[cell_idx].cellZ = coord_to_cell(arr[cell_start].z, cell_size);
-                g_cells[cell_idx].start = (uint32_t)cell_start;
-                g_cells[cell_idx].count = (uint32_t)(i - cell_start);
-                g_cells[cell_idx].next = 0;
-                cell_idx++;
-                cell_start = i;
-            }
-        }
-    }
-
-    /* Build hash table - size based on available memory */
-    uint64_t max_hash_bits = (g_mode == MODE_HIGH_PERF) ? 27 : 
-                             (g_mode == MODE_BALANCED) ? 26 : 24;
-    g_hash_table_size = 1ULL << 20;
-    while (g_hash_table_size < num_cells * 2 && g_hash_table_size < (1ULL << max_hash_bits))
-        g_hash_table_size *= 2;
-    
-    fprintf(stderr, "  Hash table: %lu buckets (%.2f MB)\n",
-            (unsigned long)g_hash_table_size,
-            (g_hash_table_size * sizeof(uint32_t)) / (1024.0 * 1024.0));
-    
-    g_hash_table = calloc(g_hash_table_size, sizeof(uint32_t));
-    if (!g_hash_table) {
-        fprintf(stderr, "Failed to allocate hash table\n");
-        free(g_cells);
-        return false;
-    }
-    
-    for (uint64_t i = 0; i < num_cells; i++) {
-        uint64_t h = hash_cell(g_cells[i].cellX, g_cells[i].cellZ, g_hash_table_size);
-        g_cells[i].next = g_hash_table[h];
-        g_hash_table[h] = (uint32_t)(i + 1);
-    }
+    run_slices(iw, sizeof(IndexWork), parts, index_fill_worker, "index");
+    free(iw);
 
     g_total_cells = num_cells;
+    ct_end(span, "cell index", (int64_t)num_cells);
+
+    if (g_hilbert) {
+        fprintf(stderr, "  Ordering cells along a Hilbert curve...\n");
+        span = ct_begin();
+        hilbert_layout(num_threads);
+        ct_end(span, "hilbert", (int64_t)num_cells);
+    }
     
     double total_mem = (g_structures_count * structure_size() + 
-                       num_cells * sizeof(CellEntry) + 
-                       g_hash_table_size * sizeof(uint32_t)) / (1024.0 * 1024.0 * 1024.0);
+                       num_cells * sizeof(CellEntry)) / (1024.0 * 1024.0 * 1024.0);
     fprintf(stderr, "  Total memory used: %.2f GB\n", total_mem);
 
     return true;
 }
 
-static CellEntry *find_cell(int64_t cx, int64_t cz)
+/* First cell at or after (cx, cz) in row-major order, galloping out from
+ * c in whichever direction it lies, so a nearby answer is found quickly */
+static uint64_t cell_seek(const CellEntry *cells, uint64_t n, uint64_t c,
+                          int64_t cx, int64_t cz)
 {
-    uint64_t h = hash_cell(cx, cz, g_hash_table_size);
-    uint32_t idx = g_hash_table[h];
-    
-    while (idx != 0) {
-        CellEntry *cell = &g_cells[idx - 1];
-        if (cell->cellX == cx && cell->cellZ == cz)
-            return cell;
-        idx = cell->next;
+    uint64_t lo, hi, step = 1;
+    if (c < n && cell_before(&cells[c], cx, cz)) {
+        lo = c + 1;
+        while (lo + step - 1 < n && cell_before(&cells[lo + step - 1], cx, cz)) {
+            lo += step;
+            step *= 2;
+        }
+        hi = lo + step - 1 < n ? lo + step - 1 : n;
+    } else {
+        hi = c < n ? c : n;
+        while (hi >= step && !cell_before(&cells[hi - step], cx, cz)) {
+            hi -= step;
+            step *= 2;
+        }
+        lo = hi >= step ? hi - step + 1 : 0;
     }
-    return NULL;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (cell_before(&cells[mid], cx, cz))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
 }
 
 /* ============================================================================
@@ -664,12 +2707,22 @@ static void output_group(FILE *out, pthread_mutex_t *lock, uint32_t *group, int
 {
     pthread_mutex_lock(lock);
 
+    if (g_first_group < 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        g_first_group = (now.tv_sec - g_total_start.tv_sec) +
+                        (now.tv_nsec - g_total_start.tv_nsec) / 1e9;
+    }
     fprintf(out, "Group of %d:\n", count);
     double cx = 0, cz = 0;
     for (int i = 0; i < count; i++) {
         int32_t x, z;
         get_coords(group[i], &x, &z);
-        fprintf(out, "  (%d, %d)\n", x, z);
+        if (g_type_table.n > 0)
+            fprintf(out, "  (%d, %d) %s\n", x, z,
+                    g_type_table.name[g_types ? g_types[group[i]] : 0]);
+        else
+            fprintf(out, "  (%d, %d)\n", x, z);
         cx += x;
         cz += z;
     }
@@ -716,24 +2769,31 @@ static bool is_valid_group(uint32_t *group, int count, int64_t radius_sq)
     return true;
 }
 
-static void find_groups_in_cell(CellEntry *cell, ThreadWork *work)
+/* Searches the groups whose first member, in row-major cell order, is in
+ * cell ci. cursor[dx] is a hint for where row cellX + dx starts: in
+ * row-major order the cursors carry over and only move forward, so over a
+ * run of cells each row is scanned once; along the Hilbert curve they are
+ * seeded per cell from g_row_up. */
+static void find_groups_in_cell(uint64_t ci, uint64_t *cursor, ThreadWork *work)
 {
+    const CellEntry *cell = &work->cells[ci];
     uint32_t *neighbors = work->neighbors_buf;
     uint32_t max_neighbors = work->neighbors_buf_size;
     int64_t radius_sq = work->radius_sq;
-    
-    /* Search range depends on cell multiplier */
-    int search_range = (g_cell_multiplier + 1) / 2 + 1;
-    
-    /* Collect neighbors */
+
+    /* Collect the forward half-neighbourhood, the cell's own records first */
     uint32_t num_neighbors = 0;
-    for (int dx = -search_range; dx <= search_range; dx++) {
-        for (int dz = -search_range; dz <= search_range; dz++) {
-            CellEntry *nc = find_cell(cell->cellX + dx, cell->cellZ + dz);
-            if (!nc) continue;
-            for (uint32_t i = 0; i < nc->count && num_neighbors < max_neighbors; i++) {
+    for (int dx = 0; dx < g_sweep_rows; dx++) {
+        int64_t row = cell->cellX + dx;
+        int64_t z_lo = dx == 0 ? cell->cellZ : cell->cellZ - g_sweep_reach[dx];
+        int64_t z_hi = cell->cellZ + g_sweep_reach[dx];
+        uint64_t c = cell_seek(work->cells, work->num_cells, cursor[dx], row, z_lo);
+        cursor[dx] = c;
+        for (; c < work->num_cells && work->cells[c].cellX == row &&
+               work->cells[c].cellZ <= z_hi; c++) {
+            const CellEntry *nc = &work->cells[c];
+            for (uint32_t i = 0; i < nc->count && num_neighbors < max_neighbors; i++)
                 neighbors[num_neighbors++] = nc->start + i;
-            }
         }
     }
 
@@ -741,16 +2801,15 @@ static void find_groups_in_cell(CellEntry *cell, ThreadWork *work)
 
     int64_t max_pair_dist_sq = 4 * radius_sq;
     
-    for (uint32_t ci = 0; ci < cell->count; ci++) {
-        uint32_t base_idx = cell->start + ci;
+    for (uint32_t bi = 0; bi < cell->count; bi++) {
+        uint32_t base_idx = cell->start + bi;
         
-        /* Build candidates */
+        /* Build candidates from everything after the base record */
         uint32_t candidates[4096];
         uint32_t num_cand = 0;
         
-        for (uint32_t ni = 0; ni < num_neighbors && num_cand < 4096; ni++) {
+        for (uint32_t ni = bi + 1; ni < num_neighbors && num_cand < 4096; ni++) {
             uint32_t idx = neighbors[ni];
-            if (idx <= base_idx) continue;
             if (dist_sq_idx(base_idx, idx) <= max_pair_dist_sq) {
                 candidates[num_cand++] = idx;
             }
@@ -774,7 +2833,7 @@ static void find_groups_in_cell(CellEntry *cell, ThreadWork *work)
                         uint32_t group[4] = { base_idx, candidates[i], candidates[j], candidates[k] };
                         if (is_valid_group(group, 4, radius_sq)) {
                             output_group(work->output, work->output_lock, group, 4);
-                            work->groups_found_4++;
+                            counter_inc(&work->groups_found_4);
                         }
                     }
                 }
@@ -790,22 +2849,124 @@ static void find_groups_in_cell(CellEntry *cell, ThreadWork *work)
                 uint32_t group[3] = { base_idx, candidates[i], candidates[j] };
                 if (is_valid_group(group, 3, radius_sq)) {
                     output_group(work->output, work->output_lock, group, 3);
-                    work->groups_found_3++;
+                    counter_inc(&work->groups_found_3);
                 }
             }
         }
     }
 }
 
-static void *progress_thread(void *arg)
+static uint64_t load_counter(_Atomic uint64_t *c)
+{
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+/* Writes a Prometheus snapshot: the phase and memory at any time, plus the
+ * per-worker counters once the search has started */
+static void write_prom_metrics(const char *path, ThreadWork *work)
+{
+    PromFile p;
+    if (prom_begin(&p, path) != 0)
+        return;
+
+    char labels[64];
+    snprintf(labels, sizeof(labels), "phase=\"%s\"", atomic_load(&g_prom_phase));
+    prom_help(&p, "gf_phase", "gauge", "Phase the run is in");
+    prom_value(&p, "gf_phase", labels, 1);
+    prom_help(&p, "gf_resident_memory_bytes", "gauge", "Resident memory size in bytes");
+    prom_value(&p, "gf_resident_memory_bytes", NULL, (double)prom_rss_bytes());
+    if (!work) {
+        if (prom_end(&p) != 0)
+            fprintf(stderr, "\nWarning: could not write metrics to %s\n", path);
+        return;
+    }
+
+    int num_threads = work[0].num_threads;
+    uint64_t processed = 0, found_3 = 0, found_4 = 0;
+    for (int i = 0; i < num_threads; i++) {
+        processed += load_counter(&work[i].cells_processed);
+        found_3 += load_counter(&work[i].groups_found_3);
+        found_4 += load_counter(&work[i].groups_found_4);
+    }
+    double elapsed = elapsed_seconds();
+    double rate = elapsed > 0 ? processed / elapsed : 0.0;
+
+    prom_help(&p, "gf_cells_processed_total", "counter", "Grid cells searched so far");
+    prom_value(&p, "gf_cells_processed_total", NULL, (double)processed);
+    prom_help(&p, "gf_cells", "gauge", "Grid cells to search");
+    prom_value(&p, "gf_cells", NULL, (double)g_total_cells);
+    prom_help(&p, "gf_cells_queued", "gauge", "Grid cells not searched yet");
+    prom_value(&p, "gf_cells_queued", NULL, (double)(g_total_cells - processed));
+    prom_help(&p, "gf_cells_per_second", "gauge", "Average search rate since start");
+    prom_value(&p, "gf_cells_per_second", NULL, rate);
+    prom_help(&p, "gf_eta_seconds", "gauge", "Estimated time to completion");
+    prom_value(&p, "gf_eta_seconds", NULL, rate > 0 ? (g_total_cells - processed) / rate : 0.0);
+    prom_help(&p, "gf_elapsed_seconds", "gauge", "Time since the search started");
+    prom_value(&p, "gf_elapsed_seconds", NULL, elapsed);
+    prom_help(&p, "gf_structures", "gauge", "Structures loaded");
+    prom_value(&p, "gf_structures", NULL, (double)g_structures_count);
+    prom_help(&p, "gf_threads", "gauge", "Search threads");
+    prom_value(&p, "gf_threads", NULL, num_threads);
+
+    prom_help(&p, "gf_groups_found_total", "counter", "Groups found by size");
+    prom_value(&p, "gf_groups_found_total", "size=\"3\"", (double)found_3);
+    prom_value(&p, "gf_groups_found_total", "size=\"4\"", (double)found_4);
+    prom_help(&p, "gf_thread_cells_processed_total", "counter", "Grid cells searched by thread");
+    for (int i = 0; i < num_threads; i++) {
+        snprintf(labels, sizeof(labels), "thread=\"%d\"", i);
+        prom_value(&p, "gf_thread_cells_processed_total", labels,
+                   (double)load_counter(&work[i].cells_processed));
+    }
+
+    if (prom_end(&p) != 0)
+        fprintf(stderr, "\nWarning: could not write metrics to %s\n", path);
+}
+
+/* Rewrites the Prometheus file every g_prom_interval seconds from the
+ * start of the parse until stop_prom_thread */
+static void *prom_thread(void *arg)
 {
     (void)arg;
-    while (!g_done) {
-        pthread_mutex_lock(&g_progress_lock);
-        uint64_t processed = g_processed_cells;
-        uint64_t total = g_total_cells;
-        pthread_mutex_unlock(&g_progress_lock);
-        print_progress("Finding groups", processed, total);
+    struct timespec last = { 0, 0 };
+    bool first = true;
+    while (!atomic_load(&g_prom_stop)) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (first || now.tv_sec - last.tv_sec >= g_prom_interval) {
+            write_prom_metrics(g_prom_path, atomic_load(&g_prom_work));
+            last = now;
+            first = false;
+        }
+        usleep(200000);
+    }
+    return NULL;
+}
+
+static void start_prom_thread(void)
+{
+    if (g_prom_path && pthread_create(&g_prom_tid, NULL, prom_thread, NULL) == 0)
+        g_prom_running = true;
+}
+
+static void stop_prom_thread(void)
+{
+    if (!g_prom_running)
+        return;
+    atomic_store(&g_prom_stop, 1);
+    pthread_join(g_prom_tid, NULL);
+    g_prom_running = false;
+}
+
+/* Sums the per-worker counters without stopping the workers */
+static void *progress_thread(void *arg)
+{
+    ThreadWork *work = (ThreadWork *)arg;
+    int num_threads = work[0].num_threads;
+    while (!atomic_load_explicit(&g_done, memory_order_relaxed)) {
+        uint64_t processed = 0;
+        for (int i = 0; i < num_threads; i++)
+            processed += load_counter(&work[i].cells_processed);
+        print_progress("Finding groups", processed, g_total_cells);
         usleep(500000);
     }
     print_progress("Finding groups", g_total_cells, g_total_cells);
@@ -816,15 +2977,45 @@ static void *progress_thread(void *arg)
 static void *worker_thread(void *arg)
 {
     ThreadWork *work = (ThreadWork *)arg;
+    ct_thread_name("search", work->thread_id);
+
+    PerfGroup perf;
+    PerfSample perf_start, perf_end;
+    bool perf_on = pc_open(&perf) == 0;
+    if (perf_on)
+        pc_read(&perf, &perf_start);
+
+    /* Runs of consecutive cells, or curve segments, keep the row cursors
+     * short; one trace span per run, since one per cell would dwarf the work */
+    uint64_t cursor[MAX_SWEEP_ROWS];
+    for (;;) {
+        uint64_t lo = atomic_fetch_add(&g_next_cell, SEARCH_BATCH);
+        if (lo >= work->num_cells)
+            break;
+        uint64_t hi = lo + SEARCH_BATCH < work->num_cells ? lo + SEARCH_BATCH : work->num_cells;
+        uint64_t span = ct_begin();
+        for (int dx = 0; dx < g_sweep_rows; dx++)
+            cursor[dx] = lo;
+        for (uint64_t i = lo; i < hi; i++) {
+            uint64_t ci = i;
+            if (work->order) {
+                ci = work->order[i];
+                cursor[0] = ci;
+                for (int dx = 1; dx < g_sweep_rows; dx++)
+                    cursor[dx] = cursor[dx - 1] < work->num_cells ?
+                                 work->row_up[cursor[dx - 1]] : work->num_cells;
+            }
+            find_groups_in_cell(ci, cursor, work);
+            counter_inc(&work->cells_processed);
+        }
+        ct_end(span, "cells", (int64_t)hi);
+    }
 
-    for (uint64_t i = work->thread_id; i < work->num_cells; i += work->num_threads) {
-        find_groups_in_cell(&work->cells[i], work);
-
-        pthread_mutex_lock(&g_progress_lock);
-        g_processed_cells++;
-        pthread_mutex_unlock(&g_progress_lock);
-
-        work->cells_processed++;
+    if (perf_on) {
+        pc_read(&perf, &perf_end);
+        pc_phase_add("search", "cell", &perf_start, &perf_end,
+                     load_counter(&work->cells_processed));
+        pc_close(&perf);
     }
 
     return NULL;
@@ -836,9 +3027,14 @@ static void *worker_thread(void *arg)
 
 static void cleanup(void)
 {
+    stop_prom_thread();
     free(g_structures); g_structures = NULL;
+    free(g_types); g_types = NULL;
     free(g_cells); g_cells = NULL;
-    free(g_hash_table); g_hash_table = NULL;
+    free(g_cell_order); g_cell_order = NULL;
+    free(g_row_up); g_row_up = NULL;
+    free(g_run_starts); g_run_starts = NULL;
+    free(g_bucket_starts); g_bucket_starts = NULL;
 }
 
 static char *read_line(char *buf, size_t size)
@@ -851,7 +3047,8 @@ static char *read_line(char *buf, size_t size)
 
 int main(int argc, char **argv)
 {
-    (void)argc; (void)argv;
+    if (argc == 3 && strcmp(argv[1], "--bench-parse") == 0)
+        return bench_parse(argv[2]);
 
     char input_file[512];
     int64_t radius;
@@ -868,16 +3065,71 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    struct stat st;
-    if (stat(input_file, &st) < 0) {
-        fprintf(stderr, "Error: Cannot access '%s': %s\n", input_file, strerror(errno));
+    /* A file, or the parts of a structure_finder run given as a directory,
+     * glob or list */
+    InputList inputs;
+    memset(&inputs, 0, sizeof(inputs));
+    if (!input_add(&inputs, input_file)) {
+        input_free(&inputs);
         return 1;
     }
-    
-    size_t file_size = st.st_size;
+
+    size_t file_size = inputs.total_size;
     uint64_t estimated_structures = file_size / AVG_BYTES_PER_LINE;
-    printf("  File size: %.2f GB (~%lu structures)\n\n", 
-           file_size / (1024.0 * 1024.0 * 1024.0), (unsigned long)estimated_structures);
+
+    /* Tile stores and region bitmaps can be loaded for a sub-area only */
+    TsReader store;
+    RbReader bitmap;
+    bool is_store = inputs.count == 1 && ts_is_store(inputs.paths[0]);
+    bool is_bitmap = inputs.count == 1 && !is_store && rb_is_bitmap(inputs.paths[0]);
+    int32_t area[4] = { INT32_MIN, INT32_MIN, INT32_MAX, INT32_MAX };
+    if (is_store || is_bitmap) {
+        if (is_store) {
+            if (ts_open_read(&store, input_file) != 0)
+                return 1;
+            printf("Tile store: %s, seed %ld, %lu structures\n",
+                   store.hdr->label, (long)store.hdr->seed,
+                   (unsigned long)store.hdr->recordCount);
+        } else {
+            if (rb_open_read(&bitmap, input_file) != 0)
+                return 1;
+            if (bitmap.hdr->posKind == RB_POS_CUBIOMES) {
+                fprintf(stderr, "Error: %s positions need cubiomes to regenerate; "
+                        "use text output for this type\n", bitmap.hdr->label);
+                rb_close_read(&bitmap);
+                return 1;
+            }
+            printf("Region bitmap: %s, seed %ld, %lu structures\n",
+                   bitmap.hdr->label, (long)bitmap.hdr->seed,
+                   (unsigned long)bitmap.hdr->bitCount);
+        }
+        printf("Enter area as minX minZ maxX maxZ (blank = everything): ");
+        fflush(stdout);
+        char area_buf[256];
+        if (read_line(area_buf, sizeof(area_buf)) && area_buf[0] != '\0') {
+            long a[4];
+            if (sscanf(area_buf, "%ld %ld %ld %ld", &a[0], &a[1], &a[2], &a[3]) != 4) {
+                fprintf(stderr, "Error: Expected four numbers\n");
+                if (is_store) ts_close_read(&store);
+                else rb_close_read(&bitmap);
+                return 1;
+            }
+            for (int i = 0; i < 4; i++)
+                area[i] = (int32_t)a[i];
+        }
+        if (is_store)
+            estimated_structures = ts_query(&store, area[0], area[1], area[2], area[3], NULL, NULL);
+        else
+            estimated_structures = rb_query(&bitmap, area[0], area[1], area[2], area[3],
+                                            rb_builtin_pos, (void *)bitmap.hdr, NULL, NULL);
+        printf("  Structures in area: %lu\n\n", (unsigned long)estimated_structures);
+    } else if (inputs.count > 1) {
+        printf("  %d files, %.2f GB (~%lu structures)\n\n", inputs.count,
+               file_size / (1024.0 * 1024.0 * 1024.0), (unsigned long)estimated_structures);
+    } else {
+        printf("  File size: %.2f GB (~%lu structures)\n\n", 
+               file_size / (1024.0 * 1024.0 * 1024.0), (unsigned long)estimated_structures);
+    }
 
     /* Auto-configure based on system memory */
     detect_and_configure(estimated_structures);
@@ -917,26 +3169,93 @@ int main(int argc, char **argv)
         num_threads = 1;
     }
 
+    /* Optional Prometheus textfile for node_exporter */
+    char prom_buf[600];
+    static char prom_path[512];
+    printf("Write Prometheus metrics to file, optionally followed by interval in seconds (blank = off): ");
+    fflush(stdout);
+    if (read_line(prom_buf, sizeof(prom_buf)) &&
+        prom_parse_target(prom_buf, prom_path, sizeof(prom_path), &g_prom_interval))
+        g_prom_path = prom_path;
+
+    /* Optional timeline of per-thread activity for chrome://tracing */
+    char trace_path[512];
+    printf("Write Chrome trace to file (blank = off): ");
+    fflush(stdout);
+    if (read_line(trace_path, sizeof(trace_path)) && trace_path[0] != '\0') {
+        ct_enable();
+        ct_thread_name("main", -1);
+    }
+
+    /* Optional hardware counters (IPC, LLC and branch misses) per phase */
+    char perf_buf[64];
+    printf("Sample hardware performance counters per phase? [y/N]: ");
+    fflush(stdout);
+    if (read_line(perf_buf, sizeof(perf_buf)) && (perf_buf[0] == 'y' || perf_buf[0] == 'Y'))
+        pc_enable();
+    /* Optional Hilbert curve layout of the cells for the search */
+    char hilbert_buf[64];
+    printf("Order cells along a Hilbert curve instead of row-major? [y/N]: ");
+    fflush(stdout);
+    if (read_line(hilbert_buf, sizeof(hilbert_buf)) &&
+        (hilbert_buf[0] == 'y' || hilbert_buf[0] == 'Y'))
+        g_hilbert = true;
+
+    /* Main's own share of the parse and index; the threads those phases
+     * start add theirs through HelperPerf */
+    PerfGroup main_perf;
+    PerfSample perf_a, perf_b;
+    pc_open(&main_perf);
+
     printf("\n=== Final Configuration ===\n");
     printf("  Input: %s\n", input_file);
     printf("  Radius: %ld blocks\n", (long)radius);
     printf("  Cell size: %ld blocks\n", (long)(radius * g_cell_multiplier));
     printf("  Threads: %d\n", num_threads);
+    printf("  Cell order: %s\n", g_hilbert ? "Hilbert curve" : "row-major");
     printf("\n");
 
     struct timespec total_start;
     clock_gettime(CLOCK_MONOTONIC, &total_start);
-
-    uint64_t count = parse_file(input_file);
+    g_total_start = total_start;
+
+    uint64_t count;
+    atomic_store(&g_prom_phase, is_store || is_bitmap ? "load" : "parse");
+    start_prom_thread();
+    uint64_t span = ct_begin();
+    g_perf_phase = is_store || is_bitmap ? "load" : "parse_file";
+    pc_read(&main_perf, &perf_a);
+    if (is_store) {
+        count = load_store(&store, area[0], area[1], area[2], area[3], estimated_structures);
+        ts_close_read(&store);
+    } else if (is_bitmap) {
+        count = load_bitmap(&bitmap, area[0], area[1], area[2], area[3], estimated_structures);
+        rb_close_read(&bitmap);
+    } else {
+        count = parse_files(&inputs, num_threads, radius);
+    }
+    input_free(&inputs);
+    warn_type_table(&g_type_table);
+    ct_end(span, is_store || is_bitmap ? "load" : "parse_file", (int64_t)count);
+    pc_read(&main_perf, &perf_b);
+    pc_phase_add(g_perf_phase, "structure", &perf_a, &perf_b, count);
     if (count == 0) {
         cleanup();
         return 1;
     }
 
-    if (!build_spatial_index(radius)) {
+    atomic_store(&g_prom_phase, "index");
+    span = ct_begin();
+    g_perf_phase = "build_spatial_index";
+    pc_read(&main_perf, &perf_a);
+    if (!build_spatial_index(radius, num_threads)) {
         cleanup();
         return 1;
     }
+    ct_end(span, "build_spatial_index", (int64_t)g_cells_count);
+    pc_read(&main_perf, &perf_b);
+    pc_phase_add(g_perf_phase, "structure", &perf_a, &perf_b, count);
+    pc_close(&main_perf);
 
     char output_filename[256];
     snprintf(output_filename, sizeof(output_filename), "groups_%ld.txt", (long)radius);
@@ -954,7 +3273,7 @@ int main(int argc, char **argv)
     printf("Searching for groups...\n");
 
     pthread_t *threads = malloc((size_t)num_threads * sizeof(pthread_t));
-    ThreadWork *work = calloc((size_t)num_threads, sizeof(ThreadWork));
+    ThreadWork *work = aligned_alloc(CACHE_LINE, (size_t)num_threads * sizeof(ThreadWork));
     pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
 
     if (!threads || !work) {
@@ -962,11 +3281,12 @@ int main(int argc, char **argv)
         cleanup();
         return 1;
     }
+    memset(work, 0, (size_t)num_threads * sizeof(ThreadWork));
+    atomic_store(&g_prom_phase, "search");
 
     clock_gettime(CLOCK_MONOTONIC, &g_start_time);
-
-    pthread_t progress_tid;
-    pthread_create(&progress_tid, NULL, progress_thread, NULL);
+    span = ct_begin();
+    atomic_store(&g_next_cell, 0);
 
     /* Buffer size scales with available memory */
     uint32_t buf_size = (g_mode == MODE_HIGH_PERF) ? 262144 : 
@@ -979,11 +3299,11 @@ int main(int argc, char **argv)
         work[i].num_structures = g_structures_count;
         work[i].cells = g_cells;
         work[i].num_cells = g_cells_count;
-        work[i].hash_table = g_hash_table;
-        work[i].hash_table_size = g_hash_table_size;
+        work[i].order = g_cell_order;
+        work[i].row_up = g_row_up;
         work[i].radius = radius;
         work[i].radius_sq = radius * radius;
-        work[i].cell_size = radius * g_cell_multiplier;
+        work[i].cell_size = g_cell_size;
         work[i].output = output;
         work[i].output_lock = &output_lock;
         work[i].neighbors_buf = malloc(buf_size * sizeof(uint32_t));
@@ -999,6 +3319,11 @@ int main(int argc, char **argv)
         pthread_create(&threads[i], NULL, worker_thread, &work[i]);
     }
 
+    atomic_store(&g_prom_work, work);
+
+    pthread_t progress_tid;
+    pthread_create(&progress_tid, NULL, progress_thread, work);
+
     uint64_t total_3 = 0, total_4 = 0;
     for (int i = 0; i < num_threads; i++) {
         pthread_join(threads[i], NULL);
@@ -1007,8 +3332,14 @@ int main(int argc, char **argv)
         free(work[i].neighbors_buf);
     }
 
-    g_done = 1;
+    atomic_store_explicit(&g_done, 1, memory_order_relaxed);
     pthread_join(progress_tid, NULL);
+    ct_end(span, "search", num_threads);
+    stop_prom_thread();
+    if (g_prom_path) {
+        atomic_store(&g_prom_phase, "done");
+        write_prom_metrics(g_prom_path, work);
+    }
 
     fprintf(output, "\n=== Summary ===\n");
     fprintf(output, "Groups of 3: %lu\n", (unsigned long)total_3);
@@ -1023,6 +3354,8 @@ int main(int argc, char **argv)
     printf("Groups of 3: %lu\n", (unsigned long)total_3);
     printf("Groups of 4: %lu\n", (unsigned long)total_4);
     printf("Output: %s\n", output_filename);
+    if (g_first_group >= 0)
+        printf("First group after: %.2fs\n", g_first_group);
     printf("Time: %02d:%02d:%02d (%.1fs)\n",
            (int)(elapsed / 3600), ((int)elapsed % 3600) / 60, (int)elapsed % 60, elapsed);
 
@@ -1031,5 +3364,13 @@ int main(int argc, char **argv)
     free(work);
     cleanup();
 
+    pc_report(stdout);
+    if (ct_on) {
+        if (ct_write(trace_path) == 0)
+            printf("Trace: %s\n", trace_path);
+        else
+            fprintf(stderr, "Warning: could not write trace to %s\n", trace_path);
+    }
+
     return 0;
 }
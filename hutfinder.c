@@ -1,202 +1,418 @@
+// hutfinder - finds quad swamp hut and quad ocean monument seeds
+//
+// A quad is four structures in the corners of four neighbouring regions,
+// close enough for one AFK spot to cover all of them. Whether a structure
+// seed has a quad depends only on its lower 48 bits, and for huts only on
+// a few patterns of the lower 20 bits, so the search runs over seed space
+// rather than over one world:
+//
+//   1. quad bases: cubiomes' quadbase searchAll48 over the known lower
+//      20-bit constellations for huts; the precomputed base lists for
+//      monuments.
+//   2. expansion: each base is moved so the quad lies around 0,0 and
+//      expanded by its upper 16 bits into world seeds, keeping those where
+//      all four structures pass the biome check.
+//
+// Every matching world seed is written out with the four positions and
+// the optimal AFK position.
+
 #include "generator.h"
 #include "finders.h"
+#include "quadbase.h"
+#include "util.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
-#include <unistd.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <string.h>
 #include <time.h>
-#include <sys/stat.h>
+#include <unistd.h>
 
-// Define a struct to hold thread arguments
+#define QF_CACHE_LINE 64
+#define QF_UPPER_CHUNK 4096     // upper 16-bit values per work unit
+#define QF_RADIUS 128           // AFK sphere radius the quad has to fit
+
+// One quad base, ready for expansion
 typedef struct
 {
-    int totalThreads;
-    int numThread;
-    int startRegionX;
-    int endRegionX;
-    int startRegionZ;
-    int endRegionZ;
-    char *tempDir;
-    int64_t seed;
-} ThreadArgs;
+    uint64_t s48;           // structure seed with the quad around 0,0
+    Pos pos[4];
+    Pos afk;
+    int spaces;             // spawning spaces in range of the AFK spot
+    atomic_int found;       // world seeds reported so far
+} QuadBase;
 
+typedef struct
+{
+    _Atomic uint64_t worlds;    // world seeds tested
+    _Atomic uint64_t matches;
+} __attribute__((aligned(QF_CACHE_LINE))) QuadSlot;
 
-void logD(const char *msg)
+static struct
 {
-    // log with date before message
-    time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
-    printf("[%d-%02d-%02d %02d:%02d:%02d] %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, msg);
+    int type;
+    const char *label;
+    int mc;
+    QuadBase *bases;
+    uint64_t baseCount;
+    int perBaseLimit;           // world seeds reported per base, 0 = all
+    _Atomic uint64_t next;      // next (base, upper chunk) unit
+    uint64_t units;
+    QuadSlot *slots;
+    int threads;
+    atomic_int done;
+    struct timespec startTime;
+    FILE *out;
+    pthread_mutex_t outLock;
+} g_quad;
+
+static volatile char g_stop;
+
+static void on_interrupt(int sig)
+{
+    (void)sig;
+    g_stop = 1;
 }
 
-// Define a thread function
-void *threadFunc(void *arg)
+static double elapsed_since(const struct timespec *start)
 {
-    ThreadArgs *args = (ThreadArgs *)arg;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
 
-    Pos currPos;
-    int regionX, regionZ;
-    int64_t seed = args->seed;
-    uint64_t s48 = (uint64_t)seed;
-    int mc = MC_1_20;
-    Generator g;
+// Only this thread writes its slot, so a relaxed load and store is enough
+static void slot_add(_Atomic uint64_t *v, uint64_t n)
+{
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static void quad_totals(uint64_t *worlds, uint64_t *matches)
+{
+    *worlds = *matches = 0;
+    for (int t = 0; t < g_quad.threads; t++)
+    {
+        *worlds += atomic_load_explicit(&g_quad.slots[t].worlds, memory_order_relaxed);
+        *matches += atomic_load_explicit(&g_quad.slots[t].matches, memory_order_relaxed);
+    }
+}
 
-    setupGenerator(&g, mc, 0);
-    applySeed(&g, DIM_OVERWORLD, s48);
+// Stage 1 --------------------------------------------------------------------
 
-    // Generate file names with thread number, use temp directory
-    char filename[100];
-    sprintf(filename, "%s/huts_%03d.txt", args->tempDir, args->numThread);
-    FILE *f = fopen(filename, "w");
+static int check_quad(uint64_t s48, void *data)
+{
+    const StructureConfig *sconf = (const StructureConfig *)data;
+    return isQuadBase(*sconf, s48 - sconf->salt, QF_RADIUS) != 0;
+}
 
-    char filename2[100];
-    sprintf(filename2, "%s/monuments_%03d.txt", args->tempDir, args->numThread);
-    FILE *f2 = fopen(filename2, "w");
+// Bounding box of the structure, for the AFK spot and spawning spaces
+static void structure_box(int type, int *ax, int *ay, int *az)
+{
+    if (type == Monument)
+    {
+        *ax = 58;
+        *ay = 23;
+        *az = 58;
+    }
+    else
+    {
+        *ax = 7 + 1;
+        *ay = 7 + 1;
+        *az = 9 + 1;
+    }
+}
 
-    long long numHuts = 0;
-    long long numMonuments = 0;
+// Moves each base so its quad occupies regions (-1,-1) to (0,0) and works
+// out the positions and AFK spot. Bases that fail the quad check are
+// dropped. Returns the number kept.
+static uint64_t prepare_bases(const StructureConfig *sconf, const uint64_t *raw, uint64_t n)
+{
+    g_quad.bases = calloc(n ? n : 1, sizeof(QuadBase));
+    if (!g_quad.bases)
+        return 0;
+    int ax, ay, az;
+    structure_box(g_quad.type, &ax, &ay, &az);
+    uint64_t kept = 0;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        if (!check_quad(raw[i], (void *)sconf))
+            continue;
+        QuadBase *b = &g_quad.bases[kept];
+        b->s48 = moveStructure(raw[i] - sconf->salt, -1, -1);
+        int ok = 1;
+        for (int k = 0; k < 4; k++)
+            ok &= getStructurePos(g_quad.type, g_quad.mc, b->s48, (k >> 1) - 1, (k & 1) - 1, &b->pos[k]);
+        if (!ok)
+            continue;
+        b->afk = getOptimalAfk(b->pos, ax, ay, az, &b->spaces);
+        kept++;
+    }
+    return kept;
+}
 
-    printf("Thread %03d: Regions (%d, %d) to (%d, %d)\n", args->numThread, args->startRegionX, args->startRegionZ, args->endRegionX, args->endRegionZ);
+// Stage 2 --------------------------------------------------------------------
 
-    sleep(5 + args->numThread);
-    // Timing variables
-    uint64_t totalRegions = (uint64_t)(args->endRegionX - args->startRegionX) * (args->endRegionZ - args->startRegionZ);
-    struct timespec startTime, currentTime;
-    clock_gettime(CLOCK_MONOTONIC, &startTime);
+static void report_match(const QuadBase *b, uint64_t seed)
+{
+    pthread_mutex_lock(&g_quad.outLock);
+    fprintf(g_quad.out, "%" PRId64 " afk(%d,%d) spaces %d %s", (int64_t)seed,
+        b->afk.x, b->afk.z, b->spaces, g_quad.label);
+    for (int k = 0; k < 4; k++)
+        fprintf(g_quad.out, " (%d,%d)", b->pos[k].x, b->pos[k].z);
+    fprintf(g_quad.out, "\n");
+    fflush(g_quad.out);
+    pthread_mutex_unlock(&g_quad.outLock);
+}
 
-    float lastPrintedPercentage = 0;
-    float interval = 0.05f; // Set the interval for progress updates (0.01%)
-    uint64_t processedRegions = 0;
-    time_t etaStart = time(NULL);
+static void *expandThread(void *arg)
+{
+    int thread = (int)(intptr_t)arg;
+    QuadSlot *slot = &g_quad.slots[thread];
+    const int chunks = 0x10000 / QF_UPPER_CHUNK;
+    Generator g;
+    setupGenerator(&g, g_quad.mc, 0);
 
-    for (regionX = args->startRegionX; regionX < args->endRegionX; regionX++)
+    while (!g_stop)
     {
-        for (regionZ = args->startRegionZ; regionZ < args->endRegionZ; regionZ++)
+        uint64_t u = atomic_fetch_add_explicit(&g_quad.next, 1, memory_order_relaxed);
+        if (u >= g_quad.units)
+            break;
+        QuadBase *b = &g_quad.bases[u / chunks];
+        uint64_t upper0 = (u % chunks) * QF_UPPER_CHUNK;
+        uint64_t worlds = 0, matches = 0;
+        for (uint64_t upper = upper0; upper < upper0 + QF_UPPER_CHUNK; upper++)
         {
-            processedRegions++;
-            float perc = (float)processedRegions / totalRegions * 100;
-
-            // Print progress only at specified intervals
-            if (perc - lastPrintedPercentage >= interval)
-            {
-                lastPrintedPercentage = perc;
-                clock_gettime(CLOCK_MONOTONIC, &currentTime);
-                double elapsedSeconds = (currentTime.tv_sec - startTime.tv_sec) + (currentTime.tv_nsec - startTime.tv_nsec) / 1e9;
-                double regionsPerSecond = processedRegions / elapsedSeconds;
-
-                // Calculate ETA
-                uint64_t remainingRegions = totalRegions - processedRegions;
-                double etaSeconds = remainingRegions / regionsPerSecond;
-
-                // Convert ETA to human-readable format
-                int etaMinutes = etaSeconds / 60;
-                int etaHours = etaMinutes / 60;
-                etaMinutes %= 60;
-                etaSeconds = fmod(etaSeconds, 60);
-
-                int elapsedMinutes = elapsedSeconds / 60;
-                int elapsedHours = elapsedMinutes / 60;
-                elapsedMinutes %= 60;
-                elapsedSeconds = fmod(elapsedSeconds, 60);
-
-                double totalRegionsPerSecond = regionsPerSecond * args->totalThreads;
-
-                printf("Thread %03d: %.2f%% - Huts: %llu - Monuments: %llu - TotReg/s: %.2f - ETA: %03dh%02dm%02ds - Elapsed: %02dh%02dm%02ds\n",
-                       args->numThread,
-                       (double)processedRegions / totalRegions * 100,
-                       numHuts, numMonuments,
-                       totalRegionsPerSecond,
-                       etaHours, etaMinutes, (int)etaSeconds
-                       , elapsedHours, elapsedMinutes, (int)elapsedSeconds);
-            }
-
-            getStructurePos(Swamp_Hut, mc, seed, regionX, regionZ, &currPos);
-            if (isViableStructurePos(Swamp_Hut, &g, currPos.x, currPos.z, 0))
-            {
-                numHuts++;
-                fprintf(f, "hut->(%d,%d)reg(%d,%d)\n", currPos.x, currPos.z, regionX, regionZ);
-            }
-
-            getStructurePos(Monument, mc, seed, regionX, regionZ, &currPos);
-            if (isViableStructurePos(Monument, &g, currPos.x, currPos.z, 0))
-            {
-                numMonuments++;
-                fprintf(f2, "monument->(%d,%d)reg(%d,%d)\n", currPos.x, currPos.z, regionX, regionZ);
-            }
+            if (g_quad.perBaseLimit && atomic_load_explicit(&b->found, memory_order_relaxed) >= g_quad.perBaseLimit)
+                break;
+            uint64_t seed = (upper << 48) | b->s48;
+            applySeed(&g, DIM_OVERWORLD, seed);
+            worlds++;
+            int ok = 1;
+            for (int k = 0; k < 4 && ok; k++)
+                ok = isViableStructurePos(g_quad.type, &g, b->pos[k].x, b->pos[k].z, 0);
+            if (!ok)
+                continue;
+            // Claim a place so concurrent chunks of one base stay within the limit
+            int n = atomic_fetch_add(&b->found, 1);
+            if (g_quad.perBaseLimit && n >= g_quad.perBaseLimit)
+                break;
+            report_match(b, seed);
+            matches++;
         }
+        slot_add(&slot->worlds, worlds);
+        slot_add(&slot->matches, matches);
     }
-
-    fclose(f);
-    fclose(f2);
-
     return NULL;
 }
 
-int main()
+static void *progressThread(void *arg)
 {
+    (void)arg;
+    uint64_t total = g_quad.baseCount * 0x10000;
+    for (;;)
+    {
+        int finished = atomic_load_explicit(&g_quad.done, memory_order_acquire);
+        uint64_t worlds, matches;
+        quad_totals(&worlds, &matches);
+        // Units cut short by the limit count as done
+        uint64_t done = atomic_load_explicit(&g_quad.next, memory_order_relaxed);
+        if (done > g_quad.units)
+            done = g_quad.units;
+        double elapsed = elapsed_since(&g_quad.startTime);
+        double perc = g_quad.units ? 100.0 * done / g_quad.units : 100.0;
+        fprintf(stderr, "\rSeeds/s: %.0f | Progress: %6.2f%% of %llu world seeds | matches: %llu   ",
+            elapsed > 0 ? worlds / elapsed : 0.0, perc, (unsigned long long)total,
+            (unsigned long long)matches);
+        if (finished)
+            break;
+        usleep(500000);
+    }
+    fprintf(stderr, "\n");
+    return NULL;
+}
 
-    int regionsAxis = 117188;
-    int maxRegion = 58594;
-    int minRegion = -maxRegion;
-
-    // Input for number of threads
-    int numThreads;
-    printf("Enter the number of threads: ");
-    scanf("%d", &numThreads);
-
-    int64_t seed;
-    printf("Enter seed: ");
-    scanf("%ld", &seed);
-
-
-    pthread_t threads[numThreads];
-    ThreadArgs threadArgs[numThreads];
-
-    // remove old temp directories
-    system("rm -rf tmp*");
+// Setup ----------------------------------------------------------------------
 
-    // create new temp directory with date
-    time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
-    char tempDir[20];
-    sprintf(tempDir, "tmp_%d%02d%02d%02d%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min);
-    mkdir(tempDir, 0777);
-    printf("Created tmp directory: %s\n", tempDir);
+static int read_line(char *buf, int n)
+{
+    if (!fgets(buf, n, stdin))
+        return 0;
+    buf[strcspn(buf, "\r\n")] = '\0';
+    return 1;
+}
 
-    // Divide the map area along the X-axis among threads
-    int regionsPerThreadX = regionsAxis / numThreads;
-    int startRegionX = minRegion;
+static int read_choice(const char *prompt, int count, int def)
+{
+    char buf[64];
+    printf("%s", prompt);
+    if (read_line(buf, sizeof(buf)) && atoi(buf) >= 1 && atoi(buf) <= count)
+        return atoi(buf);
+    return def;
+}
 
-    for (int i = 0; i < numThreads; i++)
+int main()
+{
+    char buf[256];
+
+    int numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    printf("Enter the number of threads (blank = %d): ", numThreads);
+    if (read_line(buf, sizeof(buf)) && atoi(buf) > 0)
+        numThreads = atoi(buf);
+
+    int versionsList[] = {
+        MC_1_7, MC_1_8, MC_1_9, MC_1_10, MC_1_11, MC_1_12, MC_1_13, MC_1_14, MC_1_15,
+        MC_1_16_1, MC_1_16, MC_1_17, MC_1_18, MC_1_19_2, MC_1_19, MC_1_20,
+        MC_1_21_1, MC_1_21_3, MC_1_21_WD
+    };
+    const int versionsCount = (int)(sizeof(versionsList) / sizeof(versionsList[0]));
+    printf("Select Minecraft version (enter one index):\n");
+    for (int i = 0; i < versionsCount; i++)
+        printf("  %d) %s\n", i + 1, mc2str(versionsList[i]));
+    g_quad.mc = versionsList[read_choice("Your choice (default latest): ", versionsCount, versionsCount) - 1];
+
+    printf("Structure:\n  1) swamp hut\n  2) ocean monument\n");
+    int monument = read_choice("Your choice (default 1): ", 2, 1) == 2;
+    g_quad.type = monument ? Monument : Swamp_Hut;
+    g_quad.label = monument ? "monuments" : "huts";
+
+    StructureConfig sconf;
+    if (!getStructureConfig(g_quad.type, g_quad.mc, &sconf))
     {
+        fprintf(stderr, "Error: %s do not generate in %s\n", g_quad.label, mc2str(g_quad.mc));
+        return 1;
+    }
 
-        threadArgs[i].numThread = i;
-        threadArgs[i].tempDir = tempDir;
-        threadArgs[i].seed = seed;
-        threadArgs[i].totalThreads = numThreads;
-
-        // Calculate end region for X-axis
-        int endRegionX = startRegionX + regionsPerThreadX;
-        if (i == numThreads - 1) // Last thread takes the remaining regions
-            endRegionX = maxRegion;
-
-        threadArgs[i].startRegionX = startRegionX;
-        threadArgs[i].endRegionX = endRegionX;
-        threadArgs[i].startRegionZ = minRegion; // Constant Z-axis
-        threadArgs[i].endRegionZ = maxRegion;   // Constant Z-axis
-
-        // Update start region for next thread
-        startRegionX = endRegionX;
+    const uint64_t *lowBits = NULL;
+    int lowBitCnt = 0;
+    if (monument)
+    {
+        printf("Quad monuments (precomputed bases):\n"
+            "  1) at least 95%% of the area in range\n"
+            "  2) at least 90%% of the area in range\n");
+        if (read_choice("Your choice (default 1): ", 2, 1) == 1)
+        {
+            lowBits = g_qm_95;
+            lowBitCnt = (int)(sizeof(g_qm_95) / sizeof(g_qm_95[0]));
+        }
+        else
+        {
+            lowBits = g_qm_90;
+            lowBitCnt = (int)(sizeof(g_qm_90) / sizeof(g_qm_90[0]));
+        }
+    }
+    else
+    {
+        printf("Quad huts (lower 20-bit constellations, each includes the ones above):\n"
+            "  1) ideal\n  2) classic\n  3) normal\n  4) barely\n");
+        switch (read_choice("Your choice (default 1): ", 4, 1))
+        {
+            case 1:
+                lowBits = low20QuadIdeal;
+                lowBitCnt = (int)(sizeof(low20QuadIdeal) / sizeof(low20QuadIdeal[0]));
+                break;
+            case 2:
+                lowBits = low20QuadClassic;
+                lowBitCnt = (int)(sizeof(low20QuadClassic) / sizeof(low20QuadClassic[0]));
+                break;
+            case 3:
+                lowBits = low20QuadHutNormal;
+                lowBitCnt = (int)(sizeof(low20QuadHutNormal) / sizeof(low20QuadHutNormal[0]));
+                break;
+            default:
+                lowBits = low20QuadHutBarely;
+                lowBitCnt = (int)(sizeof(low20QuadHutBarely) / sizeof(low20QuadHutBarely[0]));
+                break;
+        }
+    }
 
-        // Create thread
-        pthread_create(&threads[i], NULL, threadFunc, (void *)&threadArgs[i]);
+    printf("World seeds to report per quad base (blank = 1, 0 = all): ");
+    g_quad.perBaseLimit = 1;
+    if (read_line(buf, sizeof(buf)) && buf[0] != '\0' && atoi(buf) >= 0)
+        g_quad.perBaseLimit = atoi(buf);
+
+    char outPath[256];
+    snprintf(outPath, sizeof(outPath), "quad_%s.txt", g_quad.label);
+    printf("Output file (blank = %s): ", outPath);
+    if (read_line(buf, sizeof(buf)) && buf[0] != '\0')
+        snprintf(outPath, sizeof(outPath), "%s", buf);
+    g_quad.out = fopen(outPath, "w");
+    if (!g_quad.out)
+    {
+        fprintf(stderr, "Error: cannot create %s\n", outPath);
+        return 1;
+    }
+    fprintf(g_quad.out, "# %s, quad %s around 0,0: seed afk(x,z) spaces n positions\n",
+        mc2str(g_quad.mc), g_quad.label);
+    pthread_mutex_init(&g_quad.outLock, NULL);
+    signal(SIGINT, on_interrupt);
+
+    // Stage 1: quad bases
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    uint64_t *raw = NULL;
+    uint64_t rawCount = 0;
+    if (monument)
+    {
+        raw = malloc((size_t)lowBitCnt * sizeof(uint64_t));
+        if (raw)
+            memcpy(raw, lowBits, (size_t)lowBitCnt * sizeof(uint64_t));
+        rawCount = raw ? (uint64_t)lowBitCnt : 0;
+    }
+    else
+    {
+        printf("Searching quad bases over %d lower 20-bit patterns...\n", lowBitCnt);
+        if (searchAll48(&raw, &rawCount, NULL, numThreads, lowBits, lowBitCnt, 20,
+                check_quad, &sconf, &g_stop) != 0)
+        {
+            fprintf(stderr, "Error: quad base search failed\n");
+            return 1;
+        }
+    }
+    g_quad.baseCount = prepare_bases(&sconf, raw, rawCount);
+    free(raw);
+    printf("%llu quad bases in %.1fs\n", (unsigned long long)g_quad.baseCount, elapsed_since(&t0));
+    if (g_stop || g_quad.baseCount == 0)
+    {
+        fclose(g_quad.out);
+        free(g_quad.bases);
+        return g_stop ? 1 : 0;
     }
 
-    // Wait for all threads to finish
-    for (int i = 0; i < numThreads; i++)
+    // Stage 2: expansion to world seeds
+    g_quad.threads = numThreads;
+    g_quad.units = g_quad.baseCount * (0x10000 / QF_UPPER_CHUNK);
+    g_quad.slots = aligned_alloc(QF_CACHE_LINE, (size_t)numThreads * sizeof(QuadSlot));
+    if (!g_quad.slots)
     {
-        pthread_join(threads[i], NULL);
+        fprintf(stderr, "Failed to allocate counters\n");
+        return 1;
     }
+    memset(g_quad.slots, 0, (size_t)numThreads * sizeof(QuadSlot));
 
+    clock_gettime(CLOCK_MONOTONIC, &g_quad.startTime);
+    pthread_t progThread;
+    pthread_create(&progThread, NULL, progressThread, NULL);
+    pthread_t threads[numThreads];
+    for (int i = 0; i < numThreads; i++)
+        pthread_create(&threads[i], NULL, expandThread, (void *)(intptr_t)i);
+    for (int i = 0; i < numThreads; i++)
+        pthread_join(threads[i], NULL);
+    double secs = elapsed_since(&g_quad.startTime);
+    atomic_store_explicit(&g_quad.done, 1, memory_order_release);
+    pthread_join(progThread, NULL);
+    fclose(g_quad.out);
+
+    uint64_t worlds, matches;
+    quad_totals(&worlds, &matches);
+    printf("%s: %llu world seeds tested in %.1fs, %llu matches written to %s\n",
+        g_stop ? "Interrupted" : "Finished", (unsigned long long)worlds, secs,
+        (unsigned long long)matches, outPath);
+
+    free(g_quad.slots);
+    free(g_quad.bases);
     return 0;
 }
@@ -0,0 +1,260 @@
+#include "perfcount.h"
+
+#include <string.h>
+
+#define PC_MAX_PHASES 16
+
+typedef struct
+{
+    const char *name;
+    const char *unit;
+    uint64_t v[PC_COUNT];
+    uint64_t units;
+    int samples;        // thread-phases added
+} PerfPhase;
+
+static int g_enabled;
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static PerfPhase g_phases[PC_MAX_PHASES];
+static int g_phaseCount;
+static int g_opened;            // groups opened successfully
+static int g_failed;            // groups that could not be opened
+static int g_failErrno;
+static unsigned g_missing;      // counters some thread could not open
+
+static const uint64_t pcConfig[PC_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,     // last level cache on most CPUs
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+void pc_enable(void)
+{
+    g_enabled = 1;
+}
+
+int pc_enabled(void)
+{
+    return g_enabled;
+}
+
+static int pc_open_one(int k, int groupFd)
+{
+    struct perf_event_attr a;
+    memset(&a, 0, sizeof(a));
+    a.size = sizeof(a);
+    a.type = PERF_TYPE_HARDWARE;
+    a.config = pcConfig[k];
+    a.disabled = groupFd < 0;
+    a.exclude_kernel = 1;
+    a.exclude_hv = 1;
+    a.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID |
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &a, 0, -1, groupFd, 0);
+}
+
+int pc_open(PerfGroup *g)
+{
+    for (int k = 0; k < PC_COUNT; k++)
+        g->fd[k] = -1;
+    g->leader = -1;
+    if (!g_enabled)
+        return -1;
+
+    int leader = pc_open_one(PC_CYCLES, -1);
+    if (leader < 0)
+    {
+        pthread_mutex_lock(&g_lock);
+        if (!g_failed++)
+            g_failErrno = errno;
+        pthread_mutex_unlock(&g_lock);
+        return -1;
+    }
+    g->fd[PC_CYCLES] = g->leader = leader;
+    unsigned missing = 0;
+    for (int k = 1; k < PC_COUNT; k++)
+    {
+        g->fd[k] = pc_open_one(k, leader);
+        if (g->fd[k] < 0)
+            missing |= 1u << k;
+    }
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    pthread_mutex_lock(&g_lock);
+    g_opened++;
+    g_missing |= missing;
+    pthread_mutex_unlock(&g_lock);
+    return 0;
+}
+
+void pc_read(const PerfGroup *g, PerfSample *s)
+{
+    memset(s, 0, sizeof(*s));
+    if (g->leader < 0)
+        return;
+
+    // nr, time_enabled, time_running, then { value, id } per counter
+    uint64_t buf[3 + 2 * PC_COUNT];
+    if (read(g->leader, buf, sizeof(buf)) < (ssize_t)(3 * sizeof(uint64_t)))
+        return;
+    uint64_t nr = buf[0];
+    if (nr > PC_COUNT)
+        nr = PC_COUNT;
+    double scale = buf[2] > 0 ? (double)buf[1] / (double)buf[2] : 1.0;
+
+    uint64_t ids[PC_COUNT];
+    for (int k = 0; k < PC_COUNT; k++)
+    {
+        ids[k] = (uint64_t)-1;
+        if (g->fd[k] >= 0)
+            ioctl(g->fd[k], PERF_EVENT_IOC_ID, &ids[k]);
+    }
+    for (uint64_t i = 0; i < nr; i++)
+    {
+        uint64_t value = buf[3 + 2 * i], id = buf[4 + 2 * i];
+        for (int k = 0; k < PC_COUNT; k++)
+        {
+            if (ids[k] == id)
+                s->v[k] = (uint64_t)(value * scale);
+        }
+    }
+}
+
+void pc_close(PerfGroup *g)
+{
+    for (int k = PC_COUNT - 1; k >= 0; k--)
+    {
+        if (g->fd[k] >= 0)
+            close(g->fd[k]);
+        g->fd[k] = -1;
+    }
+    g->leader = -1;
+}
+
+void pc_phase_add(const char *name, const char *unit, const PerfSample *a,
+    const PerfSample *b, uint64_t units)
+{
+    if (!g_enabled || !g_opened)
+        return;
+    pthread_mutex_lock(&g_lock);
+    PerfPhase *p = NULL;
+    for (int i = 0; i < g_phaseCount; i++)
+    {
+        if (strcmp(g_phases[i].name, name) == 0)
+            p = &g_phases[i];
+    }
+    if (!p && g_phaseCount < PC_MAX_PHASES)
+    {
+        p = &g_phases[g_phaseCount++];
+        p->name = name;
+        p->unit = unit;
+    }
+    if (p)
+    {
+        for (int k = 0; k < PC_COUNT; k++)
+            p->v[k] += b->v[k] - a->v[k];
+        p->units += units;
+        p->samples++;
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+static int pc_paranoid(void)
+{
+    int level = -99;
+    FILE *fp = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+    if (fp)
+    {
+        if (fscanf(fp, "%d", &level) != 1)
+            level = -99;
+        fclose(fp);
+    }
+    return level;
+}
+
+void pc_report(FILE *fp)
+{
+    if (!g_enabled)
+        return;
+    if (!g_opened)
+    {
+        fprintf(fp, "Hardware counters unavailable (perf_event_open: %s)", strerror(g_failErrno));
+        int level = pc_paranoid();
+        if (level != -99)
+            fprintf(fp, " (kernel.perf_event_paranoid = %d)", level);
+        fprintf(fp, "\n");
+        return;
+    }
+
+    fprintf(fp, "\n=== Hardware counters ===\n");
+    if (g_failed)
+        fprintf(fp, "(%d of %d threads could not open counters and are not included)\n",
+            g_failed, g_failed + g_opened);
+    fprintf(fp, "%-20s %8s %6s %14s %14s %12s\n", "phase", "threads", "IPC",
+        "cycles/unit", "LLC miss/unit", "br miss/unit");
+    for (int i = 0; i < g_phaseCount; i++)
+    {
+        const PerfPhase *p = &g_phases[i];
+        double u = p->units ? (double)p->units : 1.0;
+        char ipc[16], llc[32], br[32];
+        snprintf(ipc, sizeof(ipc), "%.2f", p->v[PC_CYCLES] ?
+            (double)p->v[PC_INSTRUCTIONS] / (double)p->v[PC_CYCLES] : 0.0);
+        snprintf(llc, sizeof(llc), "%.3f", p->v[PC_LLC_MISSES] / u);
+        snprintf(br, sizeof(br), "%.3f", p->v[PC_BRANCH_MISSES] / u);
+        fprintf(fp, "%-20s %8d %6s %14.1f %14s %12s  per %s\n", p->name, p->samples,
+            (g_missing & (1u << PC_INSTRUCTIONS)) ? "n/a" : ipc,
+            p->v[PC_CYCLES] / u,
+            (g_missing & (1u << PC_LLC_MISSES)) ? "n/a" : llc,
+            (g_missing & (1u << PC_BRANCH_MISSES)) ? "n/a" : br, p->unit);
+    }
+}
+
+#else
+
+void pc_enable(void) { g_enabled = 1; }
+int pc_enabled(void) { return g_enabled; }
+
+int pc_open(PerfGroup *g)
+{
+    for (int k = 0; k < PC_COUNT; k++)
+        g->fd[k] = -1;
+    g->leader = -1;
+    return -1;
+}
+
+void pc_read(const PerfGroup *g, PerfSample *s)
+{
+    (void)g;
+    memset(s, 0, sizeof(*s));
+}
+
+void pc_close(PerfGroup *g)
+{
+    (void)g;
+}
+
+void pc_phase_add(const char *name, const char *unit, const PerfSample *a,
+    const PerfSample *b, uint64_t units)
+{
+    (void)name; (void)unit; (void)a; (void)b; (void)units;
+}
+
+void pc_report(FILE *fp)
+{
+    if (g_enabled)
+        fprintf(fp, "Hardware counters need Linux perf events; not available here\n");
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef PERFCOUNT_H_
+#define PERFCOUNT_H_
+
+// Optional hardware performance counters per phase (Linux perf events).
+//
+// Each thread opens its own counter group, reads it at phase boundaries
+// and adds the difference to a named phase:
+//
+//     PerfGroup g;
+//     PerfSample a, b;
+//     pc_open(&g);
+//     pc_read(&g, &a);
+//     ... phase ...
+//     pc_read(&g, &b);
+//     pc_phase_add("scan", "region", &a, &b, regions);
+//     pc_close(&g);
+//
+// When perf events are unavailable (other platforms, containers,
+// perf_event_paranoid) pc_open fails, every other call does nothing and
+// pc_report says why once.
+
+#include <stdio.h>
+#include <stdint.h>
+
+enum
+{
+    PC_CYCLES,
+    PC_INSTRUCTIONS,
+    PC_LLC_MISSES,
+    PC_BRANCH_MISSES,
+    PC_COUNT
+};
+
+typedef struct
+{
+    int fd[PC_COUNT];   // -1 where the counter could not be opened
+    int leader;         // fd of the group leader, -1 if the group is unusable
+} PerfGroup;
+
+typedef struct
+{
+    uint64_t v[PC_COUNT];
+} PerfSample;
+
+// Turns sampling on; without it pc_open always fails silently.
+void pc_enable(void);
+int pc_enabled(void);
+
+// Opens the counters for the calling thread. Returns 0 on success.
+int pc_open(PerfGroup *g);
+void pc_read(const PerfGroup *g, PerfSample *s);
+void pc_close(PerfGroup *g);
+
+// Adds b - a to phase name, counted against `units` units of work such
+// as regions or cells. name and unit must be string literals.
+void pc_phase_add(const char *name, const char *unit, const PerfSample *a,
+    const PerfSample *b, uint64_t units);
+
+// Prints one line per phase: IPC and misses per unit of work.
+void pc_report(FILE *fp);
+
+#endif
@@ -0,0 +1,93 @@
+#include "promfile.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+
+#define PROM_DEFAULT_INTERVAL 15
+
+int prom_begin(PromFile *p, const char *path)
+{
+    p->path = path;
+    snprintf(p->tmpPath, sizeof(p->tmpPath), "%s.tmp", path);
+    p->fp = fopen(p->tmpPath, "w");
+    return p->fp ? 0 : -1;
+}
+
+void prom_help(PromFile *p, const char *name, const char *type, const char *help)
+{
+    fprintf(p->fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void prom_value(PromFile *p, const char *name, const char *labels, double value)
+{
+    if (labels && labels[0])
+        fprintf(p->fp, "%s{%s} %.17g\n", name, labels, value);
+    else
+        fprintf(p->fp, "%s %.17g\n", name, value);
+}
+
+int prom_end(PromFile *p)
+{
+    int err = ferror(p->fp);
+    if (fclose(p->fp) != 0)
+        err = 1;
+    p->fp = NULL;
+    if (!err)
+    {
+#ifdef _WIN32
+        err = !MoveFileExA(p->tmpPath, p->path, MOVEFILE_REPLACE_EXISTING);
+#else
+        err = rename(p->tmpPath, p->path) != 0;
+#endif
+    }
+    if (err)
+        remove(p->tmpPath);
+    return err ? -1 : 0;
+}
+
+uint64_t prom_rss_bytes(void)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return (uint64_t)pmc.WorkingSetSize;
+    return 0;
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS)
+        return (uint64_t)info.resident_size;
+    return 0;
+#else
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+        return 0;
+    unsigned long long size, resident;
+    int ok = fscanf(fp, "%llu %llu", &size, &resident) == 2;
+    fclose(fp);
+    return ok ? (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE) : 0;
+#endif
+}
+
+int prom_parse_target(const char *answer, char *path, size_t n, int *interval)
+{
+    while (*answer == ' ' || *answer == '\t')
+        answer++;
+    size_t len = strcspn(answer, " \t\r\n");
+    if (len == 0 || len >= n)
+        return 0;
+    memcpy(path, answer, len);
+    path[len] = '\0';
+    int secs = atoi(answer + len);
+    *interval = secs > 0 ? secs : PROM_DEFAULT_INTERVAL;
+    return 1;
+}
@@ -0,0 +1,48 @@
+#ifndef PROMFILE_H_
+#define PROMFILE_H_
+
+// Prometheus text exposition files.
+//
+// Long scans can publish their counters for node_exporter's textfile
+// collector. Each snapshot is written to "<path>.tmp" and renamed over
+// the target, so the collector never reads a half-written file:
+//
+//     PromFile p;
+//     if (prom_begin(&p, path) == 0)
+//     {
+//         prom_help(&p, "sf_regions_processed_total", "counter", "Regions scanned");
+//         prom_value(&p, "sf_regions_processed_total", NULL, done);
+//         prom_end(&p);
+//     }
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef struct
+{
+    FILE *fp;
+    const char *path;
+    char tmpPath[1024];
+} PromFile;
+
+// Opens a new snapshot for path. Returns 0 on success.
+int prom_begin(PromFile *p, const char *path);
+
+// Writes the # HELP and # TYPE lines of a metric family.
+void prom_help(PromFile *p, const char *name, const char *type, const char *help);
+
+// Writes one sample; labels is the text between the braces, e.g.
+// "type=\"hut\"", or NULL for none.
+void prom_value(PromFile *p, const char *name, const char *labels, double value);
+
+// Closes the snapshot and replaces the target. Returns 0 on success.
+int prom_end(PromFile *p);
+
+// Resident set size of this process in bytes, 0 if unknown.
+uint64_t prom_rss_bytes(void);
+
+// Parses an answer of the form "<path> [seconds]". Returns 1 and fills
+// path (of size n) and *interval when a path was given, else 0.
+int prom_parse_target(const char *answer, char *path, size_t n, int *interval);
+
+#endif
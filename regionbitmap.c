@@ -0,0 +1,455 @@
+#include "regionbitmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+struct RegionBitmap
+{
+    FILE *fp;
+    RbHeader hdr;
+    uint64_t end;           // next free byte for a tile block
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+#else
+    pthread_mutex_t lock;
+#endif
+};
+
+static int rb_seek(FILE *fp, uint64_t off)
+{
+#ifdef _WIN32
+    return _fseeki64(fp, (__int64)off, SEEK_SET);
+#else
+    return fseeko(fp, (off_t)off, SEEK_SET);
+#endif
+}
+
+static uint64_t rb_dir_bytes(void)
+{
+    return (uint64_t)TS_TILES_AXIS * TS_TILES_AXIS * sizeof(RbTileEntry);
+}
+
+RegionBitmap *rb_create(const char *path, const RbHeader *hdr)
+{
+    RegionBitmap *rb = (RegionBitmap *)calloc(1, sizeof(RegionBitmap));
+    if (!rb)
+        return NULL;
+
+    rb->fp = fopen(path, "w+b");
+    if (!rb->fp)
+    {
+        fprintf(stderr, "Error: cannot create bitmap %s\n", path);
+        free(rb);
+        return NULL;
+    }
+    setvbuf(rb->fp, NULL, _IOFBF, 1 << 20);
+
+    rb->hdr = *hdr;
+    rb->hdr.magic = RB_MAGIC;
+    rb->hdr.version = RB_FORMAT_VERSION;
+    rb->hdr.tileShift = TS_TILE_SHIFT;
+    rb->hdr.minRegion = TS_MIN_REGION;
+    rb->hdr.tilesAxis = TS_TILES_AXIS;
+    rb->hdr.dirOffset = RB_HEADER_SIZE;
+    rb->hdr.bitCount = 0;
+    memset(rb->hdr.reserved, 0, sizeof(rb->hdr.reserved));
+
+    // Header placeholder followed by an all-empty directory
+    int ok = fwrite(&rb->hdr, sizeof(RbHeader), 1, rb->fp) == 1;
+    char zeros[65536];
+    memset(zeros, 0, sizeof(zeros));
+    uint64_t left = rb_dir_bytes();
+    while (ok && left > 0)
+    {
+        size_t n = left < sizeof(zeros) ? (size_t)left : sizeof(zeros);
+        ok = fwrite(zeros, 1, n, rb->fp) == n;
+        left -= n;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Error: cannot initialise bitmap %s\n", path);
+        fclose(rb->fp);
+        free(rb);
+        return NULL;
+    }
+    rb->end = RB_HEADER_SIZE + rb_dir_bytes();
+
+#ifdef _WIN32
+    InitializeCriticalSection(&rb->lock);
+#else
+    pthread_mutex_init(&rb->lock, NULL);
+#endif
+    return rb;
+}
+
+int rb_put_tile(RegionBitmap *rb, int tx, int tz, const uint8_t *bits)
+{
+    if (tx < 0 || tz < 0 || tx >= TS_TILES_AXIS || tz >= TS_TILES_AXIS)
+        return -1;
+
+    const uint64_t *words = (const uint64_t *)bits;
+    uint32_t count = 0;
+    for (int i = 0; i < RB_TILE_BYTES / 8; i++)
+        count += (uint32_t)__builtin_popcountll(words[i]);
+    if (count == 0)
+        return 0;
+
+    // Sparse tiles are cheaper as a list of set bit indices
+    RbTileEntry e;
+    memset(&e, 0, sizeof(e));
+    e.count = count;
+    uint16_t list[RB_TILE_BYTES / 2];
+    const void *block = bits;
+    size_t bytes = RB_TILE_BYTES;
+    if (count * sizeof(uint16_t) < RB_TILE_BYTES)
+    {
+        uint32_t n = 0;
+        for (int w = 0; w < RB_TILE_BYTES / 8; w++)
+        {
+            uint64_t v = words[w];
+            while (v)
+            {
+                list[n++] = (uint16_t)(w * 64 + __builtin_ctzll(v));
+                v &= v - 1;
+            }
+        }
+        e.encoding = RB_ENC_LIST;
+        block = list;
+        bytes = n * sizeof(uint16_t);
+    }
+    else
+    {
+        e.encoding = RB_ENC_RAW;
+    }
+
+    uint64_t entryOff = rb->hdr.dirOffset +
+        ((uint64_t)tx * TS_TILES_AXIS + (uint64_t)tz) * sizeof(RbTileEntry);
+
+    int err = 0;
+#ifdef _WIN32
+    EnterCriticalSection(&rb->lock);
+#else
+    pthread_mutex_lock(&rb->lock);
+#endif
+    e.offset = rb->end;
+    if (rb_seek(rb->fp, rb->end) != 0 || fwrite(block, 1, bytes, rb->fp) != bytes ||
+        rb_seek(rb->fp, entryOff) != 0 || fwrite(&e, sizeof(e), 1, rb->fp) != 1)
+        err = -1;
+    else
+    {
+        // Keep blocks 8-byte aligned so raw tiles can be read as words
+        rb->end += (bytes + 7) & ~(size_t)7;
+        rb->hdr.bitCount += count;
+    }
+#ifdef _WIN32
+    LeaveCriticalSection(&rb->lock);
+#else
+    pthread_mutex_unlock(&rb->lock);
+#endif
+    return err;
+}
+
+int rb_close(RegionBitmap *rb)
+{
+    if (!rb)
+        return -1;
+    int err = 0;
+    if (rb_seek(rb->fp, 0) != 0 ||
+        fwrite(&rb->hdr, sizeof(RbHeader), 1, rb->fp) != 1)
+        err = -1;
+    if (fclose(rb->fp) != 0)
+        err = -1;
+#ifdef _WIN32
+    DeleteCriticalSection(&rb->lock);
+#else
+    pthread_mutex_destroy(&rb->lock);
+#endif
+    free(rb);
+    return err;
+}
+
+int rb_is_bitmap(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return 0;
+    uint32_t magic = 0;
+    int ok = fread(&magic, sizeof(magic), 1, fp) == 1 && magic == RB_MAGIC;
+    fclose(fp);
+    return ok;
+}
+
+static int rb_validate(RbReader *r, const char *path)
+{
+    const RbHeader *h = (const RbHeader *)r->base;
+    if (r->size < RB_HEADER_SIZE || h->magic != RB_MAGIC)
+    {
+        fprintf(stderr, "Error: %s is not a region bitmap\n", path);
+        return -1;
+    }
+    if (h->version != RB_FORMAT_VERSION || h->tileShift != TS_TILE_SHIFT ||
+        h->tilesAxis != TS_TILES_AXIS || h->minRegion != TS_MIN_REGION ||
+        h->regionBlocks <= 0 || h->dirOffset != RB_HEADER_SIZE)
+    {
+        fprintf(stderr, "Error: %s has an unsupported bitmap layout\n", path);
+        return -1;
+    }
+    if (RB_HEADER_SIZE + rb_dir_bytes() > r->size)
+    {
+        fprintf(stderr, "Error: %s is truncated\n", path);
+        return -1;
+    }
+    r->hdr = h;
+    r->dir = (const RbTileEntry *)(r->base + h->dirOffset);
+    return 0;
+}
+
+int rb_open_read(RbReader *r, const char *path)
+{
+    memset(r, 0, sizeof(*r));
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Error: cannot open bitmap %s (error %lu)\n", path, GetLastError());
+        return -1;
+    }
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(hFile, &sz) || sz.QuadPart == 0)
+    {
+        fprintf(stderr, "Error: cannot size bitmap %s\n", path);
+        CloseHandle(hFile);
+        return -1;
+    }
+    HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    void *data = hMapping ? MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!data)
+    {
+        fprintf(stderr, "Error: cannot map bitmap %s (error %lu)\n", path, GetLastError());
+        if (hMapping) CloseHandle(hMapping);
+        CloseHandle(hFile);
+        return -1;
+    }
+    r->hFile = hFile;
+    r->hMapping = hMapping;
+    r->base = (const char *)data;
+    r->size = (uint64_t)sz.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Failed to open bitmap");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        fprintf(stderr, "Error: cannot size bitmap %s\n", path);
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        perror("Failed to mmap bitmap");
+        close(fd);
+        return -1;
+    }
+    r->fd = fd;
+    r->base = (const char *)data;
+    r->size = (uint64_t)st.st_size;
+#endif
+    if (rb_validate(r, path) != 0)
+    {
+        rb_close_read(r);
+        return -1;
+    }
+    return 0;
+}
+
+void rb_close_read(RbReader *r)
+{
+    if (!r->base)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile((void *)r->base);
+    CloseHandle((HANDLE)r->hMapping);
+    CloseHandle((HANDLE)r->hFile);
+#else
+    munmap((void *)r->base, (size_t)r->size);
+    close(r->fd);
+#endif
+    memset(r, 0, sizeof(*r));
+}
+
+// Block of a tile entry, or NULL if it is empty or runs past the file
+static const char *rb_block(const RbReader *r, const RbTileEntry *e)
+{
+    if (e->offset == 0 || e->count == 0)
+        return NULL;
+    uint64_t bytes = e->encoding == RB_ENC_LIST ?
+        (uint64_t)e->count * sizeof(uint16_t) : RB_TILE_BYTES;
+    if (e->offset + bytes > r->size)
+        return NULL;
+    return r->base + e->offset;
+}
+
+int rb_test(const RbReader *r, int rx, int rz)
+{
+    int tx = ts_region_to_tile(rx), tz = ts_region_to_tile(rz);
+    if (tx < 0 || tz < 0)
+        return 0;
+    const RbTileEntry *e = &r->dir[(size_t)tx * TS_TILES_AXIS + tz];
+    const char *block = rb_block(r, e);
+    if (!block)
+        return 0;
+
+    int lx = rx - TS_MIN_REGION - (tx << TS_TILE_SHIFT);
+    int lz = rz - TS_MIN_REGION - (tz << TS_TILE_SHIFT);
+    uint16_t i = (uint16_t)(lx * TS_TILE_REGIONS + lz);
+    if (e->encoding == RB_ENC_RAW)
+        return ((const uint8_t *)block)[i >> 3] >> (i & 7) & 1;
+
+    const uint16_t *list = (const uint16_t *)block;
+    uint32_t lo = 0, hi = e->count;
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (list[mid] < i)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < e->count && list[lo] == i;
+}
+
+// Java LCG steps used by cubiomes for structure positions in a region
+static uint64_t region_rng(const RbHeader *h, int rx, int rz)
+{
+    uint64_t seed = (uint64_t)h->seed & ((1ULL << 48) - 1);
+    seed = seed + rx * 341873128712ULL + rz * 132897987541ULL + (uint64_t)(int64_t)h->salt;
+    return seed ^ 0x5deece66dULL;
+}
+
+static inline uint64_t rng_next(uint64_t seed)
+{
+    return (seed * 0x5deece66dULL + 0xb) & ((1ULL << 48) - 1);
+}
+
+int rb_builtin_pos(void *ctx, int rx, int rz, int32_t *x, int32_t *z)
+{
+    const RbHeader *h = (const RbHeader *)ctx;
+    uint64_t seed = region_rng(h, rx, rz);
+    uint64_t r = (uint64_t)h->chunkRange;
+    int cx, cz;
+
+    if (h->posKind == RB_POS_FEATURE)
+    {
+        seed = rng_next(seed);
+        if (r & (r - 1))
+        {
+            cx = (int)((int)(seed >> 17) % r);
+            seed = rng_next(seed);
+            cz = (int)((int)(seed >> 17) % r);
+        }
+        else
+        {
+            // Java's nextInt special-cases powers of two
+            cx = (int)((r * (seed >> 17)) >> 31);
+            seed = rng_next(seed);
+            cz = (int)((r * (seed >> 17)) >> 31);
+        }
+    }
+    else if (h->posKind == RB_POS_LARGE)
+    {
+        seed = rng_next(seed); cx = (int)((int)(seed >> 17) % r);
+        seed = rng_next(seed); cx += (int)((int)(seed >> 17) % r);
+        seed = rng_next(seed); cz = (int)((int)(seed >> 17) % r);
+        seed = rng_next(seed); cz += (int)((int)(seed >> 17) % r);
+        cx >>= 1;
+        cz >>= 1;
+    }
+    else
+    {
+        return 0;
+    }
+
+    *x = (int32_t)(((uint64_t)rx * h->regionSize + cx) << 4);
+    *z = (int32_t)(((uint64_t)rz * h->regionSize + cz) << 4);
+    return 1;
+}
+
+uint64_t rb_query(const RbReader *r, int32_t minX, int32_t minZ,
+    int32_t maxX, int32_t maxZ, RbPosFn pos, void *posCtx,
+    TsVisitFn fn, void *ctx)
+{
+    const RbHeader *h = r->hdr;
+    if (minX > maxX || minZ > maxZ)
+        return 0;
+
+    // A region's structure lies inside the region, so only regions
+    // overlapping the box can match
+    TsHeader th;
+    memset(&th, 0, sizeof(th));
+    th.regionBlocks = h->regionBlocks;
+    int rx0 = ts_block_to_region(&th, minX) - TS_MIN_REGION;
+    int rx1 = ts_block_to_region(&th, maxX) - TS_MIN_REGION;
+    int rz0 = ts_block_to_region(&th, minZ) - TS_MIN_REGION;
+    int rz1 = ts_block_to_region(&th, maxZ) - TS_MIN_REGION;
+    if (rx1 < 0 || rz1 < 0 || rx0 >= TS_REGIONS_AXIS || rz0 >= TS_REGIONS_AXIS)
+        return 0;
+    if (rx0 < 0) rx0 = 0;
+    if (rz0 < 0) rz0 = 0;
+    if (rx1 >= TS_REGIONS_AXIS) rx1 = TS_REGIONS_AXIS - 1;
+    if (rz1 >= TS_REGIONS_AXIS) rz1 = TS_REGIONS_AXIS - 1;
+
+    uint64_t hits = 0;
+    for (int tx = rx0 >> TS_TILE_SHIFT; tx <= (rx1 >> TS_TILE_SHIFT); tx++)
+    {
+        for (int tz = rz0 >> TS_TILE_SHIFT; tz <= (rz1 >> TS_TILE_SHIFT); tz++)
+        {
+            const RbTileEntry *e = &r->dir[(size_t)tx * TS_TILES_AXIS + tz];
+            const char *block = rb_block(r, e);
+            if (!block)
+                continue;
+
+            const uint64_t *words = (const uint64_t *)block;
+            const uint16_t *list = (const uint16_t *)block;
+            uint32_t n = e->encoding == RB_ENC_LIST ? e->count : RB_TILE_BYTES / 8;
+            for (uint32_t k = 0; k < n; k++)
+            {
+                // Walk set bits of a raw word, or one list entry
+                uint64_t v = e->encoding == RB_ENC_LIST ? 1 : words[k];
+                while (v)
+                {
+                    int i = e->encoding == RB_ENC_LIST ? list[k] : (int)(k * 64 + __builtin_ctzll(v));
+                    v &= v - 1;
+                    int lx = i >> TS_TILE_SHIFT, lz = i & (TS_TILE_REGIONS - 1);
+                    int gx = (tx << TS_TILE_SHIFT) + lx, gz = (tz << TS_TILE_SHIFT) + lz;
+                    if (gx < rx0 || gx > rx1 || gz < rz0 || gz > rz1)
+                        continue;
+                    int32_t x, z;
+                    if (!pos(posCtx, gx + TS_MIN_REGION, gz + TS_MIN_REGION, &x, &z))
+                        continue;
+                    if (x < minX || x > maxX || z < minZ || z > maxZ)
+                        continue;
+                    if (fn)
+                        fn(ctx, x, z);
+                    hits++;
+                }
+            }
+        }
+    }
+    return hits;
+}
@@ -0,0 +1,131 @@
+#ifndef REGIONBITMAP_H_
+#define REGIONBITMAP_H_
+
+// Region bitmap output.
+//
+// For a fixed seed and structure type the position inside a region is a
+// cheap function of (rx, rz); only whether the structure is viable there
+// is expensive. A region bitmap therefore stores a single bit per region
+// and regenerates coordinates when read. It uses the tile grid of the
+// tile store (tilestore.h):
+//
+//     RbHeader                       (fixed, RB_HEADER_SIZE bytes)
+//     RbTileEntry[tilesAxis^2]       (dense tile directory, row-major by tx)
+//     tile blocks                    (one per tile with at least one bit set)
+//
+// A tile block is either the raw bitmap of the tile (RB_TILE_BYTES, bit
+// lx * TS_TILE_REGIONS + lz) or, when that is smaller, the ascending list
+// of set bit indices as uint16_t. Tiles without any bit set take no space.
+
+#include "tilestore.h"
+
+#define RB_MAGIC            0x42524653u     // "SFRB"
+#define RB_FORMAT_VERSION   1
+#define RB_HEADER_SIZE      128
+#define RB_TILE_BITS        (TS_TILE_REGIONS * TS_TILE_REGIONS)
+#define RB_TILE_BYTES       (RB_TILE_BITS / 8)
+
+// How a reader without cubiomes can regenerate positions
+#define RB_POS_CUBIOMES     0   // only getStructurePos knows the position
+#define RB_POS_FEATURE      1   // getFeaturePos
+#define RB_POS_LARGE        2   // getLargeStructurePos
+
+// Tile block encodings
+#define RB_ENC_RAW          1
+#define RB_ENC_LIST         2
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    int64_t  seed;
+    int32_t  mc;
+    int32_t  type;
+    int32_t  regionBlocks;
+    int32_t  posKind;
+    int32_t  salt;          // structure configuration for RB_POS_* formulas
+    int32_t  regionSize;    // in chunks
+    int32_t  chunkRange;
+    int32_t  tileShift;
+    int32_t  minRegion;
+    int32_t  tilesAxis;
+    int32_t  areaX0, areaZ0;    // scanned region rect, half-open
+    int32_t  areaX1, areaZ1;
+    uint64_t dirOffset;
+    uint64_t bitCount;
+    char     label[32];
+    uint8_t  reserved[RB_HEADER_SIZE - 120];
+} RbHeader;
+
+typedef struct
+{
+    uint64_t offset;        // byte offset of the tile block, 0 = no bits set
+    uint32_t count;         // number of set bits
+    uint16_t encoding;
+    uint16_t flags;
+} RbTileEntry;
+
+// Writer ------------------------------------------------------------------
+
+typedef struct RegionBitmap RegionBitmap;
+
+// Creates a new bitmap at path. The identifying fields of hdr (seed, mc,
+// type, regionBlocks, posKind, structure configuration, area, label) are
+// used; layout fields are filled in here.
+RegionBitmap *rb_create(const char *path, const RbHeader *hdr);
+
+// Stores the RB_TILE_BYTES bitmap of tile (tx, tz). Each tile is written
+// once. Safe to call from several threads. Returns 0 on success.
+int rb_put_tile(RegionBitmap *rb, int tx, int tz, const uint8_t *bits);
+
+// Finalises the header and closes the file. Returns 0 on success.
+int rb_close(RegionBitmap *rb);
+
+static inline void rb_set(uint8_t *bits, int lx, int lz)
+{
+    int i = lx * TS_TILE_REGIONS + lz;
+    bits[i >> 3] |= (uint8_t)(1u << (i & 7));
+}
+
+// Reader ------------------------------------------------------------------
+
+typedef struct
+{
+    const RbHeader    *hdr;
+    const RbTileEntry *dir;
+    const char        *base;
+    uint64_t           size;
+#ifdef _WIN32
+    void              *hFile;
+    void              *hMapping;
+#else
+    int                fd;
+#endif
+} RbReader;
+
+// Position of the structure in region (rx, rz); returns 0 if there is none.
+// Tools linked against cubiomes can wrap getStructurePos; the others use
+// rb_builtin_pos with the reader's header as ctx.
+typedef int (*RbPosFn)(void *ctx, int rx, int rz, int32_t *x, int32_t *z);
+
+int rb_open_read(RbReader *r, const char *path);
+void rb_close_read(RbReader *r);
+
+// Returns 1 if the first bytes of the file at path carry the bitmap magic.
+int rb_is_bitmap(const char *path);
+
+// Bit of region (rx, rz); 0 outside the grid.
+int rb_test(const RbReader *r, int rx, int rz);
+
+// Regenerates positions from the header's posKind and structure
+// configuration, the same way cubiomes does. ctx is a const RbHeader *.
+int rb_builtin_pos(void *ctx, int rx, int rz, int32_t *x, int32_t *z);
+
+// Visits every set region whose position lies in minX <= x <= maxX and
+// minZ <= z <= maxZ, touching only the tiles that intersect the box. fn
+// may be NULL to just count. Returns the number of matching positions.
+uint64_t rb_query(const RbReader *r, int32_t minX, int32_t minZ,
+    int32_t maxX, int32_t maxZ, RbPosFn pos, void *posCtx,
+    TsVisitFn fn, void *ctx);
+
+#endif
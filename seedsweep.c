@@ -0,0 +1,808 @@
+// seedsweep - finds seeds with a group of structures near spawn
+//
+// structure_finder and groupfinder look at one world at a time. This tool
+// runs the other way round: it sweeps many seeds and keeps those where a
+// group, say 3 huts and a monument, lies within a radius of its centre
+// and that centre lies near spawn (0,0). Each seed goes through stages,
+// cheapest first:
+//
+//   1. positions: structure positions near spawn from the lower 48 bits
+//      alone, then the group geometry test. Arithmetic only, no biomes.
+//   2. biomes: the members of each candidate group are checked with
+//      isViableStructurePos. Biomes depend on all 64 bits, so this runs
+//      per world seed.
+//   3. upper bits: a range of structure seeds is expanded to world seeds
+//      by their upper 16 bits, each going through stage 2.
+//
+// Seeds come from a range of 48-bit structure seeds or from a file of
+// world seeds (which skip stage 3). Matches are written out as they are
+// found.
+
+#include "generator.h"
+#include "finders.h"
+#include "util.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SW_CACHE_LINE 64
+#define SW_CHUNK 4096           // structure seeds per work unit
+#define SW_MAX_TYPES 8
+#define SW_MAX_MEMBERS 8
+#define SW_MAX_POS 65536        // positions per type near spawn, as uint16_t indices
+
+typedef struct
+{
+    int type;
+    const char *label;
+    int count;          // members of this type in the group
+    int regionBlocks;
+    int dim;
+    int maxPos;         // regions within reach: at most one position each
+} GroupType;
+
+typedef struct
+{
+    int typeCount;
+    GroupType types[SW_MAX_TYPES];
+    int members;
+    int mc;
+    int64_t radius;
+    int64_t spawnDist;
+    int64_t reach;      // spawnDist + radius: no member lies further out
+} GroupSpec;
+
+typedef struct
+{
+    int x, z;
+} SwPos;
+
+// Positions near spawn for one structure seed, and the groups among them.
+// pos[t] holds types[t].maxPos entries, so every position fits; the group
+// list grows as needed.
+typedef struct
+{
+    int posCount[SW_MAX_TYPES];
+    SwPos *pos[SW_MAX_TYPES];
+    int groupCount, groupCap;
+    uint16_t (*group)[SW_MAX_MEMBERS];  // indices into pos, type order
+} Candidates;
+
+enum
+{
+    SW_SEEDS,           // structure seeds (or listed seeds) tested in stage 1
+    SW_STAGE1,          // ... that had a candidate group
+    SW_WORLD,           // world seeds tested in stage 2
+    SW_VIABLE,          // isViableStructurePos calls
+    SW_MATCHES,
+    SW_COUNT
+};
+
+static const char *swNames[SW_COUNT] = {
+    "structure seeds", "position survivors", "world seeds tested", "biome checks", "matches"
+};
+
+typedef struct
+{
+    _Atomic uint64_t v[SW_COUNT];
+} __attribute__((aligned(SW_CACHE_LINE))) SweepSlot;
+
+static struct
+{
+    GroupSpec spec;
+    uint64_t start, end;        // range mode: structure seeds [start, end)
+    int64_t *list;              // list mode: world seeds
+    uint64_t listCount;
+    int upperTries;             // upper 16-bit values tried per structure seed
+    int perSeedLimit;           // matches kept per structure seed, 0 = all
+    _Atomic uint64_t next;      // next work unit
+    uint64_t units;
+    SweepSlot *slots;
+    int threads;
+    atomic_int done;
+    struct timespec startTime;
+    FILE *out;
+    pthread_mutex_t outLock;
+} g_sweep;
+
+static double elapsed_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int get_structure_dim(int type)
+{
+    switch (type)
+    {
+        case Fortress:
+        case Bastion:
+        case Ruined_Portal_N:
+            return DIM_NETHER;
+        case End_City:
+            return DIM_END;
+        default:
+            return DIM_OVERWORLD;
+    }
+}
+
+static int floor_div(int64_t a, int64_t b)
+{
+    return (int)(a >= 0 ? a / b : -((-a + b - 1) / b));
+}
+
+// Only this thread writes its slot, so a relaxed load and store is enough
+static void slot_add(SweepSlot *s, int k, uint64_t n)
+{
+    uint64_t v = atomic_load_explicit(&s->v[k], memory_order_relaxed);
+    atomic_store_explicit(&s->v[k], v + n, memory_order_relaxed);
+}
+
+static void sweep_totals(uint64_t *v)
+{
+    memset(v, 0, SW_COUNT * sizeof(uint64_t));
+    for (int t = 0; t < g_sweep.threads; t++)
+    {
+        for (int k = 0; k < SW_COUNT; k++)
+            v[k] += atomic_load_explicit(&g_sweep.slots[t].v[k], memory_order_relaxed);
+    }
+}
+
+// Stage 1 --------------------------------------------------------------------
+
+// Regions of one type that reach spans, from -reach to reach blocks
+static void reach_regions(const GroupSpec *spec, const GroupType *gt, int *r0, int *r1)
+{
+    *r0 = floor_div(-spec->reach, gt->regionBlocks);
+    *r1 = floor_div(spec->reach, gt->regionBlocks);
+}
+
+// Positions of one type whose distance from 0,0 is at most reach; out
+// holds gt->maxPos entries
+static int collect_positions(const GroupSpec *spec, const GroupType *gt, uint64_t s48, SwPos *out)
+{
+    int r0, r1;
+    reach_regions(spec, gt, &r0, &r1);
+    int64_t reachSq = spec->reach * spec->reach;
+    int n = 0;
+    for (int rx = r0; rx <= r1; rx++)
+    {
+        for (int rz = r0; rz <= r1; rz++)
+        {
+            Pos p;
+            if (!getStructurePos(gt->type, spec->mc, s48, rx, rz, &p))
+                continue;
+            if ((int64_t)p.x * p.x + (int64_t)p.z * p.z > reachSq)
+                continue;
+            out[n++] = (SwPos){ p.x, p.z };
+        }
+    }
+    return n;
+}
+
+// Same test as groupfinder: every member within radius of the centroid,
+// and here also the centroid within spawnDist of 0,0
+static int group_fits(const GroupSpec *spec, const SwPos *m, int n)
+{
+    double cx = 0, cz = 0;
+    for (int i = 0; i < n; i++)
+    {
+        cx += m[i].x;
+        cz += m[i].z;
+    }
+    cx /= n;
+    cz /= n;
+    if (cx * cx + cz * cz > (double)spec->spawnDist * spec->spawnDist)
+        return 0;
+    for (int i = 0; i < n; i++)
+    {
+        double dx = m[i].x - cx, dz = m[i].z - cz;
+        if (dx * dx + dz * dz > (double)spec->radius * spec->radius)
+            return 0;
+    }
+    return 1;
+}
+
+typedef struct
+{
+    const GroupSpec *spec;
+    Candidates *c;
+    SwPos members[SW_MAX_MEMBERS];
+    uint16_t index[SW_MAX_MEMBERS];
+    int64_t pairSq;     // (2 * radius)^2: no two members can be further apart
+} GroupSearch;
+
+// Picks the members one by one, type by type; positions of the same type
+// in increasing order so each set is seen once. A new member must be
+// within 2 * radius of every member so far, which prunes almost every seed
+// before the centroid test.
+static void find_groups(GroupSearch *gs, int depth, int t, int from)
+{
+    const GroupSpec *spec = gs->spec;
+    Candidates *c = gs->c;
+    if (depth == spec->members)
+    {
+        if (!group_fits(spec, gs->members, depth))
+            return;
+        if (c->groupCount == c->groupCap)
+        {
+            int cap = c->groupCap ? c->groupCap * 2 : 64;
+            void *p = realloc(c->group, (size_t)cap * sizeof(c->group[0]));
+            if (!p)
+            {
+                fprintf(stderr, "\nOut of memory collecting candidate groups\n");
+                exit(1);
+            }
+            c->group = p;
+            c->groupCap = cap;
+        }
+        memcpy(c->group[c->groupCount++], gs->index, sizeof(gs->index));
+        return;
+    }
+    int base = 0;       // members of the types before t
+    for (int k = 0; k < t; k++)
+        base += spec->types[k].count;
+    if (depth - base == spec->types[t].count)
+    {
+        find_groups(gs, depth, t + 1, 0);
+        return;
+    }
+    for (int i = from; i < c->posCount[t]; i++)
+    {
+        SwPos p = c->pos[t][i];
+        int ok = 1;
+        for (int j = 0; j < depth && ok; j++)
+        {
+            int64_t dx = p.x - gs->members[j].x, dz = p.z - gs->members[j].z;
+            ok = dx * dx + dz * dz <= gs->pairSq;
+        }
+        if (!ok)
+            continue;
+        gs->members[depth] = p;
+        gs->index[depth] = (uint16_t)i;
+        find_groups(gs, depth + 1, t, i + 1);
+    }
+}
+
+// Returns the number of candidate groups for this structure seed
+static int position_stage(const GroupSpec *spec, uint64_t s48, Candidates *c)
+{
+    c->groupCount = 0;
+    // Types are ordered by count, so the most demanding one fails first
+    for (int t = 0; t < spec->typeCount; t++)
+    {
+        c->posCount[t] = collect_positions(spec, &spec->types[t], s48, c->pos[t]);
+        if (c->posCount[t] < spec->types[t].count)
+            return 0;
+    }
+    GroupSearch gs;
+    memset(&gs, 0, sizeof(gs));
+    gs.spec = spec;
+    gs.c = c;
+    gs.pairSq = 4 * spec->radius * spec->radius;
+    find_groups(&gs, 0, 0, 0);
+    return c->groupCount;
+}
+
+// Stage 2 --------------------------------------------------------------------
+
+typedef struct
+{
+    Generator g;
+    int dim;                            // dimension the generator is seeded for, -1 for none
+    int8_t *viable[SW_MAX_TYPES];       // per position, -1 unknown, per world seed
+} BiomeCheck;
+
+// Returns the index of the first candidate group whose members can all
+// spawn in this world seed, or -1
+static int biome_stage(const GroupSpec *spec, const Candidates *c, uint64_t seed,
+    BiomeCheck *bc, uint64_t *checks)
+{
+    bc->dim = -1;
+    for (int t = 0; t < spec->typeCount; t++)
+        memset(bc->viable[t], -1, (size_t)c->posCount[t]);
+    for (int gi = 0; gi < c->groupCount; gi++)
+    {
+        int ok = 1;
+        int m = 0;
+        for (int t = 0; t < spec->typeCount && ok; t++)
+        {
+            const GroupType *gt = &spec->types[t];
+            for (int k = 0; k < gt->count && ok; k++, m++)
+            {
+                int i = c->group[gi][m];
+                if (bc->viable[t][i] < 0)
+                {
+                    if (bc->dim != gt->dim)
+                    {
+                        applySeed(&bc->g, gt->dim, seed);
+                        bc->dim = gt->dim;
+                    }
+                    const SwPos p = c->pos[t][i];
+                    bc->viable[t][i] = isViableStructurePos(gt->type, &bc->g, p.x, p.z, 0) ? 1 : 0;
+                    (*checks)++;
+                }
+                ok = bc->viable[t][i];
+            }
+        }
+        if (ok)
+            return gi;
+    }
+    return -1;
+}
+
+static void report_match(const GroupSpec *spec, const Candidates *c, int gi, uint64_t seed)
+{
+    char line[1024];
+    int len = snprintf(line, sizeof(line), "%" PRId64, (int64_t)seed);
+    double cx = 0, cz = 0;
+    int m = 0;
+    for (int t = 0; t < spec->typeCount; t++)
+    {
+        for (int k = 0; k < spec->types[t].count; k++, m++)
+        {
+            SwPos p = c->pos[t][c->group[gi][m]];
+            len += snprintf(line + len, sizeof(line) - len, " %s(%d,%d)",
+                spec->types[t].label, p.x, p.z);
+            cx += p.x;
+            cz += p.z;
+        }
+    }
+    cx /= spec->members;
+    cz /= spec->members;
+    snprintf(line + len, sizeof(line) - len, " center(%.0f,%.0f)\n", cx, cz);
+
+    pthread_mutex_lock(&g_sweep.outLock);
+    fputs(line, g_sweep.out);
+    fflush(g_sweep.out);
+    pthread_mutex_unlock(&g_sweep.outLock);
+}
+
+// Workers --------------------------------------------------------------------
+
+static void sweep_structure_seed(int thread, uint64_t s48, Candidates *c, BiomeCheck *bc)
+{
+    const GroupSpec *spec = &g_sweep.spec;
+    SweepSlot *slot = &g_sweep.slots[thread];
+    if (!position_stage(spec, s48, c))
+        return;
+    slot_add(slot, SW_STAGE1, 1);
+
+    uint64_t world = 0, checks = 0, matches = 0;
+    for (int upper = 0; upper < g_sweep.upperTries; upper++)
+    {
+        uint64_t seed = ((uint64_t)upper << 48) | s48;
+        world++;
+        int gi = biome_stage(spec, c, seed, bc, &checks);
+        if (gi < 0)
+            continue;
+        report_match(spec, c, gi, seed);
+        if (++matches == (uint64_t)g_sweep.perSeedLimit)
+            break;
+    }
+    slot_add(slot, SW_WORLD, world);
+    slot_add(slot, SW_VIABLE, checks);
+    slot_add(slot, SW_MATCHES, matches);
+}
+
+static void sweep_listed_seed(int thread, uint64_t seed, Candidates *c, BiomeCheck *bc)
+{
+    const GroupSpec *spec = &g_sweep.spec;
+    SweepSlot *slot = &g_sweep.slots[thread];
+    if (!position_stage(spec, seed & MASK48, c))
+        return;
+    slot_add(slot, SW_STAGE1, 1);
+    uint64_t checks = 0;
+    int gi = biome_stage(spec, c, seed, bc, &checks);
+    slot_add(slot, SW_WORLD, 1);
+    slot_add(slot, SW_VIABLE, checks);
+    if (gi >= 0)
+    {
+        report_match(spec, c, gi, seed);
+        slot_add(slot, SW_MATCHES, 1);
+    }
+}
+
+static void free_buffers(Candidates *c, BiomeCheck *bc)
+{
+    if (c)
+    {
+        free(c->pos[0]);
+        free(c->group);
+    }
+    if (bc)
+        free(bc->viable[0]);
+    free(c);
+    free(bc);
+}
+
+// Position and verdict buffers sized for the spec, one block per kind
+static int alloc_buffers(const GroupSpec *spec, Candidates **cp, BiomeCheck **bcp)
+{
+    size_t total = 0;
+    for (int t = 0; t < spec->typeCount; t++)
+        total += (size_t)spec->types[t].maxPos;
+    Candidates *c = calloc(1, sizeof(Candidates));
+    BiomeCheck *bc = calloc(1, sizeof(BiomeCheck));
+    if (c)
+        c->pos[0] = malloc(total * sizeof(SwPos));
+    if (bc)
+        bc->viable[0] = malloc(total);
+    if (!c || !bc || !c->pos[0] || !bc->viable[0])
+    {
+        free_buffers(c, bc);
+        return 0;
+    }
+    for (int t = 1; t < spec->typeCount; t++)
+    {
+        c->pos[t] = c->pos[t - 1] + spec->types[t - 1].maxPos;
+        bc->viable[t] = bc->viable[t - 1] + spec->types[t - 1].maxPos;
+    }
+    *cp = c;
+    *bcp = bc;
+    return 1;
+}
+
+static void *sweepThread(void *arg)
+{
+    int thread = (int)(intptr_t)arg;
+    Candidates *c;
+    BiomeCheck *bc;
+    if (!alloc_buffers(&g_sweep.spec, &c, &bc))
+    {
+        fprintf(stderr, "\nThread %d: out of memory\n", thread);
+        return NULL;
+    }
+    setupGenerator(&bc->g, g_sweep.spec.mc, 0);
+    SweepSlot *slot = &g_sweep.slots[thread];
+
+    for (;;)
+    {
+        uint64_t u = atomic_fetch_add_explicit(&g_sweep.next, 1, memory_order_relaxed);
+        if (u >= g_sweep.units)
+            break;
+        uint64_t n = 0;
+        if (g_sweep.list)
+        {
+            uint64_t i0 = u * SW_CHUNK, i1 = i0 + SW_CHUNK;
+            if (i1 > g_sweep.listCount)
+                i1 = g_sweep.listCount;
+            for (uint64_t i = i0; i < i1; i++, n++)
+                sweep_listed_seed(thread, (uint64_t)g_sweep.list[i], c, bc);
+        }
+        else
+        {
+            uint64_t s0 = g_sweep.start + u * SW_CHUNK, s1 = s0 + SW_CHUNK;
+            if (s1 > g_sweep.end)
+                s1 = g_sweep.end;
+            for (uint64_t s = s0; s < s1; s++, n++)
+                sweep_structure_seed(thread, s, c, bc);
+        }
+        slot_add(slot, SW_SEEDS, n);
+    }
+    free_buffers(c, bc);
+    return NULL;
+}
+
+static void *progressThread(void *arg)
+{
+    (void)arg;
+    uint64_t total = g_sweep.list ? g_sweep.listCount : g_sweep.end - g_sweep.start;
+    for (;;)
+    {
+        int finished = atomic_load_explicit(&g_sweep.done, memory_order_acquire);
+        uint64_t v[SW_COUNT];
+        sweep_totals(v);
+        double elapsed = elapsed_since(&g_sweep.startTime);
+        double rate = elapsed > 0 ? v[SW_SEEDS] / elapsed : 0.0;
+        double eta = rate > 0 ? (total - v[SW_SEEDS]) / rate : 0.0;
+        fprintf(stderr, "\rETA: %02dh%02dm%02ds | Seeds/s: %.0f | Progress: %6.2f%% | survivors: %llu, matches: %llu   ",
+            (int)(eta / 3600), (int)(eta / 60) % 60, (int)eta % 60, rate,
+            total ? 100.0 * v[SW_SEEDS] / total : 100.0,
+            (unsigned long long)v[SW_STAGE1], (unsigned long long)v[SW_MATCHES]);
+        if (finished)
+            break;
+        usleep(500000);
+    }
+    fprintf(stderr, "\n");
+    return NULL;
+}
+
+// Setup ----------------------------------------------------------------------
+
+static int read_line(char *buf, int n)
+{
+    if (!fgets(buf, n, stdin))
+        return 0;
+    buf[strcspn(buf, "\r\n")] = '\0';
+    return 1;
+}
+
+// Reads world seeds, one per line, numeric or string; blank lines and
+// lines starting with '#' are skipped
+static int64_t *read_seed_list(const char *path, uint64_t *count)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        fprintf(stderr, "Error: cannot open seed file %s\n", path);
+        return NULL;
+    }
+    uint64_t cap = 1024, n = 0;
+    int64_t *seeds = malloc(cap * sizeof(int64_t));
+    char line[256];
+    while (seeds && fgets(line, sizeof(line), f))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+        if (n == cap)
+        {
+            cap *= 2;
+            int64_t *p = realloc(seeds, cap * sizeof(int64_t));
+            if (!p)
+            {
+                free(seeds);
+                seeds = NULL;
+                break;
+            }
+            seeds = p;
+        }
+        char *end;
+        int64_t v = strtoll(line, &end, 10);
+        if (*end != '\0')
+        {
+            // Not a number: Java's String.hashCode(), as the game does
+            int32_t hash = 0;
+            for (const char *p = line; *p; p++)
+                hash = (int32_t)((uint32_t)hash * 31u + (unsigned char)*p);
+            v = hash;
+        }
+        seeds[n++] = v;
+    }
+    fclose(f);
+    if (!seeds)
+        fprintf(stderr, "Error: out of memory reading %s\n", path);
+    *count = n;
+    return seeds;
+}
+
+static int compare_count_desc(const void *a, const void *b)
+{
+    return ((const GroupType *)b)->count - ((const GroupType *)a)->count;
+}
+
+int main()
+{
+    char buf[256];
+
+    int numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    printf("Enter the number of threads (blank = %d): ", numThreads);
+    if (read_line(buf, sizeof(buf)) && atoi(buf) > 0)
+        numThreads = atoi(buf);
+
+    int versionsList[] = {
+        MC_1_7, MC_1_8, MC_1_9, MC_1_10, MC_1_11, MC_1_12, MC_1_13, MC_1_14, MC_1_15,
+        MC_1_16_1, MC_1_16, MC_1_17, MC_1_18, MC_1_19_2, MC_1_19, MC_1_20,
+        MC_1_21_1, MC_1_21_3, MC_1_21_WD
+    };
+    const int versionsCount = (int)(sizeof(versionsList) / sizeof(versionsList[0]));
+    printf("Select Minecraft version (enter one index):\n");
+    for (int i = 0; i < versionsCount; i++)
+        printf("  %d) %s\n", i + 1, mc2str(versionsList[i]));
+    printf("Your choice (default latest): ");
+    GroupSpec *spec = &g_sweep.spec;
+    spec->mc = MC_NEWEST;
+    if (read_line(buf, sizeof(buf)))
+    {
+        int idx = atoi(buf);
+        if (idx >= 1 && idx <= versionsCount)
+            spec->mc = versionsList[idx - 1];
+    }
+
+    struct { int type; const char *label; } supported[] = {
+        { Desert_Pyramid,    "desert_pyramid" },
+        { Jungle_Temple,     "jungle_temple" },
+        { Swamp_Hut,         "hut" },
+        { Igloo,             "igloo" },
+        { Village,           "village" },
+        { Ocean_Ruin,        "ocean_ruin" },
+        { Shipwreck,         "shipwreck" },
+        { Monument,          "monument" },
+        { Mansion,           "mansion" },
+        { Outpost,           "outpost" },
+        { Ruined_Portal,     "ruined_portal" },
+        { Ruined_Portal_N,   "ruined_portal_n" },
+        { Ancient_City,      "ancient_city" },
+        { Treasure,          "treasure" },
+        { Fortress,          "fortress" },
+        { Bastion,           "bastion" },
+        { End_City,          "end_city" },
+        { Trail_Ruins,       "trail_ruins" },
+        { Trial_Chambers,    "trial_chambers" },
+    };
+    const int supportedCount = (int)(sizeof(supported) / sizeof(supported[0]));
+    printf("Structures in the group:\n");
+    for (int i = 0; i < supportedCount; i++)
+        printf("  %d) %s\n", i + 1, supported[i].label);
+    printf("Your choice as index:count (default 3:3 8:1 = 3 huts and a monument): ");
+    if (!read_line(buf, sizeof(buf)) || buf[0] == '\0')
+        snprintf(buf, sizeof(buf), "3:3 8:1");
+    char *ctx = NULL;
+    for (char *tok = strtok_r(buf, " \t", &ctx); tok; tok = strtok_r(NULL, " \t", &ctx))
+    {
+        int idx = atoi(tok), count = 1;
+        char *colon = strchr(tok, ':');
+        if (colon)
+            count = atoi(colon + 1);
+        if (idx < 1 || idx > supportedCount || count < 1)
+        {
+            fprintf(stderr, "Ignoring '%s'\n", tok);
+            continue;
+        }
+        GroupType *gt = NULL;
+        for (int t = 0; t < spec->typeCount; t++)
+        {
+            if (spec->types[t].type == supported[idx - 1].type)
+                gt = &spec->types[t];
+        }
+        if (!gt && spec->typeCount < SW_MAX_TYPES)
+        {
+            gt = &spec->types[spec->typeCount++];
+            gt->type = supported[idx - 1].type;
+            gt->label = supported[idx - 1].label;
+            gt->count = 0;
+        }
+        if (gt)
+            gt->count += count;
+    }
+    for (int t = 0; t < spec->typeCount; t++)
+    {
+        GroupType *gt = &spec->types[t];
+        StructureConfig sconf;
+        if (!getStructureConfig(gt->type, spec->mc, &sconf))
+        {
+            fprintf(stderr, "Error: %s does not generate in %s\n", gt->label, mc2str(spec->mc));
+            return 1;
+        }
+        gt->regionBlocks = sconf.regionSize * 16;
+        gt->dim = get_structure_dim(gt->type);
+        spec->members += gt->count;
+    }
+    if (spec->members < 2 || spec->members > SW_MAX_MEMBERS)
+    {
+        fprintf(stderr, "Error: a group needs 2 to %d structures\n", SW_MAX_MEMBERS);
+        return 1;
+    }
+    for (int t = 1; t < spec->typeCount; t++)
+    {
+        if (spec->types[t].dim != spec->types[0].dim)
+        {
+            fprintf(stderr, "Error: all structures of a group must be in the same dimension\n");
+            return 1;
+        }
+    }
+    qsort(spec->types, spec->typeCount, sizeof(GroupType), compare_count_desc);
+
+    printf("Group radius (max distance from the group center in blocks, default 128): ");
+    spec->radius = 128;
+    if (read_line(buf, sizeof(buf)) && atoll(buf) > 0)
+        spec->radius = atoll(buf);
+    printf("Max distance of the group center from spawn (0,0) in blocks (default 2000): ");
+    spec->spawnDist = 2000;
+    if (read_line(buf, sizeof(buf)) && atoll(buf) >= 0 && buf[0] != '\0')
+        spec->spawnDist = atoll(buf);
+    spec->reach = spec->spawnDist + spec->radius;
+    for (int t = 0; t < spec->typeCount; t++)
+    {
+        GroupType *gt = &spec->types[t];
+        int64_t regions = INT64_MAX;
+        if (spec->reach / gt->regionBlocks < SW_MAX_POS)
+        {
+            int r0, r1;
+            reach_regions(spec, gt, &r0, &r1);
+            regions = (int64_t)(r1 - r0 + 1) * (r1 - r0 + 1);
+        }
+        if (regions > SW_MAX_POS)
+        {
+            fprintf(stderr, "Error: spawn distance plus radius spans more than %d %s regions; "
+                "lower them\n", SW_MAX_POS, gt->label);
+            return 1;
+        }
+        gt->maxPos = (int)regions;
+    }
+
+    printf("Seeds: structure seed range 'start end' (48-bit, end exclusive), or @file of world seeds: ");
+    if (!read_line(buf, sizeof(buf)) || buf[0] == '\0')
+    {
+        fprintf(stderr, "Error: no seeds given\n");
+        return 1;
+    }
+    if (buf[0] == '@')
+    {
+        g_sweep.list = read_seed_list(buf + 1, &g_sweep.listCount);
+        if (!g_sweep.list)
+            return 1;
+        g_sweep.units = (g_sweep.listCount + SW_CHUNK - 1) / SW_CHUNK;
+    }
+    else
+    {
+        unsigned long long a = 0, b = 0;
+        int n = sscanf(buf, "%llu %llu", &a, &b);
+        if (n < 1 || (n == 2 && b <= a) || a > MASK48 || b > MASK48 + 1)
+        {
+            fprintf(stderr, "Error: expected 'start end' with start < end <= 2^48\n");
+            return 1;
+        }
+        g_sweep.start = a;
+        g_sweep.end = n == 2 ? b : a + 1;
+        g_sweep.units = (g_sweep.end - g_sweep.start + SW_CHUNK - 1) / SW_CHUNK;
+
+        printf("Upper 16-bit values to try per structure seed (blank = all 65536): ");
+        g_sweep.upperTries = 65536;
+        if (read_line(buf, sizeof(buf)) && atoi(buf) > 0 && atoi(buf) < 65536)
+            g_sweep.upperTries = atoi(buf);
+        printf("World seeds to report per structure seed (blank = 1, 0 = all): ");
+        g_sweep.perSeedLimit = 1;
+        if (read_line(buf, sizeof(buf)) && buf[0] != '\0' && atoi(buf) >= 0)
+            g_sweep.perSeedLimit = atoi(buf);
+    }
+
+    char outPath[256] = "sweep_matches.txt";
+    printf("Output file (blank = %s): ", outPath);
+    if (read_line(buf, sizeof(buf)) && buf[0] != '\0')
+        snprintf(outPath, sizeof(outPath), "%s", buf);
+    g_sweep.out = fopen(outPath, "w");
+    if (!g_sweep.out)
+    {
+        fprintf(stderr, "Error: cannot create %s\n", outPath);
+        return 1;
+    }
+    fprintf(g_sweep.out, "# %s, group", mc2str(spec->mc));
+    for (int t = 0; t < spec->typeCount; t++)
+        fprintf(g_sweep.out, " %dx%s", spec->types[t].count, spec->types[t].label);
+    fprintf(g_sweep.out, " within %" PRId64 " of the center, center within %" PRId64 " of 0,0\n",
+        spec->radius, spec->spawnDist);
+    pthread_mutex_init(&g_sweep.outLock, NULL);
+
+    g_sweep.threads = numThreads;
+    g_sweep.slots = aligned_alloc(SW_CACHE_LINE, (size_t)numThreads * sizeof(SweepSlot));
+    if (!g_sweep.slots)
+    {
+        fprintf(stderr, "Failed to allocate counters\n");
+        return 1;
+    }
+    memset(g_sweep.slots, 0, (size_t)numThreads * sizeof(SweepSlot));
+
+    clock_gettime(CLOCK_MONOTONIC, &g_sweep.startTime);
+    pthread_t progThread;
+    pthread_create(&progThread, NULL, progressThread, NULL);
+    pthread_t threads[numThreads];
+    for (int i = 0; i < numThreads; i++)
+        pthread_create(&threads[i], NULL, sweepThread, (void *)(intptr_t)i);
+    for (int i = 0; i < numThreads; i++)
+        pthread_join(threads[i], NULL);
+    double secs = elapsed_since(&g_sweep.startTime);
+    atomic_store_explicit(&g_sweep.done, 1, memory_order_release);
+    pthread_join(progThread, NULL);
+    fclose(g_sweep.out);
+
+    uint64_t v[SW_COUNT];
+    sweep_totals(v);
+    printf("Finished in %.1fs (%.0f seeds/s)\n", secs, secs > 0 ? v[SW_SEEDS] / secs : 0.0);
+    for (int k = 0; k < SW_COUNT; k++)
+        printf("  %-20s %llu\n", swNames[k], (unsigned long long)v[k]);
+    printf("Matches written to %s\n", outPath);
+
+    free(g_sweep.slots);
+    free(g_sweep.list);
+    return 0;
+}
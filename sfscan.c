@@ -0,0 +1,571 @@
+#include "sfscan.h"
+
+#include "generator.h"
+#include "finders.h"
+#include "tilestore.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Size that keeps per-thread counters on separate cache lines
+#define SFS_CACHE_LINE 64
+
+typedef struct
+{
+    _Atomic uint64_t regions;
+    _Atomic uint64_t hits[SF_SCAN_MAX_TYPES];
+} __attribute__((aligned(SFS_CACHE_LINE))) SfSlot;
+
+typedef struct
+{
+    SfScan *scan;
+    int index;
+    pthread_t thread;
+} SfWorker;
+
+struct SfScan
+{
+    SfScanConfig cfg;
+    int64_t *seeds;
+    int regionBlocks[SF_SCAN_MAX_TYPES];
+    int dims[SF_SCAN_MAX_TYPES];
+    int order[SF_SCAN_MAX_TYPES];   // type indices grouped by dimension
+    SfRect area[SF_SCAN_MAX_TYPES];
+    int *tiles;                 // tiles touching any type's area
+    int tileCount;
+    uint64_t *unitList;         // with onPlan: planned units as seed << 32 | tile
+    uint64_t regionsTotal;
+    uint64_t units;
+    _Atomic uint64_t nextUnit;
+    atomic_int lastTile;
+    atomic_int *unitsLeft;      // per seed
+    atomic_int *started;        // per seed
+    struct timespec *seedStart; // per seed, set by the first unit
+    atomic_int seedsDone;
+    atomic_int running;         // threads still working
+    atomic_int cancelled;
+    atomic_int failed;          // a worker ran out of memory
+    SfSlot *slots;
+    SfWorker *workers;
+    int threads;
+    struct timespec start;
+};
+
+int sf_rect_empty(SfRect r)
+{
+    return r.x0 >= r.x1 || r.z0 >= r.z1;
+}
+
+int sf_rect_has(SfRect r, int rx, int rz)
+{
+    return rx >= r.x0 && rx < r.x1 && rz >= r.z0 && rz < r.z1;
+}
+
+SfRect sf_rect_intersect(SfRect a, SfRect b)
+{
+    SfRect r;
+    r.x0 = a.x0 > b.x0 ? a.x0 : b.x0;
+    r.z0 = a.z0 > b.z0 ? a.z0 : b.z0;
+    r.x1 = a.x1 < b.x1 ? a.x1 : b.x1;
+    r.z1 = a.z1 < b.z1 ? a.z1 : b.z1;
+    return r;
+}
+
+SfRect sf_rect_bbox(SfRect a, SfRect b)
+{
+    if (sf_rect_empty(a)) return b;
+    if (sf_rect_empty(b)) return a;
+    SfRect r;
+    r.x0 = a.x0 < b.x0 ? a.x0 : b.x0;
+    r.z0 = a.z0 < b.z0 ? a.z0 : b.z0;
+    r.x1 = a.x1 > b.x1 ? a.x1 : b.x1;
+    r.z1 = a.z1 > b.z1 ? a.z1 : b.z1;
+    return r;
+}
+
+int sf_rect_contains(SfRect outer, SfRect inner)
+{
+    return !sf_rect_empty(outer) && inner.x0 >= outer.x0 && inner.x1 <= outer.x1 &&
+        inner.z0 >= outer.z0 && inner.z1 <= outer.z1;
+}
+
+SfRect sf_tile_rect(int tile)
+{
+    SfRect r;
+    r.x0 = TS_MIN_REGION + (tile / TS_TILES_AXIS) * TS_TILE_REGIONS;
+    r.z0 = TS_MIN_REGION + (tile % TS_TILES_AXIS) * TS_TILE_REGIONS;
+    r.x1 = r.x0 + TS_TILE_REGIONS;
+    r.z1 = r.z0 + TS_TILE_REGIONS;
+    if (r.x1 > TS_MIN_REGION + TS_REGIONS_AXIS) r.x1 = TS_MIN_REGION + TS_REGIONS_AXIS;
+    if (r.z1 > TS_MIN_REGION + TS_REGIONS_AXIS) r.z1 = TS_MIN_REGION + TS_REGIONS_AXIS;
+    return r;
+}
+
+SfRect sf_scan_area(int64_t radius, int regionBlocks)
+{
+    SfRect world = { TS_MIN_REGION, TS_MIN_REGION,
+        TS_MIN_REGION + TS_REGIONS_AXIS, TS_MIN_REGION + TS_REGIONS_AXIS };
+    if (radius <= 0)
+        return world;
+    int r0 = (int)((-radius - regionBlocks + 1) / regionBlocks);
+    int r1 = (int)(radius / regionBlocks) + 1;
+    SfRect sq = { r0, r0, r1, r1 };
+    return sf_rect_intersect(world, sq);
+}
+
+int sf_structure_dim(int type)
+{
+    switch (type)
+    {
+        case Fortress:
+        case Bastion:
+        case Ruined_Portal_N:
+            return DIM_NETHER;
+        case End_City:
+            return DIM_END;
+        default:
+            return DIM_OVERWORLD;
+    }
+}
+
+uint64_t sf_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Adds the time since *mark to *acc and moves the mark to now
+static inline void lap(uint64_t *acc, uint64_t *mark)
+{
+    uint64_t now = sf_ticks();
+    *acc += now - *mark;
+    *mark = now;
+}
+
+// Fills in what the unit scans: each type's area within the tile, narrowed
+// by onPlan. Returns 0 if the unit is dropped, else sets *all to the
+// bounding box of the scan rects.
+static int plan_unit(const SfScan *s, SfUnit *u, SfRect *all)
+{
+    SfRect t = sf_tile_rect(u->tile);
+    SfRect none = { 0, 0, 0, 0 };
+    for (int i = 0; i < s->cfg.typeCount; i++)
+    {
+        u->scan[i] = sf_rect_intersect(t, s->area[i]);
+        u->skip[i] = none;
+    }
+    if (s->cfg.onPlan && !s->cfg.onPlan(s->cfg.user, u))
+        return 0;
+    *all = none;
+    for (int i = 0; i < s->cfg.typeCount; i++)
+        *all = sf_rect_bbox(*all, u->scan[i]);
+    return 1;
+}
+
+static uint64_t rect_area(SfRect r)
+{
+    return sf_rect_empty(r) ? 0 : (uint64_t)(r.x1 - r.x0) * (uint64_t)(r.z1 - r.z0);
+}
+
+// Only this thread writes its slot, so a relaxed load and store is enough
+static void slot_add(_Atomic uint64_t *c, uint64_t v)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+// Moves a worker's counts to its slot and the onCounters hook
+static void publish(SfScan *s, int thread, SfCounters *c)
+{
+    SfSlot *slot = &s->slots[thread];
+    slot_add(&slot->regions, c->regions);
+    for (int i = 0; i < s->cfg.typeCount; i++)
+        slot_add(&slot->hits[i], c->hits[i]);
+    if (s->cfg.onCounters)
+        s->cfg.onCounters(s->cfg.user, thread, c);
+    memset(c, 0, sizeof(*c));
+}
+
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void *sf_worker(void *arg)
+{
+    SfWorker *w = (SfWorker *)arg;
+    SfScan *s = w->scan;
+    const SfScanConfig *cfg = &s->cfg;
+    Generator g;
+    setupGenerator(&g, cfg->mc, 0);
+    SfHit *hits = NULL;
+    size_t cap = 0;
+    SfUnit unit;
+    SfCounters c;
+    memset(&c, 0, sizeof(c));
+    int timed = cfg->timed;
+    uint64_t mark = 0;
+
+    if (cfg->onThreadStart)
+        cfg->onThreadStart(cfg->user, w->index);
+    while (!atomic_load_explicit(&s->cancelled, memory_order_relaxed))
+    {
+        uint64_t u = atomic_fetch_add_explicit(&s->nextUnit, 1, memory_order_relaxed);
+        if (u >= s->units)
+            break;
+        if (s->unitList)
+        {
+            unit.seedIndex = (int)(s->unitList[u] >> 32);
+            unit.tile = (int)(uint32_t)s->unitList[u];
+        }
+        else
+        {
+            unit.seedIndex = (int)(u / (uint64_t)s->tileCount);
+            unit.tile = s->tiles[u % (uint64_t)s->tileCount];
+        }
+        unit.thread = w->index;
+        atomic_store_explicit(&s->lastTile, unit.tile, memory_order_relaxed);
+        int seedIndex = unit.seedIndex;
+        uint64_t s48 = (uint64_t)s->seeds[seedIndex] & MASK48;
+        if (!atomic_exchange(&s->started[seedIndex], 1))
+            clock_gettime(CLOCK_MONOTONIC, &s->seedStart[seedIndex]);
+        SfRect all = { 0, 0, 0, 0 };
+        int live = plan_unit(s, &unit, &all);
+        int failed = 0;
+        size_t n = 0;
+
+        for (int rx = all.x0; live && !failed && rx < all.x1; rx++)
+        {
+            for (int rz = all.z0; !failed && rz < all.z1; rz++)
+            {
+                // New region: the generator must be reseeded. DIM_NETHER is
+                // -1, so "not seeded yet" needs its own flag.
+                int seeded = 0, lastDim = 0;
+                for (int k = 0; k < cfg->typeCount; k++)
+                {
+                    int i = s->order[k];
+                    if (!sf_rect_has(unit.scan[i], rx, rz) || sf_rect_has(unit.skip[i], rx, rz))
+                        continue;
+                    uint64_t *st = c.stages[i];
+
+                    // Fast math-only rejection before the expensive biome check
+                    Pos pos;
+                    if (timed) mark = sf_ticks();
+                    int found = getStructurePos(cfg->types[i], cfg->mc, s48, rx, rz, &pos);
+                    if (timed) lap(&st[SF_STAGE_TICKS_POS], &mark);
+                    st[SF_STAGE_POS_CHECKS]++;
+                    if (!found)
+                        continue;
+                    st[SF_STAGE_POS_PASSES]++;
+
+                    if (cfg->onFilter)
+                    {
+                        int keep = cfg->onFilter(cfg->user, &unit, i, pos.x, pos.z);
+                        if (timed) lap(&st[SF_STAGE_TICKS_FILTER], &mark);
+                        if (!keep)
+                        {
+                            st[SF_STAGE_FILTER_REJECTS]++;
+                            continue;
+                        }
+                    }
+
+                    // Types are grouped by dimension, so the generator is
+                    // seeded at most once per dimension and region, and
+                    // only when a position needs the biome check
+                    if (!seeded || s->dims[i] != lastDim)
+                    {
+                        applySeed(&g, s->dims[i], s48);
+                        seeded = 1;
+                        lastDim = s->dims[i];
+                        st[SF_STAGE_SEED_CALLS]++;
+                        if (timed) lap(&st[SF_STAGE_TICKS_SEED], &mark);
+                    }
+                    if (cfg->onViableStart)
+                    {
+                        cfg->onViableStart(cfg->user, w->index);
+                        if (timed) mark = sf_ticks();
+                    }
+                    int viable = isViableStructurePos(cfg->types[i], &g, pos.x, pos.z, 0);
+                    if (timed) lap(&st[SF_STAGE_TICKS_VIABLE], &mark);
+                    if (cfg->onViableEnd)
+                        cfg->onViableEnd(cfg->user, w->index);
+                    st[SF_STAGE_VIABLE_CALLS]++;
+                    if (!viable)
+                        continue;
+                    st[SF_STAGE_VIABLE_PASSES]++;
+                    c.hits[i]++;
+                    if (!cfg->onHits)
+                        continue;
+                    if (n == cap)
+                    {
+                        size_t ncap = cap ? cap * 2 : 4096;
+                        SfHit *p = realloc(hits, ncap * sizeof(SfHit));
+                        if (!p)
+                        {
+                            failed = 1;
+                            break;
+                        }
+                        hits = p;
+                        cap = ncap;
+                    }
+                    hits[n++] = (SfHit){ pos.x, pos.z, rx, rz, i };
+                }
+                if ((++c.regions & 4095u) == 0u)
+                    publish(s, w->index, &c);
+            }
+        }
+
+        // A unit that could not keep its hits is dropped whole: no hits,
+        // no onUnitDone, and its seed never finishes
+        if (failed)
+        {
+            fprintf(stderr, "\nError: out of memory buffering hits, stopping the scan\n");
+            atomic_store(&s->failed, 1);
+            atomic_store(&s->cancelled, 1);
+            publish(s, w->index, &c);
+            break;
+        }
+        if (n > 0)
+            cfg->onHits(cfg->user, &unit, hits, n);
+        if (live && cfg->onUnitDone)
+            cfg->onUnitDone(cfg->user, &unit);
+        publish(s, w->index, &c);
+
+        // The last unit of a seed finishes it
+        if (atomic_fetch_sub(&s->unitsLeft[seedIndex], 1) == 1)
+        {
+            if (cfg->onSeedDone)
+                cfg->onSeedDone(cfg->user, seedIndex, seconds_since(&s->seedStart[seedIndex]));
+            atomic_fetch_add(&s->seedsDone, 1);
+        }
+    }
+    if (cfg->onThreadEnd)
+        cfg->onThreadEnd(cfg->user, w->index);
+    free(hits);
+    atomic_fetch_sub_explicit(&s->running, 1, memory_order_release);
+    return NULL;
+}
+
+void sf_scan_defaults(SfScanConfig *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->mc = MC_NEWEST;
+}
+
+static void sf_scan_free(SfScan *s)
+{
+    free(s->seeds);
+    free(s->tiles);
+    free(s->unitList);
+    free(s->unitsLeft);
+    free(s->started);
+    free(s->seedStart);
+    free(s->slots);
+    free(s->workers);
+    free(s);
+}
+
+SfScan *sf_scan_start(const SfScanConfig *cfg)
+{
+    if (cfg->seedCount <= 0 || !cfg->seeds)
+    {
+        fprintf(stderr, "Error: no seeds to scan\n");
+        return NULL;
+    }
+    if (cfg->typeCount <= 0 || cfg->typeCount > SF_SCAN_MAX_TYPES)
+    {
+        fprintf(stderr, "Error: between 1 and %d structure types are needed\n", SF_SCAN_MAX_TYPES);
+        return NULL;
+    }
+    SfScan *s = calloc(1, sizeof(SfScan));
+    if (!s)
+        return NULL;
+    s->cfg = *cfg;
+    s->threads = cfg->threads > 0 ? cfg->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (s->threads < 1)
+        s->threads = 1;
+
+    for (int i = 0; i < cfg->typeCount; i++)
+    {
+        StructureConfig sconf;
+        if (!getStructureConfig(cfg->types[i], cfg->mc, &sconf))
+        {
+            fprintf(stderr, "Error: structure type %d does not generate in this version\n", cfg->types[i]);
+            sf_scan_free(s);
+            return NULL;
+        }
+        s->regionBlocks[i] = sconf.regionSize * 16;
+        s->dims[i] = sf_structure_dim(cfg->types[i]);
+        s->area[i] = sf_scan_area(cfg->radius, s->regionBlocks[i]);
+    }
+    static const int dimOrder[3] = { DIM_OVERWORLD, DIM_NETHER, DIM_END };
+    int k = 0;
+    for (int d = 0; d < 3; d++)
+    {
+        for (int i = 0; i < cfg->typeCount; i++)
+        {
+            if (s->dims[i] == dimOrder[d])
+                s->order[k++] = i;
+        }
+    }
+
+    s->seeds = malloc((size_t)cfg->seedCount * sizeof(int64_t));
+    s->unitsLeft = malloc((size_t)cfg->seedCount * sizeof(atomic_int));
+    s->started = calloc((size_t)cfg->seedCount, sizeof(atomic_int));
+    s->seedStart = calloc((size_t)cfg->seedCount, sizeof(struct timespec));
+    s->tiles = malloc((size_t)TS_TILES_AXIS * TS_TILES_AXIS * sizeof(int));
+    s->slots = aligned_alloc(SFS_CACHE_LINE, (size_t)s->threads * sizeof(SfSlot));
+    s->workers = calloc((size_t)s->threads, sizeof(SfWorker));
+    if (!s->seeds || !s->unitsLeft || !s->started || !s->seedStart || !s->tiles || !s->slots || !s->workers)
+    {
+        fprintf(stderr, "Error: out of memory starting the scan\n");
+        sf_scan_free(s);
+        return NULL;
+    }
+    memcpy(s->seeds, cfg->seeds, (size_t)cfg->seedCount * sizeof(int64_t));
+    memset(s->slots, 0, (size_t)s->threads * sizeof(SfSlot));
+
+    for (int tile = 0; tile < TS_TILES_AXIS * TS_TILES_AXIS; tile++)
+    {
+        SfRect t = sf_tile_rect(tile);
+        int touches = 0;
+        for (int i = 0; i < cfg->typeCount && !touches; i++)
+            touches = !sf_rect_empty(sf_rect_intersect(t, s->area[i]));
+        if (touches)
+            s->tiles[s->tileCount++] = tile;
+    }
+
+    // Without onPlan every seed has the same units; with it each unit is
+    // planned here, and units with nothing to do drop out
+    SfUnit unit;
+    SfRect all;
+    unit.thread = -1;
+    if (!cfg->onPlan)
+    {
+        uint64_t regionsPerSeed = 0;
+        for (int t = 0; t < s->tileCount; t++)
+        {
+            unit.seedIndex = 0;
+            unit.tile = s->tiles[t];
+            plan_unit(s, &unit, &all);
+            regionsPerSeed += rect_area(all);
+        }
+        for (int i = 0; i < cfg->seedCount; i++)
+            atomic_init(&s->unitsLeft[i], s->tileCount);
+        s->units = (uint64_t)cfg->seedCount * (uint64_t)s->tileCount;
+        s->regionsTotal = regionsPerSeed * (uint64_t)cfg->seedCount;
+    }
+    else
+    {
+        uint64_t cap = 0;
+        for (int i = 0; i < cfg->seedCount; i++)
+        {
+            int left = 0;
+            for (int t = 0; t < s->tileCount; t++)
+            {
+                unit.seedIndex = i;
+                unit.tile = s->tiles[t];
+                if (!plan_unit(s, &unit, &all))
+                    continue;
+                if (s->units == cap)
+                {
+                    cap = cap ? cap * 2 : 1024;
+                    uint64_t *p = realloc(s->unitList, cap * sizeof(uint64_t));
+                    if (!p)
+                    {
+                        fprintf(stderr, "Error: out of memory planning the scan\n");
+                        sf_scan_free(s);
+                        return NULL;
+                    }
+                    s->unitList = p;
+                }
+                s->unitList[s->units++] = (uint64_t)i << 32 | (uint32_t)unit.tile;
+                s->regionsTotal += rect_area(all);
+                left++;
+            }
+            atomic_init(&s->unitsLeft[i], left);
+        }
+    }
+    for (int i = 0; i < cfg->seedCount; i++)
+    {
+        if (atomic_load(&s->unitsLeft[i]) > 0)
+            continue;
+        if (cfg->onSeedDone)
+            cfg->onSeedDone(cfg->user, i, 0.0);
+        atomic_fetch_add(&s->seedsDone, 1);
+    }
+    atomic_init(&s->lastTile, -1);
+
+    clock_gettime(CLOCK_MONOTONIC, &s->start);
+    atomic_init(&s->running, 0);
+    for (int i = 0; i < s->threads; i++)
+    {
+        s->workers[i].scan = s;
+        s->workers[i].index = i;
+        // Count the thread before it can finish, so running never reads 0
+        // while workers are still being started
+        atomic_fetch_add(&s->running, 1);
+        if (pthread_create(&s->workers[i].thread, NULL, sf_worker, &s->workers[i]) != 0)
+        {
+            fprintf(stderr, "Error: could not start scan thread %d of %d\n", i + 1, s->threads);
+            sf_scan_cancel(s);
+            for (int k = 0; k < i; k++)
+                pthread_join(s->workers[k].thread, NULL);
+            sf_scan_free(s);
+            return NULL;
+        }
+    }
+    return s;
+}
+
+int sf_scan_progress(SfScan *s, SfScanProgress *p)
+{
+    // Read the flag first so a finished scan reports every count
+    int finished = atomic_load_explicit(&s->running, memory_order_acquire) == 0;
+    memset(p, 0, sizeof(*p));
+    p->regionsTotal = s->regionsTotal;
+    p->unitsTotal = s->units;
+    p->unitsStarted = atomic_load_explicit(&s->nextUnit, memory_order_relaxed);
+    if (p->unitsStarted > s->units)
+        p->unitsStarted = s->units;
+    p->lastTile = atomic_load_explicit(&s->lastTile, memory_order_relaxed);
+    for (int t = 0; t < s->threads; t++)
+    {
+        p->regionsDone += atomic_load_explicit(&s->slots[t].regions, memory_order_relaxed);
+        for (int i = 0; i < s->cfg.typeCount; i++)
+            p->hits[i] += atomic_load_explicit(&s->slots[t].hits[i], memory_order_relaxed);
+    }
+    p->seedsDone = atomic_load(&s->seedsDone);
+    p->failed = atomic_load(&s->failed);
+    p->seconds = seconds_since(&s->start);
+    return finished;
+}
+
+void sf_scan_cancel(SfScan *s)
+{
+    atomic_store(&s->cancelled, 1);
+}
+
+int sf_scan_wait(SfScan *s)
+{
+    for (int i = 0; i < s->threads; i++)
+        pthread_join(s->workers[i].thread, NULL);
+    int complete = atomic_load(&s->seedsDone) == s->cfg.seedCount;
+    int failed = atomic_load(&s->failed);
+    sf_scan_free(s);
+    return failed ? 2 : complete ? 0 : 1;
+}
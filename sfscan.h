@@ -0,0 +1,195 @@
+#ifndef SFSCAN_H_
+#define SFSCAN_H_
+
+// Embeddable scan engine.
+//
+// Finds the structures of one or more seeds in a square around 0,0 (or
+// the whole world) on a pool of threads and hands every hit to the caller
+// as plain numbers: no prompts, no files, no text.
+//
+//     int64_t seed = 77;
+//     SfScanConfig cfg;
+//     sf_scan_defaults(&cfg);
+//     cfg.seeds = &seed;
+//     cfg.seedCount = 1;
+//     cfg.mc = MC_1_20;
+//     cfg.types[cfg.typeCount++] = Swamp_Hut;
+//     cfg.radius = 100000;
+//     cfg.onHits = my_hits;
+//     SfScan *scan = sf_scan_start(&cfg);
+//     SfScanProgress p;
+//     while (!sf_scan_progress(scan, &p))
+//         sleep(1);                       // or sf_scan_cancel(scan)
+//     sf_scan_wait(scan);
+//
+// Work is split into (seed, tile) units of up to 256x256 regions, handed
+// out seed by seed and, within a seed, in increasing tile order, so several
+// seeds run at once when the area has fewer tiles than there are threads.
+//
+// Callers that keep their own output (structure_finder's text files, tile
+// stores and bitmaps) plug in through the optional hooks: onPlan narrows
+// what a unit scans, onFilter rejects positions before the biome check,
+// onUnitDone closes a unit, and the thread hooks set up per-thread state.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SF_SCAN_MAX_TYPES 32
+
+// Half-open rectangle of region indices
+typedef struct
+{
+    int x0, z0, x1, z1;
+} SfRect;
+
+int sf_rect_empty(SfRect r);
+int sf_rect_has(SfRect r, int rx, int rz);
+SfRect sf_rect_intersect(SfRect a, SfRect b);
+// Bounding box of two rects; empty rects are ignored
+SfRect sf_rect_bbox(SfRect a, SfRect b);
+int sf_rect_contains(SfRect outer, SfRect inner);
+
+// Regions of a tile store tile (tx * TS_TILES_AXIS + tz, see tilestore.h)
+SfRect sf_tile_rect(int tile);
+// Regions of a type that touch the square of the given radius around 0,0
+// (the whole world for radius 0)
+SfRect sf_scan_area(int64_t radius, int regionBlocks);
+// DIM_OVERWORLD, DIM_NETHER or DIM_END
+int sf_structure_dim(int type);
+// Stage clock: the time stamp counter where there is one, else ns
+uint64_t sf_ticks(void);
+
+typedef struct
+{
+    int32_t x, z;       // block position
+    int32_t rx, rz;     // region of the type's grid
+    int type;           // index into SfScanConfig.types
+} SfHit;
+
+// One (seed, tile) piece of work
+typedef struct
+{
+    int seedIndex;
+    int tile;                           // tx * TS_TILES_AXIS + tz
+    int thread;                         // worker index, -1 while planning
+    SfRect scan[SF_SCAN_MAX_TYPES];     // regions to check, per type
+    SfRect skip[SF_SCAN_MAX_TYPES];     // part of scan not to check again
+} SfUnit;
+
+// Per-type counters of the scan stages
+enum
+{
+    SF_STAGE_POS_CHECKS,        // getStructurePos calls
+    SF_STAGE_POS_PASSES,        // ... that returned a position
+    SF_STAGE_FILTER_REJECTS,    // positions rejected by onFilter
+    SF_STAGE_SEED_CALLS,        // applySeed calls triggered by this type
+    SF_STAGE_VIABLE_CALLS,      // isViableStructurePos calls
+    SF_STAGE_VIABLE_PASSES,     // ... that passed
+    SF_STAGE_TICKS_POS,         // stage times in sf_ticks units, only
+    SF_STAGE_TICKS_FILTER,      // with SfScanConfig.timed
+    SF_STAGE_TICKS_SEED,
+    SF_STAGE_TICKS_VIABLE,
+    SF_STAGE_COUNT
+};
+
+// Counts one worker gathered since its previous report
+typedef struct
+{
+    uint64_t regions;
+    uint64_t hits[SF_SCAN_MAX_TYPES];
+    uint64_t stages[SF_SCAN_MAX_TYPES][SF_STAGE_COUNT];
+} SfCounters;
+
+// Called from the worker threads, possibly at the same time, with the hits
+// of one unit. hits is only valid during the call.
+typedef void (*SfHitsFn)(void *user, const SfUnit *unit, const SfHit *hits, size_t count);
+
+// Called once per seed, from the thread that finished its last unit,
+// after every onHits call for that seed has returned. seconds runs from
+// the start of the seed's first unit. Not called for seeds left
+// unfinished by sf_scan_cancel. Seeds with no units left after planning
+// are finished by sf_scan_start itself.
+typedef void (*SfSeedDoneFn)(void *user, int seedIndex, double seconds);
+
+// Called for every (seed, tile) unit touching the area, first by
+// sf_scan_start with thread -1 to size the work, then again on the worker
+// right before the unit is scanned. unit->scan starts as each type's area
+// within the tile and skip as empty; the hook may shrink scan and set
+// skip. Return 0 to drop the unit. Both calls must decide the same way.
+typedef int (*SfPlanFn)(void *user, SfUnit *unit);
+
+// Called for positions that passed getStructurePos, before the generator
+// is seeded. Return 0 to reject the position without the biome check.
+typedef int (*SfFilterFn)(void *user, const SfUnit *unit, int type, int x, int z);
+
+// Called after the onHits call of a unit, also for units without hits
+typedef void (*SfUnitDoneFn)(void *user, const SfUnit *unit);
+
+// Called on each worker when it starts and right before it exits; also
+// the type of onViableStart and onViableEnd, which bracket every
+// isViableStructurePos call for per-call instrumentation
+typedef void (*SfThreadFn)(void *user, int thread);
+
+// Called on the worker every few thousand regions and after each unit
+typedef void (*SfCountersFn)(void *user, int thread, const SfCounters *delta);
+
+typedef struct
+{
+    const int64_t *seeds;       // copied by sf_scan_start
+    int seedCount;
+    int mc;
+    int types[SF_SCAN_MAX_TYPES];
+    int typeCount;
+    int64_t radius;             // square around 0,0 in blocks, 0 = whole world
+    int threads;                // 0 = one per CPU
+    int timed;                  // fill the SF_STAGE_TICKS_* counters
+    SfHitsFn onHits;            // may be NULL to only count
+    SfSeedDoneFn onSeedDone;    // may be NULL
+    // optional hooks, see above
+    SfPlanFn onPlan;
+    SfFilterFn onFilter;
+    SfUnitDoneFn onUnitDone;
+    SfThreadFn onThreadStart;
+    SfThreadFn onThreadEnd;
+    SfThreadFn onViableStart;
+    SfThreadFn onViableEnd;
+    SfCountersFn onCounters;
+    void *user;
+} SfScanConfig;
+
+typedef struct
+{
+    uint64_t regionsDone;
+    uint64_t regionsTotal;
+    uint64_t hits[SF_SCAN_MAX_TYPES];   // per type, over all seeds
+    uint64_t unitsTotal;
+    uint64_t unitsStarted;
+    int lastTile;                       // tile of the latest unit, -1 before the first
+    int seedsDone;
+    int failed;                         // a worker ran out of memory, see sf_scan_wait
+    double seconds;
+} SfScanProgress;
+
+typedef struct SfScan SfScan;
+
+void sf_scan_defaults(SfScanConfig *cfg);
+
+// Validates cfg and starts the threads. Returns NULL with a message on
+// stderr if cfg is unusable or a thread cannot be started; in the latter
+// case the threads already running are stopped and joined first, and may
+// have delivered hits for the units they finished.
+SfScan *sf_scan_start(const SfScanConfig *cfg);
+
+// Fills p with the counts so far. Returns 1 once every thread has stopped.
+int sf_scan_progress(SfScan *scan, SfScanProgress *p);
+
+// Asks the threads to stop after their current unit.
+void sf_scan_cancel(SfScan *scan);
+
+// Waits for the threads and frees the scan. Returns 0 if every seed was
+// scanned, 1 if the scan was cancelled first, 2 if a worker ran out of
+// memory. In that case the engine cancels the scan itself, and the unit
+// that failed gets neither onHits nor onUnitDone.
+int sf_scan_wait(SfScan *scan);
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * storequery.c - Bounding-box query over a structure_finder tile store
+ *                or region bitmap
+ *
+ * Prints every structure inside the box in the same line format that
+ * structure_finder writes to its text files, so the output can be fed
+ * straight to groupfinder or grep. Only the tiles intersecting the box
+ * are read. Bitmap positions are regenerated from the region formula.
+ *
+ * Usage: storequery <store.sfts|bitmap.sfrb> [minX minZ maxX maxZ]
+ */
+
+#include "tilestore.h"
+#include "regionbitmap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+typedef struct
+{
+    const TsHeader *hdr;
+    FILE *out;
+} QueryCtx;
+
+static void print_hit(void *arg, int32_t x, int32_t z)
+{
+    QueryCtx *q = (QueryCtx *)arg;
+    fprintf(q->out, "%s->(%d,%d)reg(%d,%d)\n", q->hdr->label, x, z,
+        ts_block_to_region(q->hdr, x), ts_block_to_region(q->hdr, z));
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2 && argc != 6)
+    {
+        fprintf(stderr, "Usage: %s <store.sfts|bitmap.sfrb> [minX minZ maxX maxZ]\n", argv[0]);
+        return 1;
+    }
+
+    int32_t minX = INT32_MIN, minZ = INT32_MIN, maxX = INT32_MAX, maxZ = INT32_MAX;
+    if (argc == 6)
+    {
+        minX = (int32_t)strtol(argv[2], NULL, 10);
+        minZ = (int32_t)strtol(argv[3], NULL, 10);
+        maxX = (int32_t)strtol(argv[4], NULL, 10);
+        maxZ = (int32_t)strtol(argv[5], NULL, 10);
+    }
+
+    if (rb_is_bitmap(argv[1]))
+    {
+        RbReader b;
+        if (rb_open_read(&b, argv[1]) != 0)
+            return 1;
+        if (b.hdr->posKind == RB_POS_CUBIOMES)
+        {
+            fprintf(stderr, "Error: %s positions need cubiomes to regenerate\n", b.hdr->label);
+            rb_close_read(&b);
+            return 1;
+        }
+
+        // Only the label and region size are needed to print lines
+        TsHeader th;
+        memset(&th, 0, sizeof(th));
+        th.regionBlocks = b.hdr->regionBlocks;
+        memcpy(th.label, b.hdr->label, sizeof(th.label));
+        QueryCtx q = { &th, stdout };
+        setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+        uint64_t hits = rb_query(&b, minX, minZ, maxX, maxZ,
+            rb_builtin_pos, (void *)b.hdr, print_hit, &q);
+        fflush(stdout);
+
+        fprintf(stderr, "%" PRIu64 " %s structures in [%d,%d]..[%d,%d] (seed %" PRId64 ", %" PRIu64 " in bitmap)\n",
+            hits, b.hdr->label, minX, minZ, maxX, maxZ, b.hdr->seed, b.hdr->bitCount);
+        rb_close_read(&b);
+        return 0;
+    }
+
+    TsReader r;
+    if (ts_open_read(&r, argv[1]) != 0)
+        return 1;
+
+    QueryCtx q = { r.hdr, stdout };
+    setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+    uint64_t hits = ts_query(&r, minX, minZ, maxX, maxZ, print_hit, &q);
+    fflush(stdout);
+
+    fprintf(stderr, "%" PRIu64 " %s structures in [%d,%d]..[%d,%d] (seed %" PRId64 ", %" PRIu64 " stored)\n",
+        hits, r.hdr->label, minX, minZ, maxX, maxZ, r.hdr->seed, r.hdr->recordCount);
+
+    ts_close_read(&r);
+    return 0;
+}
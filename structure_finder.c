@@ -2,63 +2,519 @@
 #include "finders.h"
 #include "biomes.h"
 #include "util.h"
+#include "tilestore.h"
+#include "biomemap.h"
+#include "regionbitmap.h"
+#include "promfile.h"
+#include "chrometrace.h"
+#include "perfcount.h"
+#include "sfscan.h"
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <time.h>
 #include <sys/stat.h>
 #include <string.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <sys/ioctl.h>
 
-// Define a struct to hold thread arguments
+// Bump when the meaning of cached results changes
+#define SF_CACHE_VERSION 1
+
+// Coarse biome map pruning: cells around a position that must all lack a
+// viable biome before it is rejected without the live check
+#define SF_BIOME_MARGIN     1
+#define SF_BIOME_MAX_TILES  4096
+
+// Size that keeps per-thread counters on separate cache lines
+#define SF_CACHE_LINE 64
+
+// Seconds between rewrites of the stage statistics file during a scan
+#define SF_STATS_REFRESH 10
+
+// Default seconds between rows of the time-series log
+#define SF_SERIES_INTERVAL 5
+
+// Cell-ordered text output. With a sort cell size set, every text file
+// starts with a "#sorted cell=<size>" line and its records are ascending by
+// (floor(x / size), floor(z / size)); the order within a cell is by x, z.
+// groupfinder recognises such files (and concatenations of them) as
+// pre-sorted runs and merges them instead of sorting.
+static int64_t g_sortCell = 0;     // 0 = plain, unordered text
+
+static int64_t floor_div64(int64_t v, int64_t d)
+{
+    return v >= 0 ? v / d : -((-v + d - 1) / d);
+}
+
+static int compare_cell_order(const void *a, const void *b)
+{
+    const TsRecord *ra = (const TsRecord *)a;
+    const TsRecord *rb = (const TsRecord *)b;
+    int64_t ka = floor_div64(ra->x, g_sortCell), kb = floor_div64(rb->x, g_sortCell);
+    if (ka != kb) return ka < kb ? -1 : 1;
+    ka = floor_div64(ra->z, g_sortCell);
+    kb = floor_div64(rb->z, g_sortCell);
+    if (ka != kb) return ka < kb ? -1 : 1;
+    if (ra->x != rb->x) return ra->x < rb->x ? -1 : 1;
+    if (ra->z != rb->z) return ra->z < rb->z ? -1 : 1;
+    return 0;
+}
+
+// Hits of one type waiting to be written in cell order. Callers feed hits
+// in non-decreasing tile column order and flush the cells that no later
+// hit can fall into.
 typedef struct
 {
-    int totalThreads;
-    int numThread;
-    int startRegionX;
-    int endRegionX;
-    int startRegionZ;
-    int endRegionZ;
-    char *tempDir;
-    int64_t seed;
-    // user-selected structures
-    int selectedTypes[32];
-    const char *selectedLabels[32];
-    const char *selectedPrefixes[32];
-    int selectedCount;
-    // selected MC version
-    int mcVersion;
-    // per-file flush counters
-    unsigned int flushCounters[32];
-} ThreadArgs;
+    FILE *out;
+    const char *label;
+    int regionBlocks;
+    TsRecord *buf;
+    size_t count, cap;
+} CellRun;
+
+static void cell_run_start(CellRun *r, FILE *out, const char *label, int regionBlocks)
+{
+    memset(r, 0, sizeof(*r));
+    r->out = out;
+    r->label = label;
+    r->regionBlocks = regionBlocks;
+    fprintf(out, "#sorted cell=%" PRId64 "\n", g_sortCell);
+}
+
+static void cell_run_add(CellRun *r, int32_t x, int32_t z)
+{
+    if (r->count == r->cap)
+    {
+        size_t cap = r->cap ? r->cap * 2 : 4096;
+        TsRecord *p = realloc(r->buf, cap * sizeof(TsRecord));
+        if (!p)
+        {
+            fprintf(stderr, "\nOut of memory buffering sorted output\n");
+            exit(1);
+        }
+        r->buf = p;
+        r->cap = cap;
+    }
+    r->buf[r->count].x = x;
+    r->buf[r->count].z = z;
+    r->count++;
+}
+
+// Writes every buffered hit whose cell column is below cellX and keeps
+// the rest for later
+static void cell_run_flush_below(CellRun *r, int64_t cellX)
+{
+    if (r->count == 0)
+        return;
+    qsort(r->buf, r->count, sizeof(TsRecord), compare_cell_order);
+    size_t n = 0;
+    while (n < r->count && floor_div64(r->buf[n].x, g_sortCell) < cellX)
+    {
+        int32_t x = r->buf[n].x, z = r->buf[n].z;
+        fprintf(r->out, "%s->(%d,%d)reg(%d,%d)\n", r->label, x, z,
+            (int)floor_div64(x, r->regionBlocks), (int)floor_div64(z, r->regionBlocks));
+        n++;
+    }
+    memmove(r->buf, r->buf + n, (r->count - n) * sizeof(TsRecord));
+    r->count -= n;
+}
+
+static void cell_run_finish(CellRun *r)
+{
+    cell_run_flush_below(r, INT64_MAX);
+    free(r->buf);
+    r->buf = NULL;
+    r->cap = 0;
+}
+
+// First block x of a tile column for a type with this region size
+static int64_t tile_column_x(int tx, int regionBlocks)
+{
+    return ((int64_t)TS_MIN_REGION + (int64_t)tx * TS_TILE_REGIONS) * regionBlocks;
+}
+
+// Per-type stage statistics. Counters are always kept; the ST_TICKS_*
+// stage times only when a statistics file was requested.
+enum
+{
+    ST_POS_CHECKS,      // getStructurePos calls
+    ST_POS_PASSES,      // ... that returned a position
+    ST_MAP_REJECTS,     // positions rejected by the coarse biome map
+    ST_SEED_CALLS,      // applySeed calls triggered by this type
+    ST_VIABLE_CALLS,    // isViableStructurePos calls
+    ST_VIABLE_PASSES,   // ... that passed
+    ST_TILES_PRUNED,    // tiles skipped whole by the coarse biome map
+    ST_TICKS_POS,
+    ST_TICKS_MAP,
+    ST_TICKS_SEED,
+    ST_TICKS_VIABLE,
+    ST_TICKS_OUTPUT,    // text, store and bitmap output
+    ST_COUNT
+};
+
+static const char *const statNames[ST_COUNT] = {
+    "posChecks", "posPasses", "mapRejects", "seedCalls", "viableCalls",
+    "viablePasses", "tilesPruned", "nsPos", "nsBiomeMap", "nsApplySeed",
+    "nsViable", "nsOutput",
+};
+
+// Adds the time since *mark to *acc and moves the mark to now
+static inline void stat_lap(uint64_t *acc, uint64_t *mark)
+{
+    uint64_t now = sf_ticks();
+    *acc += now - *mark;
+    *mark = now;
+}
+
+// Progress counters of one scan thread. Each slot is written only by its
+// own thread and sits on its own cache lines, so updates need neither a
+// lock nor atomic read-modify-write; the progress thread sums the slots.
+typedef struct
+{
+    _Atomic uint64_t processedRegions;
+    _Atomic uint64_t selectedCounts[32];
+    _Atomic uint64_t stats[32][ST_COUNT];
+    _Atomic uint64_t bytesWritten;      // text and store output
+} __attribute__((aligned(SF_CACHE_LINE))) ProgressSlot;
 
 typedef struct
 {
-    pthread_mutex_t lock;
     uint64_t totalRegions;
-    uint64_t processedRegions;
     struct timespec startTime;
+    uint64_t startTicks;
     int totalThreads;
-    volatile int done;
+    SfScan *scan;           // finished once the engine reports it
+    ProgressSlot *slots;    // one per scan thread
     // dynamic per-structure progress
     int selectedCount;
     const char *selectedLabels[32];
-    uint64_t selectedCounts[32];
+    // optional stage statistics file, rewritten while scanning
+    const char *statsPath;
+    // optional Prometheus textfile and its refresh interval in seconds
+    const char *promPath;
+    int promInterval;
+    // optional time-series log (CSV, or JSON lines for *.jsonl)
+    FILE *series;
+    int seriesJsonl;
+    int seriesInterval;
+    int64_t seed;
+    int mc;
 } Progress;
 
 static Progress g_progress;
 
-static void progress_add_multi(uint64_t processed, const int *incs, int count)
+static inline void slot_add(_Atomic uint64_t *c, uint64_t v)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v,
+        memory_order_relaxed);
+}
+
+static void progress_add_multi(int thread, uint64_t processed, const uint64_t *incs, int count)
+{
+    ProgressSlot *slot = &g_progress.slots[thread];
+    slot_add(&slot->processedRegions, processed);
+    for (int i = 0; i < count && i < 32; i++)
+    {
+        if (incs && incs[i])
+            slot_add(&slot->selectedCounts[i], incs[i]);
+    }
+}
+
+// Publishes the output bytes produced since the last call: the growth of
+// the thread's text files plus *pending (store records), which is cleared
+static void progress_add_bytes(int thread, FILE **files, int count,
+    uint64_t *textBytes, uint64_t *pending)
+{
+    uint64_t text = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (files[i])
+            text += (uint64_t)ftello(files[i]);
+    }
+    slot_add(&g_progress.slots[thread].bytesWritten, text - *textBytes + *pending);
+    *textBytes = text;
+    *pending = 0;
+}
+
+// Publishes and clears a thread's local stage statistics
+static void progress_add_stats(int thread, uint64_t (*stats)[ST_COUNT], int count)
 {
-    pthread_mutex_lock(&g_progress.lock);
-    g_progress.processedRegions += processed;
+    ProgressSlot *slot = &g_progress.slots[thread];
     for (int i = 0; i < count && i < 32; i++)
     {
-        g_progress.selectedCounts[i] += (incs ? (uint64_t)incs[i] : 0ULL);
+        for (int f = 0; f < ST_COUNT; f++)
+        {
+            if (stats[i][f])
+                slot_add(&slot->stats[i][f], stats[i][f]);
+            stats[i][f] = 0;
+        }
     }
-    pthread_mutex_unlock(&g_progress.lock);
+}
+
+// Sums the per-thread slots; counts may be NULL
+static uint64_t progress_sum(uint64_t *counts, int count)
+{
+    uint64_t done = 0;
+    for (int i = 0; i < count; i++)
+        counts[i] = 0;
+    for (int t = 0; t < g_progress.totalThreads; t++)
+    {
+        const ProgressSlot *slot = &g_progress.slots[t];
+        done += atomic_load_explicit(&slot->processedRegions, memory_order_relaxed);
+        for (int i = 0; i < count; i++)
+            counts[i] += atomic_load_explicit(&slot->selectedCounts[i], memory_order_relaxed);
+    }
+    return done;
+}
+
+static double elapsed_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void write_stat_fields(FILE *f, const uint64_t *v, double nsPerTick)
+{
+    for (int k = 0; k < ST_COUNT; k++)
+    {
+        if (k >= ST_TICKS_POS)
+            fprintf(f, "%s\"%s\": %.0f", k ? ", " : "", statNames[k], v[k] * nsPerTick);
+        else
+            fprintf(f, "%s\"%s\": %llu", k ? ", " : "", statNames[k], (unsigned long long)v[k]);
+    }
+}
+
+// Writes the merged stage statistics as JSON. The file is replaced
+// atomically so readers never see a partial summary.
+static void write_stats_json(const char *path, int finished)
+{
+    int threads = g_progress.totalThreads;
+    int scount = g_progress.selectedCount;
+    double elapsed = elapsed_since(&g_progress.startTime);
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t ticks = sf_ticks() - g_progress.startTicks;
+    double nsPerTick = ticks ? elapsed * 1e9 / (double)ticks : 0.0;
+#else
+    double nsPerTick = 1.0;
+#endif
+
+    char tmpPath[1024];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE *f = fopen(tmpPath, "w");
+    if (!f)
+        return;
+
+    uint64_t counts[32];
+    uint64_t done = progress_sum(counts, scount);
+    fprintf(f, "{\n  \"seed\": %" PRId64 ", \"mc\": \"%s\", \"threads\": %d, \"finished\": %s,\n",
+        g_progress.seed, mc2str(g_progress.mc), threads, finished ? "true" : "false");
+    fprintf(f, "  \"elapsedSec\": %.3f, \"regions\": %llu, \"totalRegions\": %llu, \"nsPerTick\": %.6f,\n",
+        elapsed, (unsigned long long)done, (unsigned long long)g_progress.totalRegions, nsPerTick);
+
+    fprintf(f, "  \"types\": [\n");
+    for (int i = 0; i < scount; i++)
+    {
+        uint64_t v[ST_COUNT] = {0};
+        for (int t = 0; t < threads; t++)
+            for (int k = 0; k < ST_COUNT; k++)
+                v[k] += atomic_load_explicit(&g_progress.slots[t].stats[i][k], memory_order_relaxed);
+        fprintf(f, "    {\"type\": \"%s\", \"found\": %llu, ", g_progress.selectedLabels[i],
+            (unsigned long long)counts[i]);
+        write_stat_fields(f, v, nsPerTick);
+        fprintf(f, "}%s\n", i + 1 < scount ? "," : "");
+    }
+    fprintf(f, "  ],\n");
+
+    fprintf(f, "  \"perThread\": [\n");
+    for (int t = 0; t < threads; t++)
+    {
+        const ProgressSlot *slot = &g_progress.slots[t];
+        uint64_t v[ST_COUNT] = {0};
+        for (int i = 0; i < scount; i++)
+            for (int k = 0; k < ST_COUNT; k++)
+                v[k] += atomic_load_explicit(&slot->stats[i][k], memory_order_relaxed);
+        fprintf(f, "    {\"thread\": %d, \"regions\": %llu, ", t,
+            (unsigned long long)atomic_load_explicit(&slot->processedRegions, memory_order_relaxed));
+        write_stat_fields(f, v, nsPerTick);
+        fprintf(f, "}%s\n", t + 1 < threads ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+
+    if (fclose(f) != 0 || rename(tmpPath, path) != 0)
+    {
+        fprintf(stderr, "\nWarning: could not write statistics to %s\n", path);
+        remove(tmpPath);
+    }
+}
+
+// Previous sample of the time-series log, to turn totals into rates
+typedef struct
+{
+    double t;
+    uint64_t done;
+    uint64_t bytes;
+    uint64_t counts[32];
+    uint64_t *threadDone;
+} SeriesState;
+
+// Region rect origin of the tile handed out most recently, to place slow
+// periods in the world
+static void last_tile_origin(int *rx, int *rz, int *queued)
+{
+    SfScanProgress p;
+    sf_scan_progress(g_progress.scan, &p);
+    *queued = (int)(p.unitsTotal - p.unitsStarted);
+    SfRect r = sf_tile_rect(p.lastTile >= 0 ? p.lastTile : 0);
+    *rx = p.lastTile >= 0 ? r.x0 : 0;
+    *rz = p.lastTile >= 0 ? r.z0 : 0;
+}
+
+static void write_series_header(void)
+{
+    FILE *f = g_progress.series;
+    if (g_progress.seriesJsonl)
+        return;
+    fprintf(f, "time_s,regions,regions_per_s,avg_regions_per_s,bytes_written,bytes_per_s,"
+        "rss_bytes,tiles_queued,tile_rx,tile_rz");
+    for (int i = 0; i < g_progress.selectedCount; i++)
+        fprintf(f, ",%s_per_s", g_progress.selectedLabels[i]);
+    for (int t = 0; t < g_progress.totalThreads; t++)
+        fprintf(f, ",thread%d_regions_per_s", t);
+    fprintf(f, "\n");
+    fflush(f);
+}
+
+// Appends one row with the rates since the previous row
+static void write_series_row(SeriesState *st, double elapsed)
+{
+    FILE *f = g_progress.series;
+    int threads = g_progress.totalThreads;
+    int scount = g_progress.selectedCount;
+    uint64_t counts[32];
+    uint64_t done = progress_sum(counts, scount);
+    uint64_t bytes = 0;
+    for (int t = 0; t < threads; t++)
+        bytes += atomic_load_explicit(&g_progress.slots[t].bytesWritten, memory_order_relaxed);
+    double dt = elapsed - st->t;
+    if (dt <= 0)
+        return;
+    int rx, rz, queued;
+    last_tile_origin(&rx, &rz, &queued);
+    uint64_t rss = prom_rss_bytes();
+    double rps = (done - st->done) / dt;
+    double avg = elapsed > 0 ? done / elapsed : 0.0;
+    double bps = (bytes - st->bytes) / dt;
+
+    if (g_progress.seriesJsonl)
+    {
+        fprintf(f, "{\"t\": %.2f, \"regions\": %llu, \"rps\": %.1f, \"avgRps\": %.1f, "
+            "\"bytes\": %llu, \"bytesPerSec\": %.0f, \"rss\": %llu, \"tilesQueued\": %d, "
+            "\"tileRx\": %d, \"tileRz\": %d, \"hitsPerSec\": {", elapsed,
+            (unsigned long long)done, rps, avg, (unsigned long long)bytes, bps,
+            (unsigned long long)rss, queued, rx, rz);
+        for (int i = 0; i < scount; i++)
+            fprintf(f, "%s\"%s\": %.1f", i ? ", " : "", g_progress.selectedLabels[i],
+                (counts[i] - st->counts[i]) / dt);
+        fprintf(f, "}, \"threadRps\": [");
+    }
+    else
+    {
+        fprintf(f, "%.2f,%llu,%.1f,%.1f,%llu,%.0f,%llu,%d,%d,%d", elapsed,
+            (unsigned long long)done, rps, avg, (unsigned long long)bytes, bps,
+            (unsigned long long)rss, queued, rx, rz);
+        for (int i = 0; i < scount; i++)
+            fprintf(f, ",%.1f", (counts[i] - st->counts[i]) / dt);
+    }
+    for (int t = 0; t < threads; t++)
+    {
+        uint64_t d = atomic_load_explicit(&g_progress.slots[t].processedRegions, memory_order_relaxed);
+        if (g_progress.seriesJsonl)
+            fprintf(f, "%s%.1f", t ? ", " : "", (d - st->threadDone[t]) / dt);
+        else
+            fprintf(f, ",%.1f", (d - st->threadDone[t]) / dt);
+        st->threadDone[t] = d;
+    }
+    fprintf(f, g_progress.seriesJsonl ? "]}\n" : "\n");
+    fflush(f);
+
+    st->t = elapsed;
+    st->done = done;
+    st->bytes = bytes;
+    memcpy(st->counts, counts, sizeof(counts));
+}
+
+// Writes a Prometheus snapshot from the same slots the progress line sums
+static void write_prom_metrics(const char *path)
+{
+    PromFile p;
+    if (prom_begin(&p, path) != 0)
+        return;
+
+    int threads = g_progress.totalThreads;
+    int scount = g_progress.selectedCount;
+    uint64_t counts[32];
+    uint64_t done = progress_sum(counts, scount);
+    uint64_t total = g_progress.totalRegions;
+    double elapsed = elapsed_since(&g_progress.startTime);
+    double rps = elapsed > 0 ? (double)done / elapsed : 0.0;
+    SfScanProgress sp;
+    sf_scan_progress(g_progress.scan, &sp);
+    uint64_t tilesLeft = sp.unitsTotal - sp.unitsStarted;
+
+    char labels[128];
+    snprintf(labels, sizeof(labels), "seed=\"%" PRId64 "\",mc=\"%s\"",
+        g_progress.seed, mc2str(g_progress.mc));
+    prom_help(&p, "sf_scan_info", "gauge", "Seed and version being scanned");
+    prom_value(&p, "sf_scan_info", labels, 1);
+    prom_help(&p, "sf_regions_processed_total", "counter", "Regions scanned so far");
+    prom_value(&p, "sf_regions_processed_total", NULL, (double)done);
+    prom_help(&p, "sf_regions", "gauge", "Regions to scan in this run");
+    prom_value(&p, "sf_regions", NULL, (double)total);
+    prom_help(&p, "sf_regions_per_second", "gauge", "Average scan rate since start");
+    prom_value(&p, "sf_regions_per_second", NULL, rps);
+    prom_help(&p, "sf_eta_seconds", "gauge", "Estimated time to completion");
+    prom_value(&p, "sf_eta_seconds", NULL, rps > 0 ? (double)(total - done) / rps : 0.0);
+    prom_help(&p, "sf_elapsed_seconds", "gauge", "Time since the scan started");
+    prom_value(&p, "sf_elapsed_seconds", NULL, elapsed);
+    prom_help(&p, "sf_tiles_queued", "gauge", "Tiles not yet taken by a scan thread");
+    prom_value(&p, "sf_tiles_queued", NULL, (double)tilesLeft);
+    prom_help(&p, "sf_threads", "gauge", "Scan threads");
+    prom_value(&p, "sf_threads", NULL, threads);
+    prom_help(&p, "sf_resident_memory_bytes", "gauge", "Resident memory size in bytes");
+    prom_value(&p, "sf_resident_memory_bytes", NULL, (double)prom_rss_bytes());
+
+    prom_help(&p, "sf_structures_found_total", "counter", "Structures found by type");
+    for (int i = 0; i < scount; i++)
+    {
+        snprintf(labels, sizeof(labels), "type=\"%s\"", g_progress.selectedLabels[i]);
+        prom_value(&p, "sf_structures_found_total", labels, (double)counts[i]);
+    }
+    prom_help(&p, "sf_viability_checks_total", "counter", "Live biome checks by type");
+    for (int i = 0; i < scount; i++)
+    {
+        uint64_t v = 0;
+        for (int t = 0; t < threads; t++)
+            v += atomic_load_explicit(&g_progress.slots[t].stats[i][ST_VIABLE_CALLS],
+                memory_order_relaxed);
+        snprintf(labels, sizeof(labels), "type=\"%s\"", g_progress.selectedLabels[i]);
+        prom_value(&p, "sf_viability_checks_total", labels, (double)v);
+    }
+    prom_help(&p, "sf_thread_regions_processed_total", "counter", "Regions scanned by thread");
+    for (int t = 0; t < threads; t++)
+    {
+        snprintf(labels, sizeof(labels), "thread=\"%d\"", t);
+        prom_value(&p, "sf_thread_regions_processed_total", labels,
+            (double)atomic_load_explicit(&g_progress.slots[t].processedRegions,
+                memory_order_relaxed));
+    }
+
+    if (prom_end(&p) != 0)
+        fprintf(stderr, "\nWarning: could not write metrics to %s\n", path);
 }
 
 static void humanize_time(double s, int *h, int *m, int *sec)
@@ -90,25 +546,35 @@ static void *progressThread(void *arg)
 {
     (void)arg;
     static int last_len = 0;
+    double lastStats = 0.0;
+    double lastProm = -1e9;
+    SeriesState series;
+    memset(&series, 0, sizeof(series));
+    if (g_progress.series && !(series.threadDone = calloc(g_progress.totalThreads, sizeof(uint64_t))))
+        g_progress.series = NULL;
     for (;;)
     {
-        pthread_mutex_lock(&g_progress.lock);
-        uint64_t done = g_progress.processedRegions;
+        // Ask first so the final pass sees every thread's counts
+        SfScanProgress sp;
+        int finished = sf_scan_progress(g_progress.scan, &sp);
         uint64_t total = g_progress.totalRegions;
         int scount = g_progress.selectedCount;
-        const char *labels[32];
+        const char **labels = g_progress.selectedLabels;
         uint64_t counts[32];
-        for (int i = 0; i < scount && i < 32; i++)
+        uint64_t done = progress_sum(counts, scount);
+        double elapsed = elapsed_since(&g_progress.startTime);
+        if (g_progress.statsPath && !finished && elapsed - lastStats >= SF_STATS_REFRESH)
         {
-            labels[i] = g_progress.selectedLabels[i];
-            counts[i] = g_progress.selectedCounts[i];
+            write_stats_json(g_progress.statsPath, 0);
+            lastStats = elapsed;
         }
-        int finished = g_progress.done;
-        struct timespec now;
-        clock_gettime(CLOCK_MONOTONIC, &now);
-        double elapsed = (now.tv_sec - g_progress.startTime.tv_sec)
-            + (now.tv_nsec - g_progress.startTime.tv_nsec) / 1e9;
-        pthread_mutex_unlock(&g_progress.lock);
+        if (g_progress.promPath && !finished && elapsed - lastProm >= g_progress.promInterval)
+        {
+            write_prom_metrics(g_progress.promPath);
+            lastProm = elapsed;
+        }
+        if (g_progress.series && (finished || elapsed - series.t >= g_progress.seriesInterval))
+            write_series_row(&series, elapsed);
 
         double perc = total ? (100.0 * (double)done / (double)total) : 0.0;
         double rps = elapsed > 0 ? (double)done / elapsed : 0.0;
@@ -202,204 +668,1009 @@ static void *progressThread(void *arg)
     }
     fprintf(stdout, "\n");
     fflush(stdout);
+    free(series.threadDone);
     return NULL;
 }
 
 
-void logD(const char *msg)
+void logD(const char *msg)
+{
+    // log with date before message
+    time_t t = time(NULL);
+    struct tm tm = *localtime(&t);
+    printf("[%d-%02d-%02d %02d:%02d:%02d] %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, msg);
+}
+
+// What one tile still needs per selected type: the rect to scan, the part
+// of it already covered by the type's stored block, and whether the coarse
+// biome map rules the type out for the whole tile.
+typedef struct
+{
+    int active[32];
+    int pruned[32];
+    SfRect scan[32];
+    SfRect cached[32];
+} TilePlan;
+
+// Output state of one scan thread
+typedef struct
+{
+    FILE *files[32];
+    unsigned int flushCounters[32];
+    // Sorted output: tiles arrive in increasing column order per thread,
+    // so everything left of the current column is final
+    CellRun runs[32];
+    int runColumn;
+    // Per-tile hit buffers for the tile stores
+    TsRecord *tileHits[32];
+    uint32_t tileHitCount[32];
+    uint32_t tileHitCap[32];
+    // Per-tile region bits for the bitmaps
+    uint8_t *tileBits[32];
+    TilePlan plan;              // of the unit being scanned
+    uint64_t tileSpan;
+    // Stages the engine does not count (pruned tiles, output time), and
+    // output bytes for the time-series log: text file positions plus
+    // store records
+    uint64_t stats[32][ST_COUNT];
+    uint64_t localBytes, textBytes;
+    // Optional hardware counters over the whole scan of this thread
+    PerfGroup perf;
+    PerfSample perfStart;
+    PerfSample viableStart, viableSum;  // counters inside isViableStructurePos
+    int perfOn;
+    uint64_t perfRegions, perfViable;
+} ScanThread;
+
+// What the scan hooks share: the selected types and the output sinks
+typedef struct
+{
+    const char *tempDir;
+    int selectedCount;
+    const char *selectedLabels[32];
+    const char *selectedPrefixes[32];
+    int regionBlocks[32];
+    int dimSlot[32];            // index into biomeMaps
+    // output sinks: per-thread text files and/or shared tile stores
+    int writeText;
+    int timed;
+    TileStore *stores[32];
+    RegionBitmap *bitmaps[32];
+    // optional coarse biome maps per dimension (overworld, nether, end)
+    // and the biomes each type can spawn in
+    BiomeMap *biomeMaps[3];
+    const uint8_t *viable[32];
+    ScanThread *threads;
+} ScanJob;
+
+// Where the engine's stage counters go among ST_*
+static const int stageStat[SF_STAGE_COUNT] = {
+    ST_POS_CHECKS, ST_POS_PASSES, ST_MAP_REJECTS, ST_SEED_CALLS, ST_VIABLE_CALLS,
+    ST_VIABLE_PASSES, ST_TICKS_POS, ST_TICKS_MAP, ST_TICKS_SEED, ST_TICKS_VIABLE,
+};
+
+static void scan_thread_start(void *user, int thread)
+{
+    ScanJob *job = (ScanJob *)user;
+    ScanThread *ts = &job->threads[thread];
+    ct_thread_name("scan", thread);
+    if ((ts->perfOn = pc_open(&ts->perf) == 0))
+        pc_read(&ts->perf, &ts->perfStart);
+
+    for (int i = 0; i < job->selectedCount && job->writeText; i++)
+    {
+        char filename[256];
+        snprintf(filename, sizeof(filename), "%s/%s_%03d.txt",
+            job->tempDir, job->selectedPrefixes[i], thread);
+        ts->files[i] = fopen(filename, "w");
+        if (ts->files[i])
+            setvbuf(ts->files[i], NULL, _IOFBF, 1 << 20);
+    }
+    ts->runColumn = -1;
+    for (int i = 0; i < job->selectedCount && g_sortCell > 0; i++)
+    {
+        if (ts->files[i])
+            cell_run_start(&ts->runs[i], ts->files[i], job->selectedLabels[i], job->regionBlocks[i]);
+    }
+    for (int i = 0; i < job->selectedCount; i++)
+    {
+        if (job->bitmaps[i] && !(ts->tileBits[i] = calloc(1, RB_TILE_BYTES)))
+        {
+            fprintf(stderr, "\nOut of memory for tile bitmaps\n");
+            exit(1);
+        }
+    }
+}
+
+// Drops the parts of the tile the stores already hold and the types the
+// coarse biome map rules out. On a worker it also opens the tile: the
+// sorted runs are flushed up to its column and its trace span starts.
+static int scan_plan(void *user, SfUnit *u)
+{
+    ScanJob *job = (ScanJob *)user;
+    ScanThread *ts = u->thread >= 0 ? &job->threads[u->thread] : NULL;
+    TilePlan local;
+    TilePlan *p = ts ? &ts->plan : &local;
+    int tx = u->tile / TS_TILES_AXIS;
+    int tz = u->tile % TS_TILES_AXIS;
+    SfRect t = sf_tile_rect(u->tile);
+    SfRect none = { 0, 0, 0, 0 };
+    int any = 0;
+    for (int i = 0; i < job->selectedCount; i++)
+    {
+        p->active[i] = 0;
+        p->pruned[i] = 0;
+        SfRect need = u->scan[i];
+        u->scan[i] = none;
+        if (sf_rect_empty(need))
+            continue;
+
+        SfRect cached = none;
+        if (job->stores[i])
+        {
+            const TsTileEntry *e = ts_tile_entry(job->stores[i], tx, tz);
+            if (e->flags & TS_TILE_SCANNED)
+            {
+                cached.x0 = t.x0 + e->rx0;
+                cached.z0 = t.z0 + e->rz0;
+                cached.x1 = t.x0 + e->rx1;
+                cached.z1 = t.z0 + e->rz1;
+            }
+        }
+        if (sf_rect_contains(cached, need))
+            continue;   // fully cached
+
+        p->active[i] = 1;
+        p->cached[i] = cached;
+        p->scan[i] = sf_rect_bbox(need, cached);
+        any = 1;
+
+        // Types with no viable biome anywhere in the coarse map around
+        // their scan rect are finished for this tile without scanning
+        BiomeMap *m = job->biomeMaps[job->dimSlot[i]];
+        if (m)
+        {
+            SfRect sr = p->scan[i];
+            int64_t b = job->regionBlocks[i];
+            if (!bm_rect_may_be_viable(m, job->viable[i], sr.x0 * b, sr.z0 * b,
+                    sr.x1 * b, sr.z1 * b, SF_BIOME_MARGIN))
+            {
+                p->pruned[i] = 1;
+                if (ts)
+                    ts->stats[i][ST_TILES_PRUNED]++;
+                continue;
+            }
+        }
+        u->scan[i] = p->scan[i];
+        u->skip[i] = cached;
+    }
+    if (!any || !ts)
+        return any;
+
+    ts->tileSpan = ct_begin();
+    if (g_sortCell > 0 && tx != ts->runColumn)
+    {
+        uint64_t span = ct_begin();
+        for (int i = 0; i < job->selectedCount; i++)
+        {
+            if (ts->files[i])
+                cell_run_flush_below(&ts->runs[i],
+                    floor_div64(tile_column_x(tx, job->regionBlocks[i]), g_sortCell));
+        }
+        ts->runColumn = tx;
+        ct_end(span, "sorted flush", tx);
+    }
+    return 1;
+}
+
+// Coarse map rejection: the live check cannot pass when no cell near the
+// position has a viable biome
+static int scan_filter(void *user, const SfUnit *u, int type, int x, int z)
+{
+    ScanJob *job = (ScanJob *)user;
+    (void)u;
+    BiomeMap *m = job->biomeMaps[job->dimSlot[type]];
+    return !m || bm_may_be_viable(m, job->viable[type], x, z, SF_BIOME_MARGIN);
+}
+
+// Writes a tile's hits to the text files and buffers them for the stores
+// and bitmaps, which are published when the tile is done
+static void scan_hits(void *user, const SfUnit *u, const SfHit *hits, size_t count)
+{
+    ScanJob *job = (ScanJob *)user;
+    ScanThread *ts = &job->threads[u->thread];
+    SfRect t = sf_tile_rect(u->tile);
+    uint64_t lap = 0;
+    if (job->timed) lap = sf_ticks();
+    for (size_t k = 0; k < count; k++)
+    {
+        const SfHit *h = &hits[k];
+        int i = h->type;
+        if (ts->files[i] && g_sortCell > 0)
+        {
+            cell_run_add(&ts->runs[i], h->x, h->z);
+        }
+        else if (ts->files[i])
+        {
+            fprintf(ts->files[i], "%s->(%d,%d)reg(%d,%d)\n",
+                job->selectedLabels[i], h->x, h->z, h->rx, h->rz);
+            if ((++ts->flushCounters[i] & 2047u) == 0u)
+            {
+                uint64_t span = ct_begin();
+                fflush(ts->files[i]);
+                ct_end(span, "flush", i);
+            }
+        }
+        if (ts->tileBits[i])
+            rb_set(ts->tileBits[i], h->rx - t.x0, h->rz - t.z0);
+        if (job->stores[i])
+        {
+            if (ts->tileHitCount[i] == ts->tileHitCap[i])
+            {
+                uint32_t cap = ts->tileHitCap[i] ? ts->tileHitCap[i] * 2 : 4096;
+                TsRecord *p = realloc(ts->tileHits[i], cap * sizeof(TsRecord));
+                if (!p)
+                {
+                    fprintf(stderr, "\nOut of memory buffering tile hits\n");
+                    exit(1);
+                }
+                ts->tileHits[i] = p;
+                ts->tileHitCap[i] = cap;
+            }
+            ts->tileHits[i][ts->tileHitCount[i]].x = h->x;
+            ts->tileHits[i][ts->tileHitCount[i]].z = h->z;
+            ts->tileHitCount[i]++;
+        }
+        if (job->timed) stat_lap(&ts->stats[i][ST_TICKS_OUTPUT], &lap);
+    }
+}
+
+static void scan_unit_done(void *user, const SfUnit *u)
+{
+    ScanJob *job = (ScanJob *)user;
+    ScanThread *ts = &job->threads[u->thread];
+    const TilePlan *plan = &ts->plan;
+    int tx = u->tile / TS_TILES_AXIS;
+    int tz = u->tile % TS_TILES_AXIS;
+    SfRect t = sf_tile_rect(u->tile);
+    uint64_t lap = 0;
+    if (job->timed) lap = sf_ticks();
+    uint64_t publishSpan = ct_begin();
+    for (int i = 0; i < job->selectedCount; i++)
+    {
+        if (!ts->tileBits[i] || !plan->active[i])
+            continue;
+        if (rb_put_tile(job->bitmaps[i], tx, tz, ts->tileBits[i]) != 0)
+            fprintf(stderr, "\nWarning: failed to write tile (%d,%d) of %s bitmap\n",
+                tx, tz, job->selectedLabels[i]);
+        memset(ts->tileBits[i], 0, RB_TILE_BYTES);
+    }
+
+    // Publish this tile's hits to the stores, together with the hits
+    // of the previously stored part of the tile
+    for (int i = 0; i < job->selectedCount; i++)
+    {
+        if (!job->stores[i] || !plan->active[i])
+            continue;
+        const TsTileEntry *e = ts_tile_entry(job->stores[i], tx, tz);
+        uint32_t keep = sf_rect_empty(plan->cached[i]) ? 0 : e->count;
+        if (keep > 0)
+        {
+            uint32_t need = ts->tileHitCount[i] + keep;
+            if (need > ts->tileHitCap[i])
+            {
+                TsRecord *p = realloc(ts->tileHits[i], need * sizeof(TsRecord));
+                if (!p)
+                {
+                    fprintf(stderr, "\nOut of memory buffering tile hits\n");
+                    exit(1);
+                }
+                ts->tileHits[i] = p;
+                ts->tileHitCap[i] = need;
+            }
+            if (ts_read_tile(job->stores[i], e, ts->tileHits[i] + ts->tileHitCount[i]) != 0)
+            {
+                fprintf(stderr, "\nError: failed to read cached tile (%d,%d) of %s\n",
+                    tx, tz, job->selectedLabels[i]);
+                exit(1);
+            }
+        }
+        SfRect sr = plan->scan[i];
+        if (ts_put_tile(job->stores[i], tx, tz, ts->tileHits[i], ts->tileHitCount[i] + keep,
+                sr.x0 - t.x0, sr.z0 - t.z0, sr.x1 - t.x0, sr.z1 - t.z0) != 0)
+            fprintf(stderr, "\nWarning: failed to write tile (%d,%d) of %s store\n",
+                tx, tz, job->selectedLabels[i]);
+        ts->localBytes += (uint64_t)(ts->tileHitCount[i] + keep) * sizeof(TsRecord);
+        ts->tileHitCount[i] = 0;
+    }
+    // Tile publishing is shared output time; book it on the first type
+    if (job->timed) stat_lap(&ts->stats[0][ST_TICKS_OUTPUT], &lap);
+    ct_end(publishSpan, "publish", u->tile);
+    ct_end(ts->tileSpan, "tile", u->tile);
+}
+
+static void scan_viable_start(void *user, int thread)
+{
+    ScanThread *ts = &((ScanJob *)user)->threads[thread];
+    if (ts->perfOn)
+        pc_read(&ts->perf, &ts->viableStart);
+}
+
+static void scan_viable_end(void *user, int thread)
+{
+    ScanThread *ts = &((ScanJob *)user)->threads[thread];
+    if (!ts->perfOn)
+        return;
+    PerfSample now;
+    pc_read(&ts->perf, &now);
+    for (int k = 0; k < PC_COUNT; k++)
+        ts->viableSum.v[k] += now.v[k] - ts->viableStart.v[k];
+}
+
+// Publishes the engine's counts together with this thread's own
+static void scan_counters(void *user, int thread, const SfCounters *c)
+{
+    ScanJob *job = (ScanJob *)user;
+    ScanThread *ts = &job->threads[thread];
+    for (int i = 0; i < job->selectedCount; i++)
+    {
+        for (int k = 0; k < SF_STAGE_COUNT; k++)
+            ts->stats[i][stageStat[k]] += c->stages[i][k];
+        ts->perfViable += c->stages[i][SF_STAGE_VIABLE_CALLS];
+    }
+    ts->perfRegions += c->regions;
+    progress_add_multi(thread, c->regions, c->hits, job->selectedCount);
+    progress_add_stats(thread, ts->stats, job->selectedCount);
+    progress_add_bytes(thread, ts->files, job->selectedCount, &ts->textBytes, &ts->localBytes);
+}
+
+static void scan_thread_end(void *user, int thread)
+{
+    ScanJob *job = (ScanJob *)user;
+    ScanThread *ts = &job->threads[thread];
+    for (int i = 0; i < job->selectedCount; i++)
+        if (ts->files[i] && g_sortCell > 0) cell_run_finish(&ts->runs[i]);
+    progress_add_stats(thread, ts->stats, job->selectedCount);
+    progress_add_bytes(thread, ts->files, job->selectedCount, &ts->textBytes, &ts->localBytes);
+
+    if (ts->perfOn)
+    {
+        PerfSample perfEnd;
+        pc_read(&ts->perf, &perfEnd);
+        pc_phase_add("scan", "region", &ts->perfStart, &perfEnd, ts->perfRegions);
+        PerfSample zero;
+        memset(&zero, 0, sizeof(zero));
+        pc_phase_add("scan (viability)", "viability check", &zero, &ts->viableSum, ts->perfViable);
+        pc_close(&ts->perf);
+    }
+
+    for (int i = 0; i < job->selectedCount; i++)
+    {
+        if (ts->files[i]) fflush(ts->files[i]);
+        if (ts->files[i]) fclose(ts->files[i]);
+        free(ts->tileHits[i]);
+        free(ts->tileBits[i]);
+    }
+}
+
+static uint64_t fnv_mix(uint64_t h, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        h ^= (v >> (8 * i)) & 0xff;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Fingerprint guarding cached results of one type. It changes whenever the
+// cache format, the structure configuration, or cubiomes' answers for a
+// fixed set of probe regions change, so results from a different cubiomes
+// build or version mapping are never reused. Results pruned with a coarse
+// biome map are approximate and get their own fingerprint.
+static uint64_t cache_fingerprint(int type, int mc, int64_t seed, int biomeScale)
+{
+    uint64_t s48 = (uint64_t)seed & MASK48;
+    uint64_t h = 14695981039346656037ULL;
+    h = fnv_mix(h, SF_CACHE_VERSION);
+    h = fnv_mix(h, TS_FORMAT_VERSION);
+    h = fnv_mix(h, (uint64_t)mc);
+    h = fnv_mix(h, (uint64_t)type);
+
+    StructureConfig sconf;
+    if (getStructureConfig(type, mc, &sconf))
+    {
+        h = fnv_mix(h, (uint64_t)(uint32_t)sconf.salt);
+        h = fnv_mix(h, (uint64_t)sconf.regionSize);
+        h = fnv_mix(h, (uint64_t)sconf.chunkRange);
+    }
+    if (biomeScale > 0)
+    {
+        h = fnv_mix(h, (uint64_t)biomeScale);
+        h = fnv_mix(h, SF_BIOME_MARGIN);
+        h = fnv_mix(h, BM_FORMAT_VERSION);
+    }
+
+    Generator g;
+    setupGenerator(&g, mc, 0);
+    int applied = 0;
+    for (int p = 0; p < 64; p++)
+    {
+        int rx = -40000 + p * 1237;
+        int rz = 35000 - p * 1091;
+        Pos pos;
+        if (!getStructurePos(type, mc, s48, rx, rz, &pos))
+        {
+            h = fnv_mix(h, ~0ULL);
+            continue;
+        }
+        if (!applied)
+        {
+            applySeed(&g, sf_structure_dim(type), s48);
+            applied = 1;
+        }
+        h = fnv_mix(h, (uint64_t)(uint32_t)pos.x);
+        h = fnv_mix(h, (uint64_t)(uint32_t)pos.z);
+        h = fnv_mix(h, (uint64_t)isViableStructurePos(type, &g, pos.x, pos.z, 0));
+    }
+    return h;
+}
+
+typedef struct
+{
+    FILE *out;
+    const TsHeader *hdr;
+    CellRun *run;       // NULL for unordered output
+    int column;
+} ExportCtx;
+
+static void export_hit(void *arg, int32_t x, int32_t z)
+{
+    ExportCtx *e = (ExportCtx *)arg;
+    if (e->run)
+    {
+        // ts_query walks tiles column by column
+        int tx = ts_region_to_tile(ts_block_to_region(e->hdr, x));
+        if (tx != e->column)
+        {
+            cell_run_flush_below(e->run,
+                floor_div64(tile_column_x(tx, e->hdr->regionBlocks), g_sortCell));
+            e->column = tx;
+        }
+        cell_run_add(e->run, x, z);
+        return;
+    }
+    fprintf(e->out, "%s->(%d,%d)reg(%d,%d)\n", e->hdr->label, x, z,
+        ts_block_to_region(e->hdr, x), ts_block_to_region(e->hdr, z));
+}
+
+// Writes the stored structures of the given region area as text lines
+static uint64_t export_store_area(const char *storePath, const char *outPath, SfRect area)
+{
+    TsReader r;
+    if (ts_open_read(&r, storePath) != 0)
+        return 0;
+    FILE *out = fopen(outPath, "w");
+    if (!out)
+    {
+        fprintf(stderr, "Warning: could not create %s\n", outPath);
+        ts_close_read(&r);
+        return 0;
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+    int64_t b = r.hdr->regionBlocks;
+    CellRun run;
+    ExportCtx e = { out, r.hdr, NULL, -1 };
+    if (g_sortCell > 0)
+    {
+        cell_run_start(&run, out, r.hdr->label, r.hdr->regionBlocks);
+        e.run = &run;
+    }
+    uint64_t n = ts_query(&r, (int32_t)(area.x0 * b), (int32_t)(area.z0 * b),
+        (int32_t)(area.x1 * b - 1), (int32_t)(area.z1 * b - 1), export_hit, &e);
+    if (e.run)
+        cell_run_finish(&run);
+
+    fclose(out);
+    ts_close_read(&r);
+    return n;
+}
+
+// Picks the built-in position formula that reproduces getStructurePos for
+// this type, so bitmap readers without cubiomes can regenerate positions
+static int bitmap_pos_kind(RbHeader *h)
+{
+    uint64_t s48 = (uint64_t)h->seed & MASK48;
+    for (int kind = RB_POS_FEATURE; kind <= RB_POS_LARGE; kind++)
+    {
+        h->posKind = kind;
+        int checked = 0, ok = 1;
+        for (int p = 0; p < 256 && ok; p++)
+        {
+            int rx = -50000 + p * 389;
+            int rz = 45000 - p * 353;
+            Pos pos;
+            if (!getStructurePos(h->type, h->mc, s48, rx, rz, &pos))
+                continue;
+            int32_t x, z;
+            ok = rb_builtin_pos(h, rx, rz, &x, &z) && x == pos.x && z == pos.z;
+            checked++;
+        }
+        if (ok && checked > 0)
+            return kind;
+    }
+    return RB_POS_CUBIOMES;
+}
+
+// Sets the bits of every stored structure inside the region area
+static uint64_t export_store_bitmap(const char *storePath, RegionBitmap *rb, SfRect area)
+{
+    TsReader r;
+    if (ts_open_read(&r, storePath) != 0)
+        return 0;
+    uint8_t *bits = malloc(RB_TILE_BYTES);
+    if (!bits)
+    {
+        ts_close_read(&r);
+        return 0;
+    }
+
+    uint64_t n = 0;
+    int tx0 = ts_region_to_tile(area.x0), tx1 = ts_region_to_tile(area.x1 - 1);
+    int tz0 = ts_region_to_tile(area.z0), tz1 = ts_region_to_tile(area.z1 - 1);
+    for (int tx = tx0; tx <= tx1; tx++)
+    {
+        for (int tz = tz0; tz <= tz1; tz++)
+        {
+            const TsTileEntry *e = &r.dir[(size_t)tx * TS_TILES_AXIS + tz];
+            if (e->offset == 0 || e->count == 0)
+                continue;
+            SfRect t = sf_tile_rect(tx * TS_TILES_AXIS + tz);
+            const TsRecord *rec = (const TsRecord *)(r.base + e->offset);
+            memset(bits, 0, RB_TILE_BYTES);
+            for (uint32_t k = 0; k < e->count; k++)
+            {
+                int rx = ts_block_to_region(r.hdr, rec[k].x);
+                int rz = ts_block_to_region(r.hdr, rec[k].z);
+                if (!sf_rect_has(area, rx, rz))
+                    continue;
+                rb_set(bits, rx - t.x0, rz - t.z0);
+                n++;
+            }
+            rb_put_tile(rb, tx, tz, bits);
+        }
+    }
+
+    free(bits);
+    ts_close_read(&r);
+    return n;
+}
+
+// Converts seed text the way the game does: numbers are used as they are,
+// anything else goes through Java's String.hashCode(). Returns 1 if the
+// text was hashed.
+static int parse_seed(const char *text, int64_t *seed)
+{
+    const char *p = text;
+    if (*p == '-') p++;  // allow negative sign
+    int isNumeric = *p != '\0';
+    for (; *p; p++)
+    {
+        if (*p < '0' || *p > '9')
+        {
+            isNumeric = 0;
+            break;
+        }
+    }
+    if (isNumeric)
+    {
+        *seed = strtoll(text, NULL, 10);
+        return 0;
+    }
+    int32_t hash = 0;
+    for (p = text; *p; p++)
+        hash = (int32_t)((uint32_t)hash * 31u + (unsigned char)*p);
+    *seed = (int64_t)hash;
+    return 1;
+}
+
+// Region size in blocks of a structure type
+static int region_blocks(int type, int mc)
+{
+    StructureConfig sconf;
+    return getStructureConfig(type, mc, &sconf) ? sconf.regionSize * 16 : 512;
+}
+
+// Removes old temp directories and creates a new one named after the time
+static void make_temp_dir(char *dir, size_t n)
+{
+    system("rm -rf tmp*");
+    time_t t = time(NULL);
+    struct tm tm = *localtime(&t);
+    snprintf(dir, n, "tmp_%d%02d%02d%02d%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min);
+    mkdir(dir, 0777);
+    printf("Created tmp directory: %s\n", dir);
+}
+
+// Whether dir lies inside an entry of the working directory named tmp*,
+// which make_temp_dir deletes
+static int cleared_by_temp_dir(const char *dir)
+{
+    char cwd[PATH_MAX], path[2 * PATH_MAX], head[2 * PATH_MAX], real[PATH_MAX];
+    char full[3 * PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)))
+        return strncmp(dir, "tmp", 3) == 0;
+    if (dir[0] == '/')
+        snprintf(path, sizeof(path), "%s", dir);
+    else
+        snprintf(path, sizeof(path), "%s/%s", cwd, dir);
+
+    // Resolve the longest part that exists, so "./", ".." and symlinks
+    // compare like getcwd's path; the rest is taken as written
+    size_t keep = strlen(path);
+    memcpy(head, path, keep + 1);
+    while (!realpath(head, real))
+    {
+        char *slash = strrchr(head, '/');
+        if (!slash)
+            return 0;
+        if (slash == head)
+            slash++;
+        *slash = '\0';
+        keep = (size_t)(slash - head);
+    }
+    snprintf(full, sizeof(full), "%s%s", real, path + keep);
+
+    size_t n = strcmp(cwd, "/") == 0 ? 0 : strlen(cwd);
+    const char *p = full + n;
+    if (strncmp(full, cwd, n) != 0 || *p != '/')
+        return 0;
+    while (*p == '/' || (p[0] == '.' && p[1] == '/'))
+        p++;
+    return strncmp(p, "tmp", 3) == 0;
+}
+
+// Batch mode ---------------------------------------------------------------
+//
+// Many seeds run on the scan engine (sfscan.c), which shares one thread
+// pool between them. Hits arrive per (seed, tile) unit and are appended to
+// the seed's text file; a finished seed gets its row in the summary.
+
+typedef struct
 {
-    // log with date before message
-    time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
-    printf("[%d-%02d-%02d %02d:%02d:%02d] %s\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, msg);
-}
+    int64_t seed;
+    char input[64];         // the line of the seed file
+    pthread_mutex_t lock;   // guards fp and counts
+    FILE *fp;
+    uint64_t counts[32];
+} BatchSeed;
 
-static int get_structure_dim(int type)
+typedef struct
+{
+    BatchSeed *seeds;
+    int seedCount;
+    int typeCount;
+    const char **labels;
+    const char *outDir;
+    FILE *summary;
+    pthread_mutex_t summaryLock;
+    uint64_t totals[32];        // under summaryLock
+} BatchJob;
+
+static void csv_string(FILE *f, const char *s)
 {
-    switch (type)
+    fputc('"', f);
+    for (; *s; s++)
     {
-        case Fortress:
-        case Bastion:
-        case Ruined_Portal_N:
-            return DIM_NETHER;
-        case End_City:
-            return DIM_END;
-        default:
-            return DIM_OVERWORLD;
+        if (*s == '"')
+            fputc('"', f);
+        fputc(*s, f);
     }
+    fputc('"', f);
 }
 
-void *threadFunc(void *arg)
+// Formats one unit's hits and appends them to the seed's file
+static void batch_hits(void *user, const SfUnit *unit, const SfHit *hits, size_t count)
 {
-    ThreadArgs *args = (ThreadArgs *)arg;
+    static _Thread_local char *buf;
+    static _Thread_local size_t cap;
+    BatchJob *job = (BatchJob *)user;
+    BatchSeed *s = &job->seeds[unit->seedIndex];
+    size_t len = 0;
+    uint64_t counts[32] = {0};
+    for (size_t k = 0; k < count; k++)
+    {
+        if (cap - len < 128)
+        {
+            size_t ncap = cap ? cap * 2 : 1 << 16;
+            char *p = realloc(buf, ncap);
+            if (!p)
+            {
+                fprintf(stderr, "\nOut of memory buffering batch hits\n");
+                exit(1);
+            }
+            buf = p;
+            cap = ncap;
+        }
+        const SfHit *h = &hits[k];
+        len += (size_t)snprintf(buf + len, cap - len, "%s->(%d,%d)reg(%d,%d)\n",
+            job->labels[h->type], h->x, h->z, h->rx, h->rz);
+        counts[h->type]++;
+    }
 
-    int64_t seed = args->seed;
-    uint64_t s48 = (uint64_t)seed & MASK48;
-    int mc = args->mcVersion;
-    Generator g;
+    pthread_mutex_lock(&s->lock);
+    if (!s->fp)
+    {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%" PRId64 ".txt", job->outDir, s->seed);
+        if ((s->fp = fopen(path, "w")))
+            setvbuf(s->fp, NULL, _IOFBF, 1 << 20);
+        else
+            fprintf(stderr, "\nWarning: could not create %s\n", path);
+    }
+    if (s->fp)
+        fwrite(buf, 1, len, s->fp);
+    for (int i = 0; i < job->typeCount; i++)
+        s->counts[i] += counts[i];
+    pthread_mutex_unlock(&s->lock);
+}
 
-    setupGenerator(&g, mc, 0);
+// Closes a finished seed and adds its row to the summary
+static void batch_seed_done(void *user, int seedIndex, double secs)
+{
+    BatchJob *job = (BatchJob *)user;
+    BatchSeed *s = &job->seeds[seedIndex];
+    if (!s->fp)
+    {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%" PRId64 ".txt", job->outDir, s->seed);
+        s->fp = fopen(path, "w");
+    }
+    if (s->fp)
+        fclose(s->fp);
+    s->fp = NULL;
 
-    FILE *files[32] = {0};
-    for (int i = 0; i < args->selectedCount; i++)
+    pthread_mutex_lock(&job->summaryLock);
+    fprintf(job->summary, "%" PRId64 ",", s->seed);
+    csv_string(job->summary, s->input);
+    for (int i = 0; i < job->typeCount; i++)
     {
-        char filename[256];
-        snprintf(filename, sizeof(filename), "%s/%s_%03d.txt",
-            args->tempDir, args->selectedPrefixes[i], args->numThread);
-        files[i] = fopen(filename, "w");
-        if (files[i])
-            setvbuf(files[i], NULL, _IOFBF, 1 << 20);
-        args->flushCounters[i] = 0u;
+        fprintf(job->summary, ",%llu", (unsigned long long)s->counts[i]);
+        job->totals[i] += s->counts[i];
     }
+    fprintf(job->summary, ",%.3f\n", secs);
+    pthread_mutex_unlock(&job->summaryLock);
+}
+
+typedef struct
+{
+    int64_t seed;
+    int index;      // line order in the seed file
+} SeedLine;
+
+static int compare_seed_line(const void *a, const void *b)
+{
+    const SeedLine *la = (const SeedLine *)a;
+    const SeedLine *lb = (const SeedLine *)b;
+    if (la->seed != lb->seed) return la->seed < lb->seed ? -1 : 1;
+    return la->index - lb->index;
+}
 
-    // Pre-group selected structures by dimension so applySeed is called
-    // at most once per dimension per region instead of once per structure.
-    static const int dimOrder[3] = { DIM_OVERWORLD, DIM_NETHER, DIM_END };
-    int dimStructIdx[3][32];
-    int dimStructCount[3] = {0, 0, 0};
-    for (int i = 0; i < args->selectedCount; i++)
+// Reads the seed file: one seed per line, numeric or string; blank lines
+// and lines starting with '#' are skipped, and so is a seed that an
+// earlier line already gave
+static BatchSeed *read_seed_file(const char *path, int *count)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
     {
-        int dim = get_structure_dim(args->selectedTypes[i]);
-        for (int d = 0; d < 3; d++)
+        fprintf(stderr, "Error: cannot open seed file %s\n", path);
+        return NULL;
+    }
+    int cap = 1024, n = 0;
+    BatchSeed *seeds = malloc((size_t)cap * sizeof(BatchSeed));
+    char line[256];
+    while (seeds && fgets(line, sizeof(line), f))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+        if (n == cap)
         {
-            if (dimOrder[d] == dim)
+            cap *= 2;
+            BatchSeed *p = realloc(seeds, (size_t)cap * sizeof(BatchSeed));
+            if (!p)
             {
-                dimStructIdx[d][dimStructCount[d]++] = i;
+                free(seeds);
+                seeds = NULL;
                 break;
             }
+            seeds = p;
         }
+        BatchSeed *s = &seeds[n++];
+        memset(s, 0, sizeof(*s));
+        parse_seed(line, &s->seed);
+        snprintf(s->input, sizeof(s->input), "%.63s", line);
+    }
+    fclose(f);
+    if (!seeds)
+    {
+        fprintf(stderr, "Error: out of memory reading %s\n", path);
+        *count = 0;
+        return NULL;
     }
 
-    // Thread-local accumulators to avoid locking the global mutex every region
-    uint64_t localProcessed = 0;
-    int localIncs[32] = {0};
+    // Each seed's hits go to <seed>.txt, so a seed listed twice, or two
+    // strings that hash to the same seed, would share a file: keep the
+    // first line that names a seed and skip the rest
+    SeedLine *order = malloc((size_t)(n > 0 ? n : 1) * sizeof(SeedLine));
+    if (!order)
+    {
+        fprintf(stderr, "Error: out of memory reading %s\n", path);
+        free(seeds);
+        *count = 0;
+        return NULL;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        order[i].seed = seeds[i].seed;
+        order[i].index = i;
+    }
+    qsort(order, (size_t)n, sizeof(SeedLine), compare_seed_line);
+    for (int i = 1; i < n; i++)
+    {
+        if (order[i].seed != order[i - 1].seed)
+            continue;
+        BatchSeed *first = &seeds[order[i - 1].index];
+        BatchSeed *again = &seeds[order[i].index];
+        fprintf(stderr, "Warning: seed %" PRId64 " from '%s' repeats '%s', skipped\n",
+            again->seed, again->input, first->input);
+        order[i].index = order[i - 1].index;
+        again->input[0] = '\0';    // marks the line as dropped
+    }
+    free(order);
 
-    // Flat nested loop replaces the recursive scanTile (which had no
-    // intermediate filtering and only added call overhead).
-    for (int rx = args->startRegionX; rx < args->endRegionX; rx++)
+    int kept = 0;
+    for (int i = 0; i < n; i++)
     {
-        for (int rz = args->startRegionZ; rz < args->endRegionZ; rz++)
-        {
-            for (int d = 0; d < 3; d++)
-            {
-                if (dimStructCount[d] == 0)
-                    continue;
-                int applied = 0;
-                for (int k = 0; k < dimStructCount[d]; k++)
-                {
-                    int i = dimStructIdx[d][k];
-                    int type = args->selectedTypes[i];
+        if (seeds[i].input[0] == '\0')
+            continue;
+        seeds[kept] = seeds[i];
+        pthread_mutex_init(&seeds[kept].lock, NULL);
+        kept++;
+    }
+    *count = kept;
+    return seeds;
+}
 
-                    // Fast math-only rejection before expensive biome check
-                    Pos pos;
-                    if (!getStructurePos(type, mc, s48, rx, rz, &pos))
-                        continue;
+static int run_batch(const char *seedFile, SfScanConfig *cfg, const char **labels)
+{
+    BatchJob job;
+    memset(&job, 0, sizeof(job));
+    job.seeds = read_seed_file(seedFile, &job.seedCount);
+    if (!job.seeds)
+        return 1;
+    if (job.seedCount == 0)
+    {
+        fprintf(stderr, "Error: no seeds in %s\n", seedFile);
+        free(job.seeds);
+        return 1;
+    }
+    int64_t *seedList = malloc((size_t)job.seedCount * sizeof(int64_t));
+    if (!seedList)
+    {
+        fprintf(stderr, "Failed to allocate seed list\n");
+        free(job.seeds);
+        return 1;
+    }
+    for (int i = 0; i < job.seedCount; i++)
+        seedList[i] = job.seeds[i].seed;
 
-                    // Lazy applySeed: only when at least one structure
-                    // passes the position check in this dimension group
-                    if (!applied)
-                    {
-                        applySeed(&g, dimOrder[d], s48);
-                        applied = 1;
-                    }
-                    if (!isViableStructurePos(type, &g, pos.x, pos.z, 0))
-                        continue;
-
-                    fprintf(files[i], "%s->(%d,%d)reg(%d,%d)\n",
-                        args->selectedLabels[i], pos.x, pos.z, rx, rz);
-                    args->flushCounters[i]++;
-                    if ((args->flushCounters[i] & 2047u) == 0u)
-                        fflush(files[i]);
-                    localIncs[i]++;
-                }
-            }
+    char tempDir[64];
+    make_temp_dir(tempDir, sizeof(tempDir));
+    char outDir[128], summaryPath[128];
+    snprintf(outDir, sizeof(outDir), "%s/seeds", tempDir);
+    mkdir(outDir, 0777);
+    snprintf(summaryPath, sizeof(summaryPath), "%s/batch_summary.csv", tempDir);
 
-            localProcessed++;
-            if ((localProcessed & 4095u) == 0u)
-            {
-                progress_add_multi(localProcessed, localIncs,
-                    args->selectedCount);
-                localProcessed = 0;
-                memset(localIncs, 0, sizeof(localIncs));
-            }
-        }
+    job.typeCount = cfg->typeCount;
+    job.labels = labels;
+    job.outDir = outDir;
+    pthread_mutex_init(&job.summaryLock, NULL);
+    job.summary = fopen(summaryPath, "w");
+    if (!job.summary)
+    {
+        fprintf(stderr, "Error: cannot create %s\n", summaryPath);
+        free(seedList);
+        free(job.seeds);
+        return 1;
     }
+    fprintf(job.summary, "seed,input");
+    for (int i = 0; i < cfg->typeCount; i++)
+        fprintf(job.summary, ",%s", labels[i]);
+    fprintf(job.summary, ",seconds\n");
 
-    // Flush remaining accumulated progress
-    if (localProcessed > 0)
-        progress_add_multi(localProcessed, localIncs, args->selectedCount);
+    cfg->seeds = seedList;
+    cfg->seedCount = job.seedCount;
+    cfg->onHits = batch_hits;
+    cfg->onSeedDone = batch_seed_done;
+    cfg->user = &job;
+    SfScan *scan = sf_scan_start(cfg);
+    if (!scan)
+    {
+        fclose(job.summary);
+        free(seedList);
+        free(job.seeds);
+        return 1;
+    }
+    printf("Batch: %d seeds on %d threads\n", job.seedCount, cfg->threads);
 
-    for (int i = 0; i < args->selectedCount; i++)
+    SfScanProgress p;
+    for (;;)
     {
-        if (files[i]) fflush(files[i]);
-        if (files[i]) fclose(files[i]);
+        int finished = sf_scan_progress(scan, &p);
+        double rps = p.seconds > 0 ? p.regionsDone / p.seconds : 0.0;
+        double eta = rps > 0 ? (p.regionsTotal - p.regionsDone) / rps : 0.0;
+        int th, tm, ts;
+        humanize_time(eta, &th, &tm, &ts);
+        printf("\rETA: %02dh%02dm%02ds | Reg/s: %.2f | Progress: %6.2f%% | seeds: %d/%d",
+            th, tm, ts, rps, p.regionsTotal ? 100.0 * p.regionsDone / p.regionsTotal : 100.0,
+            p.seedsDone, job.seedCount);
+        fflush(stdout);
+        if (finished)
+            break;
+        usleep(200000);
     }
+    printf("\n");
+    int failed = sf_scan_wait(scan) == 2;
+    fclose(job.summary);
 
-    return NULL;
+    printf("Batch finished: %d seeds in %.1fs (%.2f seeds/s)\n", p.seedsDone, p.seconds,
+        p.seconds > 0 ? p.seedsDone / p.seconds : 0.0);
+    for (int i = 0; i < cfg->typeCount; i++)
+        printf("  %s: %llu total, %.1f per seed\n", labels[i],
+            (unsigned long long)job.totals[i], (double)job.totals[i] / job.seedCount);
+    printf("Per-seed output: %s/<seed>.txt\n", outDir);
+    printf("Summary: %s\n", summaryPath);
+
+    for (int s = 0; s < job.seedCount; s++)
+        pthread_mutex_destroy(&job.seeds[s].lock);
+    free(seedList);
+    free(job.seeds);
+    if (failed)
+    {
+        fprintf(stderr, "Error: the batch stopped early; seeds without a summary row are incomplete\n");
+        return 1;
+    }
+    return 0;
 }
 
 int main()
 {
 
-    int regionsAxis = 117188;
-    int maxRegion = 58594;
-    int minRegion = -maxRegion;
-
     // Input for number of threads
-    int numThreads;
+    int numThreads = 1;
     printf("Enter the number of threads: ");
-    scanf("%d", &numThreads);
+    if (scanf("%d", &numThreads) != 1 || numThreads < 1)
+        numThreads = 1;
     // Drain leftover newline from scanf
     {
         int ch;
         while ((ch = getchar()) != '\n' && ch != EOF) {}
     }
 
-    int64_t seed;
-    printf("Enter seed (number or string): ");
+    int64_t seed = 0;
+    printf("Enter seed (number or string, or @file for a batch of seeds): ");
     char seedInput[256];
+    const char *seedFile = NULL;
     if (fgets(seedInput, sizeof(seedInput), stdin))
     {
-        // Remove trailing newline
-        size_t len = strlen(seedInput);
-        if (len > 0 && seedInput[len - 1] == '\n')
-            seedInput[--len] = '\0';
-        
-        // Check if input is purely numeric (with optional leading minus)
-        int isNumeric = 1;
-        char *p = seedInput;
-        if (*p == '-') p++;  // allow negative sign
-        if (*p == '\0') isNumeric = 0;  // empty or just "-"
-        while (*p)
-        {
-            if (*p < '0' || *p > '9')
-            {
-                isNumeric = 0;
-                break;
-            }
-            p++;
-        }
-        
-        if (isNumeric)
-        {
-            // Parse as number directly
-            seed = strtoll(seedInput, NULL, 10);
-        }
-        else
-        {
-            // Convert string to seed using Java's String.hashCode()
-            int32_t hash = 0;
-            for (size_t i = 0; i < len; i++)
-            {
-                hash = hash * 31 + (int32_t)(unsigned char)seedInput[i];
-            }
-            seed = (int64_t)hash;
+        seedInput[strcspn(seedInput, "\r\n")] = '\0';
+        if (seedInput[0] == '@')
+            seedFile = seedInput + 1;
+        else if (parse_seed(seedInput, &seed))
             printf("String '%s' converted to seed: %" PRId64 "\n", seedInput, seed);
-        }
-    }
-    else
-    {
-        seed = 0;
     }
 
     // Select Minecraft version
@@ -498,8 +1769,93 @@ int main()
         }
     }
 
+    // Scan area: a square around 0,0, or the whole world
+    int64_t scanRadius = 0;
+    {
+        printf("Scan radius around 0,0 in blocks (blank = whole world): ");
+        fflush(stdout);
+        char rbuf[64];
+        if (fgets(rbuf, sizeof(rbuf), stdin))
+            scanRadius = strtoll(rbuf, NULL, 10);
+        if (scanRadius < 0)
+            scanRadius = 0;
+    }
+
+    // Batch mode: text output per seed, no stores, cache or biome maps
+    if (seedFile)
+    {
+        SfScanConfig cfg;
+        sf_scan_defaults(&cfg);
+        const char *labels[32];
+        cfg.mc = mcVersion;
+        cfg.radius = scanRadius;
+        cfg.threads = numThreads;
+        for (int k = 0; k < chosenCount; k++)
+        {
+            cfg.types[cfg.typeCount++] = supported[chosenIdx[k]].type;
+            labels[k] = supported[chosenIdx[k]].label;
+        }
+        return run_batch(seedFile, &cfg, labels);
+    }
+
+    // Choose output sinks: plain text part files, tiled result stores, or both
+    int writeText = 1;
+    int writeStore = 0;
+    int writeBitmap = 0;
+    {
+        printf("Output format: 1) text files  2) tiled result store  3) both  4) region bitmap (default 1): ");
+        fflush(stdout);
+        char obuf[64];
+        if (fgets(obuf, sizeof(obuf), stdin))
+        {
+            int o = atoi(obuf);
+            if (o == 2) { writeText = 0; writeStore = 1; }
+            if (o == 3) { writeText = 1; writeStore = 1; }
+            if (o == 4) { writeText = 0; writeBitmap = 1; }
+        }
+    }
+
+    // Optional persistent cache of finished tiles, reused by later runs
+    char cacheDir[256] = "";
+    {
+        printf("Result cache directory (blank = no cache): ");
+        fflush(stdout);
+        if (fgets(cacheDir, sizeof(cacheDir), stdin))
+            cacheDir[strcspn(cacheDir, "\r\n")] = '\0';
+        else
+            cacheDir[0] = '\0';
+        if (cacheDir[0] && cleared_by_temp_dir(cacheDir))
+        {
+            fprintf(stderr, "Error: cache directory must not be inside a tmp* entry of the working directory (cleared on start)\n");
+            return 1;
+        }
+    }
+    int useCache = cacheDir[0] != '\0';
+
+    // Optional coarse biome map used to skip positions that cannot be
+    // viable; kept in the cache directory so later runs reuse it
+    int biomeScale = 0;
+    {
+        printf("Coarse biome map for pruning, scale 16 or 64 (blank = off): ");
+        fflush(stdout);
+        char bbuf[64];
+        if (fgets(bbuf, sizeof(bbuf), stdin))
+            biomeScale = atoi(bbuf);
+        if (biomeScale != 0 && biomeScale != 16 && biomeScale != 64)
+        {
+            printf("Unsupported biome map scale %d, pruning disabled\n", biomeScale);
+            biomeScale = 0;
+        }
+        if (biomeScale > 0 && scanRadius == 0)
+        {
+            printf("Biome map needs a scan radius, pruning disabled\n");
+            biomeScale = 0;
+        }
+    }
+
     // Ask whether to merge output files when done (recommended for groupfinder)
-    int mergeFiles = 1;
+    int mergeFiles = writeText;
+    if (writeText)
     {
         printf("Merge all output files into one when done? (recommended for groupfinder) [Y/n]: ");
         fflush(stdout);
@@ -511,99 +1867,464 @@ int main()
         }
     }
 
-    pthread_t threads[numThreads];
-    ThreadArgs threadArgs[numThreads];
+    // Optional cell-ordered text output that groupfinder can merge
+    // instead of sorting
+    if (writeText)
+    {
+        printf("Sort text output by cell for groupfinder (cell size in blocks, blank = unsorted): ");
+        fflush(stdout);
+        char sbuf[64];
+        if (fgets(sbuf, sizeof(sbuf), stdin))
+            g_sortCell = strtoll(sbuf, NULL, 10);
+        if (g_sortCell < 0)
+            g_sortCell = 0;
+    }
 
-    // remove old temp directories
-    system("rm -rf tmp*");
+    // Optional per-stage statistics, rewritten during the run and at exit
+    char statsPath[512] = "";
+    {
+        printf("Write stage statistics to JSON file (blank = off): ");
+        fflush(stdout);
+        if (fgets(statsPath, sizeof(statsPath), stdin))
+            statsPath[strcspn(statsPath, "\r\n")] = '\0';
+        else
+            statsPath[0] = '\0';
+    }
 
-    // create new temp directory with date
-    time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
+    // Optional Prometheus textfile for node_exporter, e.g.
+    // "/var/lib/node_exporter/textfile/sf.prom 15"
+    char promPath[512] = "";
+    int promInterval = 0;
+    {
+        printf("Write Prometheus metrics to file, optionally followed by interval in seconds (blank = off): ");
+        fflush(stdout);
+        char pbuf[600];
+        if (!fgets(pbuf, sizeof(pbuf), stdin) ||
+            !prom_parse_target(pbuf, promPath, sizeof(promPath), &promInterval))
+            promPath[0] = '\0';
+    }
+
+    // Optional timeline of per-thread activity for chrome://tracing
+    char tracePath[512] = "";
+    {
+        printf("Write Chrome trace to file (blank = off): ");
+        fflush(stdout);
+        if (fgets(tracePath, sizeof(tracePath), stdin))
+            tracePath[strcspn(tracePath, "\r\n")] = '\0';
+        else
+            tracePath[0] = '\0';
+        if (tracePath[0])
+        {
+            ct_enable();
+            ct_thread_name("main", -1);
+        }
+    }
+
+    // Optional time-series log, one row every few seconds
+    char seriesPath[512] = "";
+    int seriesInterval = 0;
+    {
+        printf("Write time-series log (CSV, or JSON lines for .jsonl), optionally followed by interval in seconds (blank = off): ");
+        fflush(stdout);
+        char lbuf[600];
+        if (fgets(lbuf, sizeof(lbuf), stdin) && sscanf(lbuf, "%511s %d", seriesPath, &seriesInterval) < 1)
+            seriesPath[0] = '\0';
+        if (seriesInterval <= 0)
+            seriesInterval = SF_SERIES_INTERVAL;
+    }
+
+    // Optional hardware counters (IPC, LLC and branch misses) per phase
+    PerfGroup mainPerf;
+    {
+        printf("Sample hardware performance counters per phase? [y/N]: ");
+        fflush(stdout);
+        char hbuf[64];
+        if (fgets(hbuf, sizeof(hbuf), stdin) && (hbuf[0] == 'y' || hbuf[0] == 'Y'))
+            pc_enable();
+        pc_open(&mainPerf);
+    }
+    PerfSample perfA, perfB;
+
+    ScanJob job;
+    memset(&job, 0, sizeof(job));
+
+    // Fresh temp directory named after the date
     char tempDir[64];
-    snprintf(tempDir, sizeof(tempDir), "tmp_%d%02d%02d%02d%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min);
-    mkdir(tempDir, 0777);
-    printf("Created tmp directory: %s\n", tempDir);
+    make_temp_dir(tempDir, sizeof(tempDir));
+
+    // Stores live in the cache directory when caching, else in the temp dir.
+    // Biome maps sit next to them; pruned (approximate) results get their
+    // own subdirectory so they never replace exact ones.
+    char seedDir[512];
+    char storeDir[600];
+    if (useCache)
+    {
+        mkdir(cacheDir, 0777);
+        snprintf(seedDir, sizeof(seedDir), "%s/%" PRId64 "_%s", cacheDir, seed, mc2str(mcVersion));
+        mkdir(seedDir, 0777);
+        if (biomeScale > 0)
+        {
+            snprintf(storeDir, sizeof(storeDir), "%s/pruned%d", seedDir, biomeScale);
+            mkdir(storeDir, 0777);
+        }
+        else
+        {
+            snprintf(storeDir, sizeof(storeDir), "%s", seedDir);
+        }
+    }
+    else
+    {
+        snprintf(seedDir, sizeof(seedDir), "%s", tempDir);
+        snprintf(storeDir, sizeof(storeDir), "%s", tempDir);
+    }
+
+    // One tile store per selected structure type
+    TileStore *stores[32] = {0};
+    int regionBlocks[32];
+    for (int k = 0; k < chosenCount; k++)
+    {
+        int sidx = chosenIdx[k];
+        regionBlocks[k] = region_blocks(supported[sidx].type, mcVersion);
+        if (!writeStore && !useCache)
+            continue;
+
+        TsHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.seed = seed;
+        hdr.mc = mcVersion;
+        hdr.type = supported[sidx].type;
+        hdr.regionBlocks = regionBlocks[k];
+        hdr.fingerprint = useCache ? cache_fingerprint(supported[sidx].type, mcVersion, seed, biomeScale) : 0;
+        snprintf(hdr.label, sizeof(hdr.label), "%s", supported[sidx].label);
+
+        char storePath[768];
+        snprintf(storePath, sizeof(storePath), "%s/%s.sfts", storeDir, supported[sidx].prefix);
+        if (useCache)
+        {
+            stores[k] = ts_open_append(storePath);
+            if (stores[k])
+            {
+                const TsHeader *h = ts_header(stores[k]);
+                if (h->seed != hdr.seed || h->mc != hdr.mc || h->type != hdr.type ||
+                    h->regionBlocks != hdr.regionBlocks || h->fingerprint != hdr.fingerprint)
+                {
+                    printf("Cache for %s is stale (fingerprint mismatch), rebuilding\n",
+                        supported[sidx].label);
+                    ts_close(stores[k]);
+                    stores[k] = NULL;
+                }
+                else
+                {
+                    printf("Using cached %s results: %llu structures\n", supported[sidx].label,
+                        (unsigned long long)h->recordCount);
+                }
+            }
+        }
+        if (!stores[k])
+            stores[k] = ts_create(storePath, &hdr);
+        if (!stores[k])
+            return 1;
+    }
+
+    // Regions of each type that touch the requested square
+    SfRect area[32];
+    job.tempDir = tempDir;
+    job.selectedCount = chosenCount;
+    for (int k = 0; k < chosenCount; k++)
+    {
+        int sidx = chosenIdx[k];
+        job.selectedLabels[k] = supported[sidx].label;
+        job.selectedPrefixes[k] = supported[sidx].prefix;
+        job.regionBlocks[k] = regionBlocks[k];
+        job.stores[k] = stores[k];
+        area[k] = sf_scan_area(scanRadius, regionBlocks[k]);
+        switch (sf_structure_dim(supported[sidx].type))
+        {
+            case DIM_NETHER: job.dimSlot[k] = 1; break;
+            case DIM_END: job.dimSlot[k] = 2; break;
+            default: job.dimSlot[k] = 0; break;
+        }
+    }
+    // With a cache, text output is assembled from the stores afterwards
+    job.writeText = writeText && !useCache;
+
+    // One region bitmap per type. Without a cache the threads fill them
+    // tile by tile; with a cache they are exported from the stores later.
+    RegionBitmap *bitmaps[32] = {0};
+    for (int k = 0; k < chosenCount && writeBitmap; k++)
+    {
+        int sidx = chosenIdx[k];
+        RbHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.seed = seed;
+        hdr.mc = mcVersion;
+        hdr.type = supported[sidx].type;
+        hdr.regionBlocks = regionBlocks[k];
+        StructureConfig sconf;
+        if (getStructureConfig(supported[sidx].type, mcVersion, &sconf))
+        {
+            hdr.salt = sconf.salt;
+            hdr.regionSize = sconf.regionSize;
+            hdr.chunkRange = sconf.chunkRange;
+            hdr.posKind = bitmap_pos_kind(&hdr);
+        }
+        if (hdr.posKind == RB_POS_CUBIOMES)
+            printf("Note: %s positions cannot be regenerated without cubiomes\n",
+                supported[sidx].label);
+        SfRect a = area[k];
+        hdr.areaX0 = a.x0;
+        hdr.areaZ0 = a.z0;
+        hdr.areaX1 = a.x1;
+        hdr.areaZ1 = a.z1;
+        snprintf(hdr.label, sizeof(hdr.label), "%s", supported[sidx].label);
+
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s.sfrb", tempDir, supported[sidx].prefix);
+        bitmaps[k] = rb_create(path, &hdr);
+        if (!bitmaps[k])
+            return 1;
+        if (!useCache)
+            job.bitmaps[k] = bitmaps[k];
+    }
+
+    // Build (or extend) the coarse biome map of every dimension in use so
+    // that it covers the scan area, then map it for the scan threads
+    BiomeMap *biomeMaps[3] = {0};
+    static uint8_t viable[32][256];
+    if (biomeScale > 0)
+    {
+        static const int dims[3] = { DIM_OVERWORLD, DIM_NETHER, DIM_END };
+        static const char *dimNames[3] = { "overworld", "nether", "end" };
+        int64_t margin = (int64_t)SF_BIOME_MARGIN * biomeScale;
+        for (int d = 0; d < 3; d++)
+        {
+            int64_t x0 = 0, z0 = 0, x1 = 0, z1 = 0;
+            int used = 0;
+            for (int k = 0; k < chosenCount; k++)
+            {
+                if (sf_structure_dim(supported[chosenIdx[k]].type) != dims[d])
+                    continue;
+                SfRect a = area[k];
+                int64_t b = regionBlocks[k];
+                if (!used || a.x0 * b < x0) x0 = a.x0 * b;
+                if (!used || a.z0 * b < z0) z0 = a.z0 * b;
+                if (!used || a.x1 * b > x1) x1 = a.x1 * b;
+                if (!used || a.z1 * b > z1) z1 = a.z1 * b;
+                used = 1;
+            }
+            if (!used)
+                continue;
+            x0 -= margin; z0 -= margin;
+            x1 += margin; z1 += margin;
+
+            uint64_t need = bm_tiles_for_rect(biomeScale, x0, z0, x1, z1);
+            if (need > SF_BIOME_MAX_TILES)
+            {
+                printf("Biome map for the %s would need %llu tiles, pruning disabled there\n",
+                    dimNames[d], (unsigned long long)need);
+                continue;
+            }
+
+            char mapPath[768];
+            snprintf(mapPath, sizeof(mapPath), "%s/biomes_%s_%d.sfbm", seedDir, dimNames[d], biomeScale);
+            struct timespec b0, b1;
+            clock_gettime(CLOCK_MONOTONIC, &b0);
+            uint64_t span = ct_begin();
+            int built = bm_build(mapPath, seed, (uint64_t)seed & MASK48, mcVersion, dims[d],
+                biomeScale, x0, z0, x1, z1, numThreads);
+            ct_end(span, "biome map", dims[d]);
+            clock_gettime(CLOCK_MONOTONIC, &b1);
+            if (built < 0 || !(biomeMaps[d] = bm_open(mapPath)))
+            {
+                fprintf(stderr, "Warning: biome map for the %s unavailable, checking live\n", dimNames[d]);
+                continue;
+            }
+            printf("Biome map %s (1:%d): %d new tiles in %.1fs, %llu total\n", dimNames[d],
+                biomeScale, built, (double)(b1.tv_sec - b0.tv_sec) + (b1.tv_nsec - b0.tv_nsec) / 1e9,
+                (unsigned long long)bm_header(biomeMaps[d])->dirCount);
+        }
 
-    // Initialize global progress and threads
+        // Unknown cells are treated as viable so they never cause a rejection
+        for (int k = 0; k < chosenCount; k++)
+        {
+            for (int id = 0; id < BM_NO_BIOME; id++)
+                viable[k][id] = (uint8_t)(isViableFeatureBiome(mcVersion,
+                    supported[chosenIdx[k]].type, id) != 0);
+            viable[k][BM_NO_BIOME] = 1;
+        }
+        for (int d = 0; d < 3; d++)
+            job.biomeMaps[d] = biomeMaps[d];
+        for (int k = 0; k < chosenCount; k++)
+            job.viable[k] = viable[k];
+    }
 
     // Initialize global progress
     memset(&g_progress, 0, sizeof(g_progress));
-    pthread_mutex_init(&g_progress.lock, NULL);
-    g_progress.totalRegions = (uint64_t)regionsAxis * (uint64_t)regionsAxis;
     g_progress.totalThreads = numThreads;
+    g_progress.slots = aligned_alloc(SF_CACHE_LINE, (size_t)numThreads * sizeof(ProgressSlot));
+    job.threads = calloc((size_t)numThreads, sizeof(ScanThread));
+    if (!g_progress.slots || !job.threads)
+    {
+        fprintf(stderr, "Failed to allocate progress counters\n");
+        return 1;
+    }
+    memset(g_progress.slots, 0, (size_t)numThreads * sizeof(ProgressSlot));
     // set selected structures for progress display
     g_progress.selectedCount = (chosenCount <= 32) ? chosenCount : 32;
     for (int i = 0; i < g_progress.selectedCount; i++)
     {
         int sidx = chosenIdx[i];
         g_progress.selectedLabels[i] = supported[sidx].label;
-        g_progress.selectedCounts[i] = 0ULL;
     }
+    g_progress.statsPath = statsPath[0] ? statsPath : NULL;
+    g_progress.promPath = promPath[0] ? promPath : NULL;
+    g_progress.promInterval = promInterval;
+    g_progress.seed = seed;
+    g_progress.mc = mcVersion;
+    job.timed = g_progress.statsPath != NULL;
+
+    // The engine plans the tiles that still have work (cached tiles drop
+    // out there) and runs them through the hooks above
+    SfScanConfig cfg;
+    sf_scan_defaults(&cfg);
+    cfg.seeds = &seed;
+    cfg.seedCount = 1;
+    cfg.mc = mcVersion;
+    for (int k = 0; k < chosenCount; k++)
+        cfg.types[cfg.typeCount++] = supported[chosenIdx[k]].type;
+    cfg.radius = scanRadius;
+    cfg.threads = numThreads;
+    cfg.timed = job.timed;
+    cfg.onHits = scan_hits;
+    cfg.onPlan = scan_plan;
+    if (biomeMaps[0] || biomeMaps[1] || biomeMaps[2])
+        cfg.onFilter = scan_filter;
+    cfg.onUnitDone = scan_unit_done;
+    cfg.onThreadStart = scan_thread_start;
+    cfg.onThreadEnd = scan_thread_end;
+    cfg.onCounters = scan_counters;
+    if (pc_enabled())
+    {
+        cfg.onViableStart = scan_viable_start;
+        cfg.onViableEnd = scan_viable_end;
+    }
+    cfg.user = &job;
+
     clock_gettime(CLOCK_MONOTONIC, &g_progress.startTime);
+    g_progress.startTicks = sf_ticks();
+    uint64_t scanSpan = ct_begin();
+    g_progress.scan = sf_scan_start(&cfg);
+    if (!g_progress.scan)
+        return 1;
+    SfScanProgress sp;
+    sf_scan_progress(g_progress.scan, &sp);
+    g_progress.totalRegions = sp.regionsTotal;
+    if (useCache)
+        printf("Tiles to compute: %llu (%llu regions)\n", (unsigned long long)sp.unitsTotal,
+            (unsigned long long)sp.regionsTotal);
+
+    if (seriesPath[0])
+    {
+        size_t n = strlen(seriesPath);
+        g_progress.seriesJsonl = n > 6 && strcmp(seriesPath + n - 6, ".jsonl") == 0;
+        g_progress.seriesInterval = seriesInterval;
+        if ((g_progress.series = fopen(seriesPath, "w")))
+            write_series_header();
+        else
+            fprintf(stderr, "Warning: could not create time-series log %s\n", seriesPath);
+    }
 
+    // The progress thread returns once the engine reports every scan
+    // thread stopped
     pthread_t progThread;
     pthread_create(&progThread, NULL, progressThread, NULL);
+    pthread_join(progThread, NULL);
+    ct_end(scanSpan, "scan", numThreads);
+    if (g_progress.statsPath)
+    {
+        write_stats_json(g_progress.statsPath, 1);
+        printf("Wrote stage statistics: %s\n", g_progress.statsPath);
+    }
+    if (g_progress.promPath)
+        write_prom_metrics(g_progress.promPath);
+    if (g_progress.series)
+    {
+        fclose(g_progress.series);
+        printf("Wrote time-series log: %s\n", seriesPath);
+    }
+    int scanFailed = sf_scan_wait(g_progress.scan) == 2;
+    g_progress.scan = NULL;
+    free(g_progress.slots);
+    free(job.threads);
+    for (int d = 0; d < 3; d++)
+        bm_close(biomeMaps[d]);
 
-    // Divide the map area along the X-axis among threads
-    int regionsPerThreadX = regionsAxis / numThreads;
-    int startRegionX = minRegion;
-
-    for (int i = 0; i < numThreads; i++)
+    uint64_t finishSpan = ct_begin();
+    for (int k = 0; k < chosenCount; k++)
     {
+        if (!stores[k])
+            continue;
+        if (ts_close(stores[k]) != 0)
+            fprintf(stderr, "Warning: failed to finalise %s store\n",
+                supported[chosenIdx[k]].label);
+        else
+            printf("Wrote tile store: %s/%s.sfts\n", storeDir, supported[chosenIdx[k]].prefix);
+    }
 
-        threadArgs[i].numThread = i;
-        threadArgs[i].tempDir = tempDir;
-        threadArgs[i].seed = seed;
-        threadArgs[i].totalThreads = numThreads;
-        // selected structures
-        threadArgs[i].selectedCount = chosenCount;
-        for (int k = 0; k < chosenCount; k++)
+    for (int k = 0; k < chosenCount; k++)
+    {
+        if (!bitmaps[k])
+            continue;
+        int sidx = chosenIdx[k];
+        if (useCache)
         {
-            int sidx = chosenIdx[k];
-            threadArgs[i].selectedTypes[k] = supported[sidx].type;
-            threadArgs[i].selectedLabels[k] = supported[sidx].label;
-            threadArgs[i].selectedPrefixes[k] = supported[sidx].prefix;
+            char storePath[768];
+            snprintf(storePath, sizeof(storePath), "%s/%s.sfts", storeDir, supported[sidx].prefix);
+            export_store_bitmap(storePath, bitmaps[k], area[k]);
         }
+        if (rb_close(bitmaps[k]) != 0)
+            fprintf(stderr, "Warning: failed to finalise %s bitmap\n", supported[sidx].label);
+        else
+            printf("Wrote region bitmap: %s/%s.sfrb\n", tempDir, supported[sidx].prefix);
+    }
 
-        // Set chosen MC version
-        threadArgs[i].mcVersion = mcVersion;
-
-        // Calculate end region for X-axis
-        int endRegionX = startRegionX + regionsPerThreadX;
-        if (i == numThreads - 1) // Last thread takes the remaining regions
-            endRegionX = maxRegion;
-
-        threadArgs[i].startRegionX = startRegionX;
-        threadArgs[i].endRegionX = endRegionX;
-        threadArgs[i].startRegionZ = minRegion; // Constant Z-axis
-        threadArgs[i].endRegionZ = maxRegion;   // Constant Z-axis
-
-        // Update start region for next thread
-        startRegionX = endRegionX;
+    ct_end(finishSpan, "finalise outputs", chosenCount);
 
-        // Create thread
-        pthread_create(&threads[i], NULL, threadFunc, (void *)&threadArgs[i]);
-    }
+    // The stores keep the tiles that finished, but the text output of a
+    // failed scan would be missing structures
+    if (scanFailed)
+        mergeFiles = 0;
 
-    // Wait for all threads to finish
-    for (int i = 0; i < numThreads; i++)
+    // Assemble the text output from cached and freshly computed tiles
+    if (useCache && writeText && !scanFailed)
     {
-        pthread_join(threads[i], NULL);
+        uint64_t assembled = 0;
+        pc_read(&mainPerf, &perfA);
+        for (int k = 0; k < chosenCount; k++)
+        {
+            int sidx = chosenIdx[k];
+            char storePath[768], outPath[256];
+            snprintf(storePath, sizeof(storePath), "%s/%s.sfts", storeDir, supported[sidx].prefix);
+            snprintf(outPath, sizeof(outPath), "%s/%s.txt", tempDir, supported[sidx].prefix);
+            uint64_t span = ct_begin();
+            uint64_t n = export_store_area(storePath, outPath, area[k]);
+            ct_end(span, "assemble", k);
+            printf("Assembled %llu %s structures into: %s\n", (unsigned long long)n,
+                supported[sidx].label, outPath);
+            assembled += n;
+        }
+        pc_read(&mainPerf, &perfB);
+        pc_phase_add("assemble", "structure", &perfA, &perfB, assembled);
     }
 
-    // Signal progress thread to finish and join
-    pthread_mutex_lock(&g_progress.lock);
-    g_progress.done = 1;
-    pthread_mutex_unlock(&g_progress.lock);
-    pthread_join(progThread, NULL);
-
     // Merge all per-thread output files into one file per structure type,
     // then combine everything into a single file for groupfinder
     if (mergeFiles)
     {
         char mergedPath[128];
         snprintf(mergedPath, sizeof(mergedPath), "%s/all_structures.txt", tempDir);
+        uint64_t mergeSpan = ct_begin();
+        pc_read(&mainPerf, &perfA);
         FILE *merged = fopen(mergedPath, "w");
         if (merged)
         {
@@ -612,13 +2333,21 @@ int main()
             for (int k = 0; k < chosenCount; k++)
             {
                 int sidx = chosenIdx[k];
-                for (int thr = 0; thr < numThreads; thr++)
+                int parts = useCache ? 1 : numThreads;
+                for (int thr = 0; thr < parts; thr++)
                 {
                     char fname[256];
-                    snprintf(fname, sizeof(fname), "%s/%s_%03d.txt",
-                        tempDir, supported[sidx].prefix, thr);
+                    if (useCache)
+                        snprintf(fname, sizeof(fname), "%s/%s.txt",
+                            tempDir, supported[sidx].prefix);
+                    else
+                        snprintf(fname, sizeof(fname), "%s/%s_%03d.txt",
+                            tempDir, supported[sidx].prefix, thr);
                     FILE *in = fopen(fname, "r");
                     if (!in) continue;
+                    uint64_t span = ct_begin();
+                    if (g_sortCell > 0)
+                        totalLines--;   // the "#sorted" header line
                     char buf[8192];
                     size_t n;
                     while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
@@ -628,9 +2357,13 @@ int main()
                             if (buf[b] == '\n') totalLines++;
                     }
                     fclose(in);
+                    ct_end(span, "merge file", thr);
                 }
             }
             fclose(merged);
+            ct_end(mergeSpan, "merge", chosenCount);
+            pc_read(&mainPerf, &perfB);
+            pc_phase_add("merge", "structure", &perfA, &perfB, totalLines);
             printf("Merged %llu structures into: %s\n",
                 (unsigned long long)totalLines, mergedPath);
         }
@@ -640,5 +2373,21 @@ int main()
         }
     }
 
+    pc_close(&mainPerf);
+    pc_report(stdout);
+
+    if (ct_on)
+    {
+        if (ct_write(tracePath) == 0)
+            printf("Wrote trace: %s\n", tracePath);
+        else
+            fprintf(stderr, "Warning: could not write trace to %s\n", tracePath);
+    }
+
+    if (scanFailed)
+    {
+        fprintf(stderr, "Error: the scan stopped early; its output is incomplete\n");
+        return 1;
+    }
     return 0;
 }
@@ -0,0 +1,422 @@
+#include "tilestore.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+struct TileStore
+{
+    FILE *fp;
+    TsHeader hdr;
+    TsTileEntry *dir;       // in-memory copy of the tile directory
+    uint64_t end;           // next free byte for a record block
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+#else
+    pthread_mutex_t lock;
+#endif
+};
+
+static int ts_seek(FILE *fp, uint64_t off)
+{
+#ifdef _WIN32
+    return _fseeki64(fp, (__int64)off, SEEK_SET);
+#else
+    return fseeko(fp, (off_t)off, SEEK_SET);
+#endif
+}
+
+static uint64_t ts_dir_bytes(void)
+{
+    return (uint64_t)TS_TILES_AXIS * TS_TILES_AXIS * sizeof(TsTileEntry);
+}
+
+static void ts_lock(TileStore *ts)
+{
+#ifdef _WIN32
+    EnterCriticalSection(&ts->lock);
+#else
+    pthread_mutex_lock(&ts->lock);
+#endif
+}
+
+static void ts_unlock(TileStore *ts)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(&ts->lock);
+#else
+    pthread_mutex_unlock(&ts->lock);
+#endif
+}
+
+static int ts_layout_ok(const TsHeader *h)
+{
+    return h->magic == TS_MAGIC && h->version == TS_FORMAT_VERSION &&
+        h->tileShift == TS_TILE_SHIFT && h->tilesAxis == TS_TILES_AXIS &&
+        h->minRegion == TS_MIN_REGION && h->regionBlocks > 0 &&
+        h->dirOffset == TS_HEADER_SIZE;
+}
+
+TileStore *ts_create(const char *path, const TsHeader *hdr)
+{
+    TileStore *ts = (TileStore *)calloc(1, sizeof(TileStore));
+    if (!ts)
+        return NULL;
+    ts->dir = (TsTileEntry *)calloc((size_t)TS_TILES_AXIS * TS_TILES_AXIS, sizeof(TsTileEntry));
+    if (!ts->dir)
+    {
+        free(ts);
+        return NULL;
+    }
+
+    ts->fp = fopen(path, "w+b");
+    if (!ts->fp)
+    {
+        fprintf(stderr, "Error: cannot create store %s\n", path);
+        free(ts->dir);
+        free(ts);
+        return NULL;
+    }
+    setvbuf(ts->fp, NULL, _IOFBF, 1 << 20);
+
+    ts->hdr = *hdr;
+    ts->hdr.magic = TS_MAGIC;
+    ts->hdr.version = TS_FORMAT_VERSION;
+    ts->hdr.tileShift = TS_TILE_SHIFT;
+    ts->hdr.minRegion = TS_MIN_REGION;
+    ts->hdr.tilesAxis = TS_TILES_AXIS;
+    ts->hdr.dirOffset = TS_HEADER_SIZE;
+    ts->hdr.recordCount = 0;
+    memset(ts->hdr.reserved, 0, sizeof(ts->hdr.reserved));
+
+    // Header placeholder followed by an all-empty directory
+    int ok = fwrite(&ts->hdr, sizeof(TsHeader), 1, ts->fp) == 1;
+    char zeros[65536];
+    memset(zeros, 0, sizeof(zeros));
+    uint64_t left = ts_dir_bytes();
+    while (ok && left > 0)
+    {
+        size_t n = left < sizeof(zeros) ? (size_t)left : sizeof(zeros);
+        ok = fwrite(zeros, 1, n, ts->fp) == n;
+        left -= n;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Error: cannot initialise store %s\n", path);
+        fclose(ts->fp);
+        free(ts->dir);
+        free(ts);
+        return NULL;
+    }
+    ts->end = TS_HEADER_SIZE + ts_dir_bytes();
+
+#ifdef _WIN32
+    InitializeCriticalSection(&ts->lock);
+#else
+    pthread_mutex_init(&ts->lock, NULL);
+#endif
+    return ts;
+}
+
+TileStore *ts_open_append(const char *path)
+{
+    FILE *fp = fopen(path, "r+b");
+    if (!fp)
+        return NULL;
+
+    TileStore *ts = (TileStore *)calloc(1, sizeof(TileStore));
+    if (ts)
+        ts->dir = (TsTileEntry *)malloc((size_t)ts_dir_bytes());
+    if (!ts || !ts->dir ||
+        fread(&ts->hdr, sizeof(TsHeader), 1, fp) != 1 || !ts_layout_ok(&ts->hdr) ||
+        fread(ts->dir, 1, (size_t)ts_dir_bytes(), fp) != ts_dir_bytes())
+    {
+        fclose(fp);
+        if (ts) free(ts->dir);
+        free(ts);
+        return NULL;
+    }
+
+#ifdef _WIN32
+    if (_fseeki64(fp, 0, SEEK_END) != 0)
+#else
+    if (fseeko(fp, 0, SEEK_END) != 0)
+#endif
+    {
+        fclose(fp);
+        free(ts->dir);
+        free(ts);
+        return NULL;
+    }
+#ifdef _WIN32
+    ts->end = (uint64_t)_ftelli64(fp);
+#else
+    ts->end = (uint64_t)ftello(fp);
+#endif
+    ts->fp = fp;
+    setvbuf(ts->fp, NULL, _IOFBF, 1 << 20);
+
+#ifdef _WIN32
+    InitializeCriticalSection(&ts->lock);
+#else
+    pthread_mutex_init(&ts->lock, NULL);
+#endif
+    return ts;
+}
+
+const TsHeader *ts_header(const TileStore *ts)
+{
+    return &ts->hdr;
+}
+
+const TsTileEntry *ts_tile_entry(const TileStore *ts, int tx, int tz)
+{
+    return &ts->dir[(size_t)tx * TS_TILES_AXIS + tz];
+}
+
+int ts_read_tile(TileStore *ts, const TsTileEntry *e, TsRecord *recs)
+{
+    if (e->count == 0)
+        return 0;
+    int err = 0;
+    ts_lock(ts);
+    if (ts_seek(ts->fp, e->offset) != 0 ||
+        fread(recs, sizeof(TsRecord), e->count, ts->fp) != e->count)
+        err = -1;
+    ts_unlock(ts);
+    return err;
+}
+
+int ts_put_tile(TileStore *ts, int tx, int tz, const TsRecord *recs,
+    uint32_t count, int rx0, int rz0, int rx1, int rz1)
+{
+    if (tx < 0 || tz < 0 || tx >= TS_TILES_AXIS || tz >= TS_TILES_AXIS)
+        return -1;
+
+    TsTileEntry e;
+    memset(&e, 0, sizeof(e));
+    e.count = count;
+    e.flags = TS_TILE_SCANNED;
+    e.rx0 = (uint16_t)rx0;
+    e.rz0 = (uint16_t)rz0;
+    e.rx1 = (uint16_t)rx1;
+    e.rz1 = (uint16_t)rz1;
+
+    uint64_t entryOff = ts->hdr.dirOffset +
+        ((uint64_t)tx * TS_TILES_AXIS + (uint64_t)tz) * sizeof(TsTileEntry);
+
+    int err = 0;
+    ts_lock(ts);
+    TsTileEntry *old = &ts->dir[(size_t)tx * TS_TILES_AXIS + tz];
+    if (count > 0)
+    {
+        e.offset = ts->end;
+        if (ts_seek(ts->fp, ts->end) != 0 ||
+            fwrite(recs, sizeof(TsRecord), count, ts->fp) != count)
+            err = -1;
+        else
+            ts->end += (uint64_t)count * sizeof(TsRecord);
+    }
+    if (!err)
+    {
+        if (ts_seek(ts->fp, entryOff) != 0 ||
+            fwrite(&e, sizeof(e), 1, ts->fp) != 1)
+            err = -1;
+        else
+        {
+            // A replaced block stays in the file but is no longer counted
+            ts->hdr.recordCount += count;
+            ts->hdr.recordCount -= old->count;
+            *old = e;
+        }
+    }
+    ts_unlock(ts);
+    return err;
+}
+
+int ts_close(TileStore *ts)
+{
+    if (!ts)
+        return -1;
+    int err = 0;
+    if (ts_seek(ts->fp, 0) != 0 ||
+        fwrite(&ts->hdr, sizeof(TsHeader), 1, ts->fp) != 1)
+        err = -1;
+    if (fclose(ts->fp) != 0)
+        err = -1;
+#ifdef _WIN32
+    DeleteCriticalSection(&ts->lock);
+#else
+    pthread_mutex_destroy(&ts->lock);
+#endif
+    free(ts->dir);
+    free(ts);
+    return err;
+}
+
+int ts_is_store(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return 0;
+    uint32_t magic = 0;
+    int ok = fread(&magic, sizeof(magic), 1, fp) == 1 && magic == TS_MAGIC;
+    fclose(fp);
+    return ok;
+}
+
+static int ts_validate(TsReader *r, const char *path)
+{
+    const TsHeader *h = (const TsHeader *)r->base;
+    if (r->size < TS_HEADER_SIZE || h->magic != TS_MAGIC)
+    {
+        fprintf(stderr, "Error: %s is not a tile store\n", path);
+        return -1;
+    }
+    if (!ts_layout_ok(h))
+    {
+        fprintf(stderr, "Error: %s has an unsupported store layout\n", path);
+        return -1;
+    }
+    if (TS_HEADER_SIZE + ts_dir_bytes() > r->size)
+    {
+        fprintf(stderr, "Error: %s is truncated\n", path);
+        return -1;
+    }
+    r->hdr = h;
+    r->dir = (const TsTileEntry *)(r->base + h->dirOffset);
+    return 0;
+}
+
+int ts_open_read(TsReader *r, const char *path)
+{
+    memset(r, 0, sizeof(*r));
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Error: cannot open store %s (error %lu)\n", path, GetLastError());
+        return -1;
+    }
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(hFile, &sz) || sz.QuadPart == 0)
+    {
+        fprintf(stderr, "Error: cannot size store %s\n", path);
+        CloseHandle(hFile);
+        return -1;
+    }
+    HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    void *data = hMapping ? MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!data)
+    {
+        fprintf(stderr, "Error: cannot map store %s (error %lu)\n", path, GetLastError());
+        if (hMapping) CloseHandle(hMapping);
+        CloseHandle(hFile);
+        return -1;
+    }
+    r->hFile = hFile;
+    r->hMapping = hMapping;
+    r->base = (const char *)data;
+    r->size = (uint64_t)sz.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Failed to open store");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        fprintf(stderr, "Error: cannot size store %s\n", path);
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        perror("Failed to mmap store");
+        close(fd);
+        return -1;
+    }
+    r->fd = fd;
+    r->base = (const char *)data;
+    r->size = (uint64_t)st.st_size;
+#endif
+    if (ts_validate(r, path) != 0)
+    {
+        ts_close_read(r);
+        return -1;
+    }
+    return 0;
+}
+
+void ts_close_read(TsReader *r)
+{
+    if (!r->base)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile((void *)r->base);
+    CloseHandle((HANDLE)r->hMapping);
+    CloseHandle((HANDLE)r->hFile);
+#else
+    munmap((void *)r->base, (size_t)r->size);
+    close(r->fd);
+#endif
+    memset(r, 0, sizeof(*r));
+}
+
+uint64_t ts_query(const TsReader *r, int32_t minX, int32_t minZ,
+    int32_t maxX, int32_t maxZ, TsVisitFn fn, void *ctx)
+{
+    const TsHeader *h = r->hdr;
+    if (minX > maxX || minZ > maxZ)
+        return 0;
+
+    // Widen by one region so positions sitting on a region edge are not
+    // missed, then clamp to the grid.
+    int rx0 = ts_block_to_region(h, minX) - 1 - TS_MIN_REGION;
+    int rx1 = ts_block_to_region(h, maxX) + 1 - TS_MIN_REGION;
+    int rz0 = ts_block_to_region(h, minZ) - 1 - TS_MIN_REGION;
+    int rz1 = ts_block_to_region(h, maxZ) + 1 - TS_MIN_REGION;
+    if (rx1 < 0 || rz1 < 0 || rx0 >= TS_REGIONS_AXIS || rz0 >= TS_REGIONS_AXIS)
+        return 0;
+    if (rx0 < 0) rx0 = 0;
+    if (rz0 < 0) rz0 = 0;
+    if (rx1 >= TS_REGIONS_AXIS) rx1 = TS_REGIONS_AXIS - 1;
+    if (rz1 >= TS_REGIONS_AXIS) rz1 = TS_REGIONS_AXIS - 1;
+
+    uint64_t hits = 0;
+    for (int tx = rx0 >> TS_TILE_SHIFT; tx <= (rx1 >> TS_TILE_SHIFT); tx++)
+    {
+        for (int tz = rz0 >> TS_TILE_SHIFT; tz <= (rz1 >> TS_TILE_SHIFT); tz++)
+        {
+            const TsTileEntry *e = &r->dir[(size_t)tx * TS_TILES_AXIS + tz];
+            if (e->offset == 0 || e->count == 0)
+                continue;
+            if (e->offset + (uint64_t)e->count * sizeof(TsRecord) > r->size)
+                continue;
+            const TsRecord *rec = (const TsRecord *)(r->base + e->offset);
+            for (uint32_t i = 0; i < e->count; i++)
+            {
+                int32_t x = rec[i].x, z = rec[i].z;
+                if (x < minX || x > maxX || z < minZ || z > maxZ)
+                    continue;
+                if (fn)
+                    fn(ctx, x, z);
+                hits++;
+            }
+        }
+    }
+    return hits;
+}
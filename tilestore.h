@@ -0,0 +1,147 @@
+#ifndef TILESTORE_H_
+#define TILESTORE_H_
+
+// Tiled on-disk result store.
+//
+// One store file holds every hit of one structure type for one seed and
+// Minecraft version. The region grid is cut into square tiles of
+// TS_TILE_REGIONS x TS_TILE_REGIONS regions. The file is laid out as
+//
+//     TsHeader                       (fixed, TS_HEADER_SIZE bytes)
+//     TsTileEntry[tilesAxis^2]       (dense tile directory, row-major by tx)
+//     record blocks                  (TsRecord[count] per stored tile)
+//
+// All integers are stored little-endian in native layout. Tiles are
+// appended in whatever order the scanner finishes them; the directory
+// entry of a tile is written once its record block is on disk.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define TS_MAGIC            0x53544653u     // "SFTS"
+#define TS_FORMAT_VERSION   1
+#define TS_HEADER_SIZE      128
+#define TS_TILE_SHIFT       8
+#define TS_TILE_REGIONS     (1 << TS_TILE_SHIFT)
+#define TS_MIN_REGION       (-58594)
+#define TS_REGIONS_AXIS     117188
+#define TS_TILES_AXIS       ((TS_REGIONS_AXIS + TS_TILE_REGIONS - 1) / TS_TILE_REGIONS)
+
+// Tile entry flags
+#define TS_TILE_SCANNED     0x1u    // the tile's scanned rect is valid
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    int64_t  seed;
+    int32_t  mc;
+    int32_t  type;
+    int32_t  regionBlocks;  // width of one region of this type in blocks
+    int32_t  tileShift;
+    int32_t  minRegion;
+    int32_t  tilesAxis;
+    uint64_t fingerprint;   // 0 when the store is not used as a cache
+    uint64_t dirOffset;
+    uint64_t recordCount;
+    char     label[32];
+    uint8_t  reserved[TS_HEADER_SIZE - 96];
+} TsHeader;
+
+typedef struct
+{
+    uint64_t offset;        // byte offset of the record block, 0 = not stored
+    uint32_t count;         // number of records in the block
+    uint32_t flags;
+    uint16_t rx0, rz0;      // scanned region rect, tile-local, half-open
+    uint16_t rx1, rz1;
+} TsTileEntry;
+
+typedef struct
+{
+    int32_t x;
+    int32_t z;
+} TsRecord;
+
+// Writer ------------------------------------------------------------------
+
+typedef struct TileStore TileStore;
+
+// Creates a new store at path, truncating any existing file. Only the
+// identifying fields of hdr (seed, mc, type, regionBlocks, fingerprint,
+// label) are used; layout fields are filled in by the store.
+TileStore *ts_create(const char *path, const TsHeader *hdr);
+
+// Reopens an existing store so more tiles can be added or replaced.
+// Returns NULL if the file is missing or has a different layout; the
+// caller checks the identifying fields through ts_header().
+TileStore *ts_open_append(const char *path);
+
+const TsHeader *ts_header(const TileStore *ts);
+
+// Directory entry of tile (tx, tz) as currently known to the writer.
+const TsTileEntry *ts_tile_entry(const TileStore *ts, int tx, int tz);
+
+// Reads the record block described by e into recs (e->count entries).
+// Safe to call while other threads write. Returns 0 on success.
+int ts_read_tile(TileStore *ts, const TsTileEntry *e, TsRecord *recs);
+
+// Writes the record block of tile (tx, tz) and publishes its directory
+// entry, replacing any previous block of that tile. The scanned rect is
+// given in tile-local region units. Safe to call from several threads.
+// Returns 0 on success.
+int ts_put_tile(TileStore *ts, int tx, int tz, const TsRecord *recs,
+    uint32_t count, int rx0, int rz0, int rx1, int rz1);
+
+// Finalises the header and closes the file. Returns 0 on success.
+int ts_close(TileStore *ts);
+
+// Reader ------------------------------------------------------------------
+
+typedef struct
+{
+    const TsHeader    *hdr;
+    const TsTileEntry *dir;
+    const char        *base;
+    uint64_t           size;
+#ifdef _WIN32
+    void              *hFile;
+    void              *hMapping;
+#else
+    int                fd;
+#endif
+} TsReader;
+
+typedef void (*TsVisitFn)(void *ctx, int32_t x, int32_t z);
+
+// Maps a store read-only. Returns 0 on success, -1 with a message on
+// stderr otherwise.
+int ts_open_read(TsReader *r, const char *path);
+void ts_close_read(TsReader *r);
+
+// Returns 1 if the first bytes of the file at path carry the store magic.
+int ts_is_store(const char *path);
+
+// Visits every record with minX <= x <= maxX and minZ <= z <= maxZ,
+// touching only the tiles that intersect the box. fn may be NULL to just
+// count. Returns the number of matching records.
+uint64_t ts_query(const TsReader *r, int32_t minX, int32_t minZ,
+    int32_t maxX, int32_t maxZ, TsVisitFn fn, void *ctx);
+
+// Region index of a block coordinate for this store's region size.
+static inline int ts_block_to_region(const TsHeader *h, int32_t v)
+{
+    int b = h->regionBlocks;
+    return v >= 0 ? v / b : -((-(int64_t)v + b - 1) / b);
+}
+
+// Tile index (0..tilesAxis-1) of a region index, or -1 outside the grid.
+static inline int ts_region_to_tile(int region)
+{
+    int rel = region - TS_MIN_REGION;
+    if (rel < 0 || rel >= TS_REGIONS_AXIS)
+        return -1;
+    return rel >> TS_TILE_SHIFT;
+}
+
+#endif